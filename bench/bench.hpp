@@ -0,0 +1,61 @@
+#ifndef BENCH_HPP
+#define BENCH_HPP
+
+#include <acevm/instructions.hpp>
+
+#include <vector>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+
+/** Assembles raw bytecode in memory so benchmarks do not depend on files. */
+class BytecodeBuilder {
+public:
+    inline size_t Position() const { return m_bytes.size(); }
+    inline std::vector<char> &GetBytes() { return m_bytes; }
+
+    template <typename T>
+    inline void Write(T value)
+    {
+        char bytes[sizeof(T)];
+        std::memcpy(bytes, &value, sizeof(T));
+        m_bytes.insert(m_bytes.end(), bytes, bytes + sizeof(T));
+    }
+
+    inline void Op(Instructions code) { Write<uint8_t>(code); }
+
+    inline void Op(Instructions code, uint8_t a) { Op(code); Write(a); }
+
+    inline void Op(Instructions code, uint8_t a, uint8_t b) { Op(code, a); Write(b); }
+
+    inline void Op(Instructions code, uint8_t a, uint8_t b, uint8_t c) { Op(code, a, b); Write(c); }
+
+    /** Emit STORE_STATIC_ADDRESS with a placeholder, returns where to patch it. */
+    inline size_t StaticAddress()
+    {
+        Op(STORE_STATIC_ADDRESS);
+        size_t at = Position();
+        Write<uint32_t>(0);
+        return at;
+    }
+
+    inline void Patch(size_t at, uint32_t value)
+    {
+        std::memcpy(&m_bytes[at], &value, sizeof(value));
+    }
+
+private:
+    std::vector<char> m_bytes;
+};
+
+template <typename Function>
+inline double TimeSeconds(Function function)
+{
+    auto start = std::chrono::high_resolution_clock::now();
+    function();
+    auto end = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration_cast<std::chrono::duration<double, std::ratio<1>>>(end - start).count();
+}
+
+#endif
@@ -0,0 +1,87 @@
+// measures the memory taken by the constant pool of a program that
+// stores many equal strings and functions, with and without interning.
+
+#include "bench.hpp"
+
+#include <acevm/vm.hpp>
+#include <acevm/heap_value.hpp>
+#include <acevm/bytecode_stream.hpp>
+#include <acevm/decoder.hpp>
+
+#include <common/utf8.hpp>
+
+#include <string>
+#include <cstdlib>
+
+/** Bytes held by static memory: its slots, and the strings they point to. */
+static size_t StaticBytes(VM &vm, size_t num_statics)
+{
+    size_t bytes = num_statics * sizeof(StackValue);
+
+    for (size_t i = 0; i < num_statics; i++) {
+        const StackValue &sv = vm.GetStaticMemory()[i];
+        if (sv.GetType() == StackValue::HEAP_POINTER && sv.GetHeapPointer() != nullptr) {
+            const utf::Utf8String &str = sv.GetHeapPointer()->Get<utf::Utf8String>();
+            bytes += sizeof(HeapValue) + sizeof(utf::Utf8String);
+            if (!str.IsInline() && !str.IsBorrowed()) {
+                bytes += str.GetBufferSize();
+            }
+        }
+    }
+
+    return bytes;
+}
+
+int main(int argc, char *argv[])
+{
+    int num_constants = argc > 1 ? std::atoi(argv[1]) : 60000;
+    int num_distinct = argc > 2 ? std::atoi(argv[2]) : 500;
+
+    // string literals and functions that repeat throughout the program,
+    // the way a compiler emits one constant per use
+    BytecodeBuilder bb;
+    for (int i = 0; i < num_constants; i++) {
+        int value = i % num_distinct;
+        if (i % 4 == 3) {
+            bb.Op(STORE_STATIC_FUNCTION);
+            bb.Write<uint32_t>(0);
+            bb.Write<uint8_t>(value % 8);
+        } else {
+            std::string str = "a string literal that is used in many places #" + std::to_string(value);
+            bb.Op(STORE_STATIC_STRING);
+            bb.Write<uint32_t>(str.size());
+            for (char ch : str) {
+                bb.Write(ch);
+            }
+        }
+    }
+    bb.Op(LOAD_STATIC, 0); bb.Write<uint16_t>(num_constants - 1);
+    bb.Op(EXIT);
+
+    std::vector<char> &bytes = bb.GetBytes();
+
+    for (int interning = 0; interning < 2; interning++) {
+        BytecodeStream bs(bytes.data(), bytes.size());
+
+        Program program;
+        Decoder decoder(&bs);
+        decoder.SetInterning(interning != 0);
+        if (!decoder.Decode(program)) {
+            std::printf("decoder: %s\n", decoder.GetError().c_str());
+            return 1;
+        }
+
+        VM vm(&program);
+        size_t num_statics = 0;
+        double seconds = TimeSeconds([&]() {
+            vm.Initialize();
+            num_statics = vm.GetStaticMemory().Size();
+        });
+
+        std::printf("%s: %d constants, %d slots, %d bytes, initialized in %.3f ms\n",
+            interning ? "interned" : "not interned", num_constants, (int)num_statics,
+            (int)StaticBytes(vm, num_statics), seconds * 1e3);
+    }
+
+    return 0;
+}
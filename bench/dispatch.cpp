@@ -0,0 +1,109 @@
+// measures interpreter dispatch cost on a branch-heavy loop.
+// build once normally and once with -DACEVM_NO_COMPUTED_GOTO
+// to compare threaded dispatch against the switch fallback.
+
+#include "bench.hpp"
+
+#include <acevm/vm.hpp>
+#include <acevm/bytecode_stream.hpp>
+#include <acevm/decoder.hpp>
+#include <acevm/verifier.hpp>
+
+#include <cstdlib>
+
+int main(int argc, char *argv[])
+{
+    int32_t iterations = argc > 1 ? std::atoi(argv[1]) : 10000000;
+
+    BytecodeBuilder bb;
+    size_t loop_at = bb.StaticAddress(); // static #0
+    size_t skip_at = bb.StaticAddress(); // static #1
+
+    bb.Op(LOAD_I32, 0); bb.Write<int32_t>(0);          // r0 = counter
+    bb.Op(LOAD_I32, 1); bb.Write<int32_t>(iterations); // r1 = limit
+    bb.Op(LOAD_I32, 2); bb.Write<int32_t>(1);          // r2 = 1
+    bb.Op(LOAD_I32, 5); bb.Write<int32_t>(0);          // r5 = accumulator
+    bb.Op(LOAD_I32, 6); bb.Write<int32_t>(0);          // r6 = toggle
+    bb.Op(LOAD_STATIC, 3); bb.Write<uint16_t>(0);
+    bb.Op(LOAD_STATIC, 4); bb.Write<uint16_t>(1);
+
+    // loop body alternates between taking and skipping a branch
+    bb.Patch(loop_at, bb.Position());
+    bb.Op(ADD, 0, 2, 0);
+    bb.Op(SUB, 2, 6, 6);
+    bb.Op(CMPZ, 6);
+    bb.Op(JE, 4);
+    bb.Op(ADD, 5, 2, 5);
+    bb.Patch(skip_at, bb.Position());
+    bb.Op(CMP, 1, 0);
+    bb.Op(JG, 3);
+    bb.Op(EXIT);
+
+    // 6 instructions per iteration, plus the add on every other one
+    double num_ops = (double)iterations * 6.0 + (double)(iterations / 2);
+
+    std::vector<char> &bytes = bb.GetBytes();
+    BytecodeStream bs(bytes.data(), bytes.size());
+
+    Program program;
+    Decoder decoder(&bs);
+    decoder.Decode(program);
+
+    double seconds;
+    {
+        // only the interpreter is measured here
+        VM vm(&program);
+        vm.GetJit().SetEnabled(false);
+        seconds = TimeSeconds([&vm]() { vm.Execute(); });
+    }
+
+#ifdef ACEVM_COMPUTED_GOTO
+    const char *mode = "computed goto";
+#else
+    const char *mode = "switch";
+#endif
+
+    std::printf("dispatch (%s): %d iterations, %.3f s, %.3f ns/op\n",
+        mode, (int)iterations, seconds, seconds * 1e9 / num_ops);
+
+    {
+        // the same loop without the runtime checks
+        Program verified_program;
+        BytecodeStream verified_bs(bytes.data(), bytes.size());
+        Decoder verified_decoder(&verified_bs);
+        verified_decoder.Decode(verified_program);
+
+        Verifier verifier(&verified_program);
+        if (verifier.Verify() != VERIFY_OK) {
+            std::printf("verifier: %s\n", verifier.GetError().c_str());
+            return 1;
+        }
+
+        VM vm(&verified_program);
+        vm.GetJit().SetEnabled(false);
+        vm.SetVerified(verifier.GetMaxStackDepth());
+        seconds = TimeSeconds([&vm]() { vm.Execute(); });
+
+        std::printf("dispatch (%s, verified): %d iterations, %.3f s, %.3f ns/op\n",
+            mode, (int)iterations, seconds, seconds * 1e9 / num_ops);
+    }
+
+#ifdef ACEVM_JIT
+    {
+        // the same loop once it has been compiled
+        Program jit_program;
+        BytecodeStream jit_bs(bytes.data(), bytes.size());
+        Decoder jit_decoder(&jit_bs);
+        jit_decoder.Decode(jit_program);
+
+        VM vm(&jit_program);
+        vm.GetJit().SetThreshold(1);
+        seconds = TimeSeconds([&vm]() { vm.Execute(); });
+
+        std::printf("dispatch (jit): %d iterations, %.3f s, %.3f ns/op\n",
+            (int)iterations, seconds, seconds * 1e9 / num_ops);
+    }
+#endif
+
+    return 0;
+}
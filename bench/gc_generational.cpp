@@ -0,0 +1,70 @@
+// measures a loop of NEW instructions where 15 of every 16 objects die
+// right away and the rest are kept in a list, with and without a nursery.
+
+#include "bench.hpp"
+
+#include <acevm/vm.hpp>
+#include <acevm/bytecode_stream.hpp>
+#include <acevm/decoder.hpp>
+
+#include <cstdlib>
+
+int main(int argc, char *argv[])
+{
+    int iterations = argc > 1 ? std::atoi(argv[1]) : 200000;
+    const int per_iteration = 16;
+
+    BytecodeBuilder builder;
+    size_t loop_at = builder.StaticAddress();
+    builder.Op(STORE_STATIC_TYPE, 2);
+
+    // r6 holds the head of the list in its first member
+    builder.Op(NEW, 6); builder.Write<uint16_t>(1);
+    builder.Op(LOAD_I32, 0); builder.Write<int32_t>(0);
+    builder.Op(LOAD_I32, 1); builder.Write<int32_t>(iterations);
+    builder.Op(LOAD_I32, 2); builder.Write<int32_t>(1);
+    builder.Op(LOAD_STATIC, 3); builder.Write<uint16_t>(0);
+
+    builder.Patch(loop_at, builder.Position());
+    for (int i = 1; i < per_iteration; i++) {
+        builder.Op(NEW, 7); builder.Write<uint16_t>(1);
+        builder.Op(MOV_MEM, 7, 1, 0);
+    }
+    // an old object is given a new one, through the write barrier
+    builder.Op(NEW, 7); builder.Write<uint16_t>(1);
+    builder.Op(LOAD_MEM, 4, 6, 0);
+    builder.Op(MOV_MEM, 7, 0, 4);
+    builder.Op(MOV_MEM, 6, 0, 7);
+    builder.Op(ADD, 0, 2, 0);
+    builder.Op(CMP, 1, 0);
+    builder.Op(JG, 3);
+    builder.Op(EXIT);
+
+    for (size_t nursery_size : { (size_t)0, Nursery::default_size }) {
+        BytecodeStream stream(builder.GetBytes().data(), builder.GetBytes().size());
+        Program program;
+        Decoder decoder(&stream);
+        if (!decoder.Decode(program)) {
+            return 1;
+        }
+
+        VM vm(&program, Stack::default_limit, nursery_size);
+        double seconds = TimeSeconds([&]() {
+            vm.Execute();
+        });
+
+        const GcStats &stats = vm.GetGcStats();
+        std::printf("%s: %.1f ns per NEW\n", nursery_size != 0 ? "nursery" : "heap only",
+            seconds * 1e9 / (iterations * (double)per_iteration));
+        if (stats.m_minor_collections != 0) {
+            std::printf("\t%d minor collections, %.1f us on average, %.1f us at most, %d promoted\n",
+                (int)stats.m_minor_collections,
+                stats.m_minor_seconds * 1e6 / stats.m_minor_collections,
+                stats.m_minor_max_seconds * 1e6, (int)stats.m_promoted);
+        }
+        std::printf("\t%d full collections, %.1f ms in total\n",
+            (int)stats.m_major_collections, stats.m_major_seconds * 1e3);
+    }
+
+    return 0;
+}
@@ -0,0 +1,76 @@
+// measures the pauses of full collections while a program keeps a large
+// list alive and churns through short-lived objects, stopping the world
+// for each collection, marking in slices with a few pause budgets, and
+// marking on a thread of its own.
+
+#include "bench.hpp"
+
+#include <acevm/vm.hpp>
+#include <acevm/bytecode_stream.hpp>
+#include <acevm/decoder.hpp>
+
+#include <cstdlib>
+
+int main(int argc, char *argv[])
+{
+    int iterations = argc > 1 ? std::atoi(argv[1]) : 400000;
+    const int per_iteration = 8;
+
+    BytecodeBuilder builder;
+    size_t loop_at = builder.StaticAddress();
+    builder.Op(STORE_STATIC_TYPE, 2);
+
+    // r6 holds the head of the list in its first member
+    builder.Op(NEW, 6); builder.Write<uint16_t>(1);
+    builder.Op(LOAD_I32, 0); builder.Write<int32_t>(0);
+    builder.Op(LOAD_I32, 1); builder.Write<int32_t>(iterations);
+    builder.Op(LOAD_I32, 2); builder.Write<int32_t>(1);
+    builder.Op(LOAD_STATIC, 3); builder.Write<uint16_t>(0);
+
+    builder.Patch(loop_at, builder.Position());
+    for (int i = 1; i < per_iteration; i++) {
+        builder.Op(NEW, 7); builder.Write<uint16_t>(1);
+        builder.Op(MOV_MEM, 7, 1, 0);
+    }
+    builder.Op(NEW, 7); builder.Write<uint16_t>(1);
+    builder.Op(LOAD_MEM, 4, 6, 0);
+    builder.Op(MOV_MEM, 7, 0, 4);
+    builder.Op(MOV_MEM, 6, 0, 7);
+    builder.Op(ADD, 0, 2, 0);
+    builder.Op(CMP, 1, 0);
+    builder.Op(JG, 3);
+    builder.Op(EXIT);
+
+    struct Config {
+        uint32_t budget;
+        bool concurrent;
+    };
+
+    for (Config config : { Config { 0, false }, Config { 1000, false }, Config { 250, false },
+            Config { 50, false }, Config { 0, true }, Config { 50, true } }) {
+        BytecodeStream stream(builder.GetBytes().data(), builder.GetBytes().size());
+        Program program;
+        Decoder decoder(&stream);
+        if (!decoder.Decode(program)) {
+            return 1;
+        }
+
+        VM vm(&program);
+        vm.SetGcPauseBudget(config.budget);
+        vm.SetGcConcurrent(config.concurrent);
+        double seconds = TimeSeconds([&]() {
+            vm.Execute();
+        });
+
+        const GcStats &stats = vm.GetGcStats();
+        std::printf("budget %4u us%s: %.1f ns per NEW, %d full collections in %d pauses\n"
+            "\tmedian %.0f us, p90 %.0f us, p99 %.0f us, longest %.0f us, %.1f ms marking concurrently\n",
+            config.budget, config.concurrent ? ", concurrent" : "", seconds * 1e9 / (iterations * (double)per_iteration),
+            (int)stats.m_major_collections, (int)stats.m_slice_seconds.size(),
+            stats.SlicePercentile(0.5) * 1e6, stats.SlicePercentile(0.9) * 1e6,
+            stats.SlicePercentile(0.99) * 1e6, stats.SlicePercentile(1.0) * 1e6,
+            stats.m_concurrent_seconds * 1e3);
+    }
+
+    return 0;
+}
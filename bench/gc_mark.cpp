@@ -0,0 +1,57 @@
+// measures a run of the gc over a heap where everything is alive:
+// a linked list in shuffled order, which the old recursive marker
+// could not get through, and a binary tree.
+
+#include "bench.hpp"
+
+#include <acevm/vm.hpp>
+#include <acevm/object.hpp>
+
+#include <vector>
+#include <algorithm>
+#include <random>
+#include <cstdlib>
+
+static void Link(HeapValue *from, int member, HeapValue *to)
+{
+    from->Get<Object>().GetMember(member).SetHeapPointer(to);
+}
+
+int main(int argc, char *argv[])
+{
+    int num_objects = argc > 1 ? std::atoi(argv[1]) : 500000;
+
+    for (int shape = 0; shape < 2; shape++) {
+        Program program;
+        VM vm(&program);
+        Heap &heap = vm.GetHeap();
+
+        std::vector<HeapValue*> objects(num_objects);
+        for (HeapValue *&hv : objects) {
+            hv = heap.Alloc(Object::SizeFor(2));
+            hv->Emplace<Object>(2);
+        }
+        std::shuffle(objects.begin(), objects.end(), std::mt19937(42));
+
+        for (int i = 1; i < num_objects; i++) {
+            if (shape == 0) {
+                Link(objects[i - 1], 0, objects[i]);
+            } else {
+                Link(objects[(i - 1) / 2], (i - 1) % 2, objects[i]);
+            }
+        }
+
+        // the only root
+        vm.GetExecutionThread().m_regs[0].SetHeapPointer(objects[0]);
+
+        double seconds = TimeSeconds([&]() {
+            vm.MarkObjects(&vm.GetExecutionThread());
+            heap.Sweep();
+        });
+
+        std::printf("%s: %.1f ns per object (%d alive)\n",
+            shape == 0 ? "list" : "tree", seconds * 1e9 / num_objects, (int)heap.Size());
+    }
+
+    return 0;
+}
@@ -0,0 +1,51 @@
+// measures what a loop of NEW instructions costs the heap: allocating
+// objects, and sweeping them when most have become garbage.
+
+#include "bench.hpp"
+
+#include <acevm/heap_memory.hpp>
+#include <acevm/object.hpp>
+
+#include <vector>
+#include <cstdlib>
+
+int main(int argc, char *argv[])
+{
+    int iterations = argc > 1 ? std::atoi(argv[1]) : 2000000;
+    // objects allocated between two collections, like GC_THRESHOLD_MAX
+    const int batch = 1000;
+
+    for (int num_members : { 0, 4, 16 }) {
+        Heap heap;
+        std::vector<HeapValue*> live;
+        double sweep_seconds = 0;
+
+        double seconds = TimeSeconds([&]() {
+            for (int i = 0; i < iterations; i += batch) {
+                for (int j = 0; j < batch; j++) {
+                    HeapValue *hv = heap.Alloc(Object::SizeFor(num_members));
+                    hv->Emplace<Object>(num_members);
+                    if (j % 16 == 0) {
+                        live.push_back(hv);
+                    }
+                }
+
+                // new objects start out marked, a collection
+                // keeps one in every 16 of them alive
+                sweep_seconds += TimeSeconds([&]() {
+                    heap.Sweep();
+                    for (HeapValue *hv : live) {
+                        hv->GetFlags() |= GC_MARKED;
+                    }
+                    heap.Sweep();
+                });
+                live.clear();
+            }
+        });
+
+        std::printf("%2d members: %.1f ns per NEW, of which %.1f ns sweeping (%d left)\n",
+            num_members, seconds * 1e9 / iterations, sweep_seconds * 1e9 / iterations, (int)heap.Size());
+    }
+
+    return 0;
+}
@@ -0,0 +1,64 @@
+// measures following references between objects the way LOAD_MEM
+// does, over more objects than fit in the cache, and how many bytes
+// of the heap an object of each size takes up.
+
+#include "bench.hpp"
+
+#include <acevm/heap_memory.hpp>
+#include <acevm/object.hpp>
+
+#include <vector>
+#include <algorithm>
+#include <random>
+#include <cstdlib>
+
+/** Bytes of the cell that the heap puts an object with size members in. */
+static size_t CellSize(int size)
+{
+    size_t bytes = sizeof(HeapValue) + Object::SizeFor(size);
+    for (uint32_t cell_size : Heap::size_classes) {
+        if (cell_size >= bytes) {
+            return cell_size;
+        }
+    }
+    return (bytes + 15) & ~(size_t)15;
+}
+
+int main(int argc, char *argv[])
+{
+    int num_objects = argc > 1 ? std::atoi(argv[1]) : 1000000;
+
+    for (int size : { 1, 4 }) {
+        Heap heap;
+        std::vector<HeapValue*> objects(num_objects);
+        for (HeapValue *&hv : objects) {
+            hv = heap.Alloc(Object::SizeFor(size));
+            hv->Emplace<Object>(size);
+        }
+
+        // member 0 of each object refers to the next one,
+        // in an order that defeats the prefetcher
+        std::vector<HeapValue*> order(objects);
+        std::shuffle(order.begin(), order.end(), std::mt19937(42));
+        for (int i = 0; i < num_objects; i++) {
+            order[i]->Get<Object>().GetMember(0).SetHeapPointer(order[(i + 1) % num_objects]);
+        }
+
+        HeapValue *hv = order[0];
+        double seconds = TimeSeconds([&]() {
+            for (int i = 0; i < num_objects; i++) {
+                Object *obj = hv->GetPointer<Object>();
+                hv = obj->GetMember(0).GetHeapPointer();
+            }
+        });
+
+        std::printf("%d members: %.2f ns per member load (%d)\n",
+            size, seconds * 1e9 / num_objects, (int)(hv == order[0]));
+    }
+
+    for (int size : { 0, 1, 4, 16 }) {
+        std::printf("%2d members: %d bytes per object\n", size, (int)CellSize(size));
+    }
+
+    return 0;
+}
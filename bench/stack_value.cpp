@@ -0,0 +1,105 @@
+// measures the memory taken by values and the cost of copying them.
+// build once normally and once with -DACEVM_NAN_BOXING to compare
+// the tagged layout against NaN-boxed values.
+
+#include "bench.hpp"
+
+#include <acevm/vm.hpp>
+#include <acevm/object.hpp>
+#include <acevm/bytecode_stream.hpp>
+#include <acevm/decoder.hpp>
+#include <acevm/verifier.hpp>
+
+#include <cstdlib>
+
+int main(int argc, char *argv[])
+{
+    int32_t iterations = argc > 1 ? std::atoi(argv[1]) : 10000000;
+
+#ifdef ACEVM_NAN_BOXING
+    const char *layout = "nan-boxed";
+#else
+    const char *layout = "tagged";
+#endif
+
+    // memory that holds values in every VM
+    const int object_members = 16;
+    std::printf("stack value (%s): %d bytes\n", layout, (int)sizeof(StackValue));
+    std::printf("  registers:     %d bytes\n", (int)(8 * sizeof(StackValue)));
+    std::printf("  stack:         %d bytes\n", (int)(Stack::default_limit * sizeof(StackValue)));
+    std::printf("  1000 statics:  %d bytes\n", (int)(1000 * sizeof(StackValue)));
+    std::printf("  object with %d members: %d bytes\n", object_members,
+        (int)(sizeof(Object) + object_members * sizeof(StackValue)));
+
+    {
+        // copies of a whole stack back and forth, one value at a time
+        std::vector<StackValue> a(Stack::default_limit), b(Stack::default_limit);
+        for (size_t i = 0; i < a.size(); i++) {
+            a[i].SetInt32((int32_t)i);
+        }
+
+        int rounds = std::max(2, iterations / (int)a.size() * 10);
+        double seconds = TimeSeconds([&]() {
+            for (int round = 0; round < rounds; round++) {
+                std::vector<StackValue> &src = (round & 1) ? b : a;
+                std::vector<StackValue> &dst = (round & 1) ? a : b;
+                for (size_t i = 1; i < src.size(); i++) {
+                    dst[i] = src[i - 1];
+                }
+            }
+        });
+
+        double copies = (double)rounds * (a.size() - 1);
+        std::printf("copy (%s): %.0f values, %.3f s, %.3f ns/value, %.2f GB/s\n",
+            layout, copies, seconds, seconds * 1e9 / copies,
+            copies * sizeof(StackValue) / seconds / 1e9);
+    }
+
+    // a loop that moves values between registers and the stack
+    BytecodeBuilder bb;
+    size_t loop_at = bb.StaticAddress(); // static #0
+
+    bb.Op(LOAD_I32, 0); bb.Write<int32_t>(0);          // r0 = counter
+    bb.Op(LOAD_I32, 1); bb.Write<int32_t>(iterations); // r1 = limit
+    bb.Op(LOAD_I32, 2); bb.Write<int32_t>(1);          // r2 = 1
+    bb.Op(LOAD_F64, 5); bb.Write<double>(0.5);         // r5 = a double
+    bb.Op(LOAD_STATIC, 3); bb.Write<uint16_t>(0);
+
+    bb.Patch(loop_at, bb.Position());
+    bb.Op(PUSH, 0);
+    bb.Op(PUSH, 5);
+    bb.Op(MOV); bb.Write<uint16_t>(2); bb.Write<uint8_t>(5);
+    bb.Op(LOAD_LOCAL, 6); bb.Write<uint16_t>(1);
+    bb.Op(LOAD_LOCAL, 7); bb.Write<uint16_t>(2);
+    bb.Op(POP);
+    bb.Op(POP);
+    bb.Op(ADD, 0, 2, 0);
+    bb.Op(CMP, 1, 0);
+    bb.Op(JG, 3);
+    bb.Op(EXIT);
+
+    double num_ops = (double)iterations * 10.0;
+
+    std::vector<char> &bytes = bb.GetBytes();
+    BytecodeStream bs(bytes.data(), bytes.size());
+
+    Program program;
+    Decoder decoder(&bs);
+    decoder.Decode(program);
+
+    Verifier verifier(&program);
+    if (verifier.Verify() != VERIFY_OK) {
+        std::printf("verifier: %s\n", verifier.GetError().c_str());
+        return 1;
+    }
+
+    VM vm(&program);
+    vm.GetJit().SetEnabled(false);
+    vm.SetVerified(verifier.GetMaxStackDepth());
+    double seconds = TimeSeconds([&vm]() { vm.Execute(); });
+
+    std::printf("push/mov/load_local (%s): %d iterations, %.3f s, %.3f ns/op\n",
+        layout, (int)iterations, seconds, seconds * 1e9 / num_ops);
+
+    return 0;
+}
@@ -0,0 +1,71 @@
+// measures building a string out of many short pieces, as a loop
+// doing s = s + piece does, with Utf8String and with StringBuilder.
+// the time per append should stay flat for the builder as the
+// number of pieces grows, and grow with it for Utf8String. the
+// forked loop also does t = s + ">" every time, which appends to a
+// builder that is no longer the newest.
+
+#include "bench.hpp"
+
+#include <acevm/string_builder.hpp>
+#include <common/utf8.hpp>
+
+#include <cstdlib>
+
+int main(int argc, char *argv[])
+{
+    int max_pieces = argc > 1 ? std::atoi(argv[1]) : 64000;
+
+    const utf::Utf8String piece("piece, ");
+    const utf::Utf8String fork(">");
+
+    for (int pieces = 1000; pieces <= max_pieces; pieces *= 4) {
+        size_t total = 0;
+
+        double string_seconds = TimeSeconds([&]() {
+            utf::Utf8String str;
+            for (int i = 0; i < pieces; i++) {
+                str = str + piece;
+            }
+            total += str.GetLength();
+        });
+
+        double builder_seconds = TimeSeconds([&]() {
+            StringBuilder builder(utf::Utf8String(""));
+            for (int i = 0; i < pieces; i++) {
+                builder = builder.Append(piece);
+            }
+            total += builder.Flatten().GetLength();
+        });
+
+        std::printf("%6d pieces: Utf8String %.1f ns, StringBuilder %.1f ns per append (%d)\n",
+            pieces, string_seconds * 1e9 / pieces, builder_seconds * 1e9 / pieces, (int)(total & 1));
+    }
+
+    for (int pieces = 1000; pieces <= max_pieces; pieces *= 4) {
+        size_t total = 0;
+
+        double string_seconds = TimeSeconds([&]() {
+            utf::Utf8String str;
+            for (int i = 0; i < pieces; i++) {
+                str = str + piece;
+                utf::Utf8String forked = str + fork;
+                total += forked.GetByteLength();
+            }
+        });
+
+        double builder_seconds = TimeSeconds([&]() {
+            StringBuilder builder(utf::Utf8String(""));
+            for (int i = 0; i < pieces; i++) {
+                builder = builder.Append(piece);
+                StringBuilder forked = builder.Append(fork);
+                total += forked.GetByteLength();
+            }
+        });
+
+        std::printf("%6d pieces, forked: Utf8String %.1f ns, StringBuilder %.1f ns per append (%d)\n",
+            pieces, string_seconds * 1e9 / pieces, builder_seconds * 1e9 / pieces, (int)(total & 1));
+    }
+
+    return 0;
+}
@@ -0,0 +1,174 @@
+// measures the throughput of the UTF-8 kernels on ASCII-only and
+// mixed-script text, for each set of kernels the CPU supports. first
+// checks that they give the scalar results for random input, valid
+// UTF-8 or not.
+
+#include "bench.hpp"
+
+#include <common/utf8.hpp>
+
+#include <string>
+#include <random>
+#include <cstdlib>
+
+/** utf8_strcmp() as the scalar kernel computes it, or 2 where that kernel
+    would not stop, or would read past the end of either string. */
+static int ReferenceStrcmp(const std::string &s1, const std::string &s2)
+{
+    // the scalar kernel decodes a lead byte without checking what follows
+    auto next = [](const std::string &str, size_t &i, uint32_t &c) {
+        unsigned char lead = i < str.size() ? (unsigned char)str[i] : 0;
+        int width = lead <= 127 ? 1 : (lead & 0xE0) == 0xC0 ? 2 : (lead & 0xF0) == 0xE0 ? 3 :
+            (lead & 0xF8) == 0xF0 ? 4 : 0;
+        c = 0;
+        for (int k = 0; k < width; k++, i++) {
+            c |= (uint32_t)(i < str.size() ? (unsigned char)str[i] : 0) << (8 * k);
+        }
+        return width;
+    };
+
+    size_t i = 0, j = 0;
+    for (int steps = 0; steps <= (int)(s1.size() + s2.size()) + 1; steps++) {
+        if (i > s1.size() || j > s2.size()) {
+            return 2;
+        }
+        if (i == s1.size() && j == s2.size()) {
+            return 0;
+        }
+
+        uint32_t c1, c2;
+        int width1 = next(s1, i, c1);
+        int width2 = next(s2, j, c2);
+        if (c1 != c2) {
+            return c1 < c2 ? -1 : 1;
+        }
+        if (width1 == 0 && width2 == 0) {
+            return 2;
+        }
+    }
+
+    return 2;
+}
+
+/** Compare every set of kernels the CPU supports with the scalar ones
+    on strings made of a few interesting bytes. Returns the number of
+    results that differ. */
+static int CheckKernels()
+{
+    const char bytes[] = { 'a', 'b', 'z', '\x80', '\xbf', '\xc3', '\xa9', '\xe3', '\xf0', '\xff' };
+    std::mt19937 generator(1234);
+    int failures = 0;
+
+    for (int n = 0; n < 200000; n++) {
+        // a long shared prefix takes the vector kernels past a block or two
+        std::string prefix, s1, s2;
+        int prefix_size = generator() % 48;
+        for (int k = 0; k < prefix_size; k++) {
+            prefix += generator() % 4 != 0 ? 'a' + generator() % 26 : bytes[generator() % sizeof(bytes)];
+        }
+        s1 = prefix;
+        s2 = prefix;
+        for (int k = generator() % 6; k > 0; k--) {
+            s1 += bytes[generator() % sizeof(bytes)];
+        }
+        for (int k = generator() % 6; k > 0; k--) {
+            s2 += bytes[generator() % sizeof(bytes)];
+        }
+
+        int expected_cmp = ReferenceStrcmp(s1, s2);
+
+        // the scalar kernels read up to three bytes past the NUL
+        // when a character runs into it
+        int index = generator() % (s1.size() + 1);
+        s1.append(4, '\0');
+        s2.append(4, '\0');
+
+        utf::utf8_set_kernels(utf::UTF8_KERNELS_SCALAR);
+        int expected_len = utf::utf8_strlen(s1.c_str());
+        utf::u32char expected_char = utf::utf8_charat(s1.c_str(), index);
+
+        for (int kernels = utf::UTF8_KERNELS_SCALAR; kernels <= utf::UTF8_KERNELS_AVX2; kernels++) {
+            utf::utf8_set_kernels((utf::Utf8Kernels)kernels);
+            if (utf::utf8_get_kernels() != kernels) {
+                continue;
+            }
+
+            if ((expected_cmp != 2 && utf::utf8_strcmp(s1.c_str(), s2.c_str()) != expected_cmp) ||
+                utf::utf8_strlen(s1.c_str()) != expected_len ||
+                utf::utf8_charat(s1.c_str(), index) != expected_char) {
+                failures++;
+            }
+        }
+    }
+
+    utf::utf8_set_kernels(utf::UTF8_KERNELS_AVX2);
+    return failures;
+}
+
+int main(int argc, char *argv[])
+{
+    int iterations = argc > 1 ? std::atoi(argv[1]) : 20000;
+
+    int failures = CheckKernels();
+    if (failures != 0) {
+        std::printf("%d results differ from the scalar kernels\n", failures);
+        return 1;
+    }
+
+    std::string ascii, mixed;
+    while (ascii.size() < 4096) {
+        ascii += "The quick brown fox jumps over the lazy dog. ";
+    }
+    while (mixed.size() < 4096) {
+        mixed += "Grüße, Привет мир, 你好世界, γειά σου κόσμε! ";
+    }
+
+    const char *kernel_names[] = { "scalar", "sse2", "avx2" };
+
+    struct Text {
+        const char *m_name;
+        std::string m_str;
+    } texts[] = { { "ascii", ascii }, { "mixed", mixed } };
+
+    for (const Text &text : texts) {
+        const char *str = text.m_str.c_str();
+        // equal up to the last character, so all of it is compared
+        std::string other_str = text.m_str;
+        other_str[other_str.size() - 1] = '?';
+        const char *other = other_str.c_str();
+
+        int length = 0;
+        for (int kernels = utf::UTF8_KERNELS_SCALAR; kernels <= utf::UTF8_KERNELS_AVX2; kernels++) {
+            utf::utf8_set_kernels((utf::Utf8Kernels)kernels);
+            if (utf::utf8_get_kernels() != kernels) {
+                continue;
+            }
+
+            length = utf::utf8_strlen(str);
+            int result = 0;
+
+            double strlen_seconds = TimeSeconds([&]() {
+                for (int i = 0; i < iterations; i++) {
+                    result += utf::utf8_strlen(str);
+                }
+            });
+            double strcmp_seconds = TimeSeconds([&]() {
+                for (int i = 0; i < iterations; i++) {
+                    result += utf::utf8_strcmp(str, other);
+                }
+            });
+            double charat_seconds = TimeSeconds([&]() {
+                for (int i = 0; i < iterations; i++) {
+                    result += utf::utf8_charat(str, length - 1);
+                }
+            });
+
+            double mb = (double)text.m_str.size() * iterations / 1e6;
+            std::printf("%s (%s, %d bytes): strlen %.0f MB/s, strcmp %.0f MB/s, charat %.0f MB/s (%d)\n",
+                text.m_name, kernel_names[kernels], (int)text.m_str.size(),
+                mb / strlen_seconds, mb / strcmp_seconds, mb / charat_seconds, result & 1);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,48 @@
+// measures reading every character of a string by index, the way a
+// script loops over the characters of a string, for ASCII text and
+// for text with multibyte characters. the time per character should
+// not grow with the length of the string.
+
+#include "bench.hpp"
+
+#include <common/utf8.hpp>
+
+#include <string>
+#include <cstdlib>
+
+int main(int argc, char *argv[])
+{
+    int max_length = argc > 1 ? std::atoi(argv[1]) : 16384;
+
+    const char *pieces[] = { "ascii", "caf\xC3\xA9 \xE2\x82\xAC" };
+
+    for (const char *piece : pieces) {
+        for (int length = 256; length <= max_length; length *= 4) {
+            std::string text;
+            while ((int)utf::utf8_strlen(text.c_str()) < length) {
+                text += piece;
+            }
+
+            utf::Utf8String str(text.c_str());
+            uint32_t sum = 0;
+
+            double charat_seconds = TimeSeconds([&]() {
+                for (size_t i = 0; i < str.GetLength(); i++) {
+                    sum += utf::utf8_charat(str.GetData(), i);
+                }
+            });
+
+            double index_seconds = TimeSeconds([&]() {
+                for (size_t i = 0; i < str.GetLength(); i++) {
+                    sum += str[i];
+                }
+            });
+
+            std::printf("%-5s %6d chars: utf8_charat %.1f ns, operator[] %.1f ns per char (%d)\n",
+                str.IsAscii() ? "ascii" : "utf-8", (int)str.GetLength(),
+                charat_seconds * 1e9 / str.GetLength(), index_seconds * 1e9 / str.GetLength(), (int)(sum & 1));
+        }
+    }
+
+    return 0;
+}
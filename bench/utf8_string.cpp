@@ -0,0 +1,44 @@
+// measures copying and comparing short and long strings, the
+// operations the VM does every time a string value is copied.
+
+#include "bench.hpp"
+
+#include <common/utf8.hpp>
+
+#include <cstdlib>
+
+int main(int argc, char *argv[])
+{
+    int iterations = argc > 1 ? std::atoi(argv[1]) : 10000000;
+
+    const char *texts[] = {
+        "name",
+        "a short literal",
+        "a string that is too long to be stored inline",
+    };
+
+    for (const char *text : texts) {
+        utf::Utf8String str(text);
+        utf::Utf8String other(text);
+        size_t equal = 0;
+
+        double copy_seconds = TimeSeconds([&]() {
+            for (int i = 0; i < iterations; i++) {
+                utf::Utf8String copy(str);
+                equal += copy.GetByteLength();
+            }
+        });
+
+        double compare_seconds = TimeSeconds([&]() {
+            for (int i = 0; i < iterations; i++) {
+                equal += (str == other);
+            }
+        });
+
+        std::printf("%2d bytes (%s): copy %.3f ns, compare %.3f ns (%d)\n",
+            (int)str.GetByteLength(), str.IsInline() ? "inline" : "heap",
+            copy_seconds * 1e9 / iterations, compare_seconds * 1e9 / iterations, (int)(equal & 1));
+    }
+
+    return 0;
+}
@@ -1,4 +1,5 @@
 import os
+import sys
 
 compiler = ""
 if os.name == "nt":
@@ -8,20 +9,71 @@ else:
 
 options = "-g"
 
+# the gc can mark the heap on a thread of its own
+if os.name != "nt":
+    options = "{} -pthread".format(options)
+
 src_dir = "./src"
 bin_dir = "./bin"
+bench_dir = "./bench"
+
+# build the portable switch-based interpreter loop
+if "--no-computed-goto" in sys.argv:
+    options = "{} -DACEVM_NO_COMPUTED_GOTO".format(options)
+
+# pack values into 8 bytes instead of a tag and a union
+if "--nan-boxing" in sys.argv:
+    options = "{} -DACEVM_NAN_BOXING".format(options)
+
+# only build the scalar UTF-8 kernels
+if "--no-simd" in sys.argv:
+    options = "{} -DACEVM_NO_SIMD".format(options)
 
 if not os.path.exists(bin_dir):
     os.makedirs(bin_dir)
 
-command = "{} {} -o {}/acevm -std=c++11 -Winline -O2 -Iinclude/".format(compiler, options, bin_dir)
+def collect_sources(directory, exclude=[]):
+    sources = []
+    for dirpath, dirnames, filenames in os.walk(directory):
+        for file in [f for f in filenames]:
+            path = "{}/{}".format(dirpath, file)
+            if file.endswith(".cpp") and path not in exclude:
+                sources.append(path)
+    return sources
+
+def build(name, sources, extra_options=""):
+    command = "{} {} {} -o {}/{} -std=c++11 -Winline -O2 -Iinclude/".format(compiler, options, extra_options, bin_dir, name)
+
+    for source in sources:
+        print("{}...".format(source))
+        command = "{} {} ".format(command, source)
 
-for dirpath, dirnames, filenames in os.walk(src_dir):
-    for file in [f for f in filenames]:
+    os.system("{}".format(command))
+
+vm_main = "{}/acevm/main.cpp".format(src_dir)
+opt_dir = "{}/acevm_opt".format(src_dir)
+
+# everything except the programs' own sources
+library = [source for source in collect_sources(src_dir, exclude=[vm_main]) if not source.startswith(opt_dir)]
+
+build("acevm", library + [vm_main])
+
+# offline bytecode optimizer
+build("acevm-opt", library + collect_sources(opt_dir))
+
+# benchmarks link against the library
+if "--bench" in sys.argv:
+    for file in sorted(os.listdir(bench_dir)):
         if file.endswith(".cpp"):
-            print("{}/{}...".format(dirpath, file))
-            command = "{} {}/{} ".format(command, dirpath, file)
+            name = "bench_{}".format(file[:-len(".cpp")])
+            build(name, library + ["{}/{}".format(bench_dir, file)])
+
+            # the dispatch benchmark is also built with the switch fallback
+            if name == "bench_dispatch":
+                build("{}_switch".format(name), library + ["{}/{}".format(bench_dir, file)], "-DACEVM_NO_COMPUTED_GOTO")
 
-os.system("{}".format(command))
+            # and the value benchmark with NaN-boxed values
+            if name == "bench_stack_value":
+                build("{}_nanbox".format(name), library + ["{}/{}".format(bench_dir, file)], "-DACEVM_NAN_BOXING")
 
 print("Build complete")
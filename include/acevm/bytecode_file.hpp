@@ -0,0 +1,33 @@
+#ifndef BYTECODE_FILE_HPP
+#define BYTECODE_FILE_HPP
+
+#include <cstddef>
+
+/** The contents of a bytecode file, kept in memory for as long as the
+    program runs, since decoded strings point into it.
+
+    Regular files are mapped read-only, so every process running the
+    same program shares its pages. Pipes and other files that cannot be
+    mapped are read into a buffer instead. */
+class BytecodeFile {
+public:
+    BytecodeFile();
+    BytecodeFile(const BytecodeFile &other) = delete;
+    ~BytecodeFile();
+
+    inline const char *GetData() const { return m_data; }
+    inline size_t GetSize() const { return m_size; }
+    inline bool IsMapped() const { return m_mapped; }
+
+    /** Returns false if the file cannot be opened or read. */
+    bool Open(const char *path);
+
+private:
+    char *m_data;
+    size_t m_size;
+    bool m_mapped;
+
+    void Close();
+};
+
+#endif
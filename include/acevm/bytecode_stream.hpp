@@ -3,18 +3,19 @@
 
 #include <iostream>
 #include <cassert>
+#include <cstring>
+#include <cstdint>
 
 class BytecodeStream {
 public:
-    BytecodeStream(char *buffer, size_t size);
+    BytecodeStream(const char *buffer, size_t size);
     BytecodeStream(const BytecodeStream &other) = delete;
 
     inline void ReadBytes(char *ptr, size_t num_bytes)
     {
         assert(m_position + num_bytes < m_size + 1 && "cannot read past end of buffer");
-        for (size_t i = 0; i < num_bytes; i++) {
-            ptr[i] = m_buffer[m_position++];
-        }
+        std::memcpy(ptr, m_buffer + m_position, num_bytes);
+        m_position += num_bytes;
     }
 
     template <typename T>
@@ -23,14 +24,28 @@ public:
         ReadBytes(reinterpret_cast<char*>(ptr), num_bytes);
     }
 
+    /** View the naturally aligned value at the current position in
+        place, so that each of its fields is a single aligned load. */
+    template <typename T>
+    inline const T *ReadAligned()
+    {
+        assert(m_position + sizeof(T) < m_size + 1 && "cannot read past end of buffer");
+        assert((reinterpret_cast<uintptr_t>(m_buffer) + m_position) % alignof(T) == 0 && "unaligned read");
+        const T *ptr = reinterpret_cast<const T*>(m_buffer + m_position);
+        m_position += sizeof(T);
+        return ptr;
+    }
+
+    inline const char *GetBuffer() const { return m_buffer; }
     inline size_t Position() const { return m_position; }
     inline size_t Size() const { return m_size; }
     inline void Seek(size_t address) { m_position = address; }
     inline void Skip(size_t amount) { m_position += amount; }
     inline bool Eof() const { return m_position >= m_size; }
+    inline bool CanRead(size_t num_bytes) const { return m_position + num_bytes <= m_size; }
 
 private:
-    char *m_buffer;
+    const char *m_buffer;
     size_t m_size;
     size_t m_position;
 };
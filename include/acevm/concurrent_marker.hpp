@@ -0,0 +1,81 @@
+#ifndef CONCURRENT_MARKER_HPP
+#define CONCURRENT_MARKER_HPP
+
+#include <acevm/heap_memory.hpp>
+#include <acevm/heap_value.hpp>
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <cstddef>
+
+/** Marks the heap on a thread of its own while the VM keeps running.
+    The thread only looks at the heap with the lock held, and the VM
+    holds it to change anything that the thread may have reached: the
+    members of old objects, and the nursery when it is collected. */
+class ConcurrentMarker {
+public:
+    // values marked between two times that the lock is let go
+    static const size_t batch_size = 128;
+
+    /** Holds the lock, ahead of the marking thread. Does
+        nothing when it is given no marker. */
+    class Guard {
+    public:
+        explicit Guard(ConcurrentMarker *marker);
+        Guard(const Guard &other) = delete;
+        ~Guard();
+
+    private:
+        ConcurrentMarker *m_marker;
+    };
+
+public:
+    /** Values in nursery are left to minor collections. */
+    explicit ConcurrentMarker(const Nursery *nursery);
+    ConcurrentMarker(const ConcurrentMarker &other) = delete;
+    ~ConcurrentMarker();
+
+    /** Whether the thread has run out of values to mark. Values can
+        still be pushed after that, which Finish() marks. */
+    inline bool IsDone() const { return m_done.load(std::memory_order_acquire); }
+    /** Values marked since Start(). The lock must be held. */
+    inline size_t GetNumMarked() const { return m_num_marked; }
+
+    /** Push a value to be marked. The lock must be held. */
+    inline void Push(HeapValue *hv)
+    {
+        if (hv != nullptr && !m_nursery->Contains(hv)) {
+            m_stack.push_back(hv);
+        }
+    }
+
+    /** Have the thread mark everything reachable from the values
+        pushed so far. The lock must be held. */
+    void Start();
+    /** Mark what is left on the calling thread. The lock must be held. */
+    void Finish();
+
+private:
+    void Run();
+    /** Mark up to max_values from the stack. */
+    void Drain(size_t max_values);
+
+    const Nursery *m_nursery;
+    std::vector<HeapValue*> m_stack;
+    size_t m_num_marked;
+    bool m_marking;
+    bool m_stopping;
+    std::atomic<bool> m_done;
+    // threads waiting in a Guard, which the marking thread lets go first
+    std::atomic<int> m_num_waiting;
+
+    std::mutex m_lock;
+    std::condition_variable m_wake;
+    // started by the first Start()
+    std::thread m_thread;
+};
+
+#endif
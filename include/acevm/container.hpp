@@ -0,0 +1,96 @@
+#ifndef CONTAINER_HPP
+#define CONTAINER_HPP
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+// layout of version 2 bytecode files. every structure is a multiple of
+// 8 bytes and every section starts on an 8 byte boundary, so each
+// field can be read with a single aligned load.
+//
+//   ContainerHeader
+//   SectionEntry[m_num_sections]
+//   sections, each padded to 8 bytes
+//
+// files that do not start with the magic are read as the older flat
+// instruction stream.
+
+// "ACEB" in file order
+#define CONTAINER_MAGIC 0x42454341u
+#define CONTAINER_VERSION 2
+#define CONTAINER_ALIGNMENT 8
+
+struct ContainerHeader {
+    uint32_t m_magic;
+    uint16_t m_version;
+    uint16_t m_num_sections;
+    // total size of the file, including this header
+    uint32_t m_size;
+    // ContainerChecksum() of everything after this header
+    uint32_t m_checksum;
+};
+
+enum SectionKind : uint32_t {
+    SECTION_CONSTANTS = 1, // ConstantEntry[m_count], then string bytes and a NUL
+    SECTION_TYPES,         // TypeEntry[m_count]
+    SECTION_CODE,          // CodeEntry[m_count]
+    SECTION_DEBUG,         // uint32_t[m_count], one per code entry
+};
+
+struct SectionEntry {
+    uint32_t m_kind;
+    uint32_t m_count;
+    // from the start of the file
+    uint32_t m_offset;
+    uint32_t m_size;
+};
+
+// one slot of static memory, in the order they are stored
+struct ConstantEntry {
+    // the STORE_STATIC_* instruction that fills in the slot
+    uint8_t m_opcode;
+    // number of arguments, for functions
+    uint8_t m_nargs;
+    uint16_t m_reserved;
+    // string length, code index for addresses and
+    // functions, or index into the type section
+    uint32_t m_value;
+    // strings only, offset of the bytes from the start of the section
+    uint64_t m_string_offset;
+};
+
+struct TypeEntry {
+    // number of data members
+    uint32_t m_size;
+    uint32_t m_reserved;
+};
+
+// an instruction with the same operand layout as a decoded Instruction
+struct CodeEntry {
+    uint8_t m_opcode;
+    uint8_t m_a;
+    uint8_t m_b;
+    uint8_t m_c;
+    uint32_t m_index;
+    uint64_t m_imm;
+};
+
+static_assert(sizeof(ContainerHeader) == 16, "container header must be 16 bytes");
+static_assert(sizeof(SectionEntry) == 16, "section entry must be 16 bytes");
+static_assert(sizeof(ConstantEntry) == 16, "constant entry must be 16 bytes");
+static_assert(sizeof(CodeEntry) == 16, "code entry must be 16 bytes");
+
+/** Checksum of size bytes at data, a multiple of 8, read a word at a time. */
+inline uint32_t ContainerChecksum(const char *data, size_t size)
+{
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+        uint64_t word;
+        std::memcpy(&word, data + i, sizeof(word));
+        hash = (hash ^ word) * 0x100000001b3ull;
+    }
+    return (uint32_t)(hash ^ (hash >> 32));
+}
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef DECODER_HPP
+#define DECODER_HPP
+
+#include <acevm/bytecode_stream.hpp>
+#include <acevm/program.hpp>
+
+#include <string>
+#include <cstdint>
+
+/** Turns a raw bytecode stream into a Program of pre-decoded instructions.
+    Byte addresses stored by STORE_STATIC_ADDRESS and STORE_STATIC_FUNCTION
+    are remapped to instruction indices.
+
+    Version 2 containers (see container.hpp) are recognized by their magic.
+    Their constant pool is turned into the STORE_STATIC_* instructions that
+    start the program, followed by the code section.
+
+    Equal constants are interned: a duplicate STORE_STATIC_* becomes a NOP,
+    and LOAD_STATIC and NEW are pointed at the first slot holding the value.
+    This is visible to programs: CMP compares strings by reference, so two
+    equal string literals in different slots compare EQUAL once interned.
+    SetInterning(false) keeps every literal a string of its own. */
+class Decoder {
+public:
+    Decoder(BytecodeStream *bs);
+    Decoder(const Decoder &other) = delete;
+
+    inline const std::string &GetError() const { return m_error; }
+    /** Number of STORE_STATIC_* instructions removed as duplicates. */
+    inline size_t GetNumInterned() const { return m_num_interned; }
+    /** On by default. Turning it off keeps the identity of string literals. */
+    inline void SetInterning(bool interning) { m_interning = interning; }
+
+    /** Decode the whole stream. Returns false if the bytecode is malformed,
+        in which case GetError() describes the problem. */
+    bool Decode(Program &program);
+
+private:
+    BytecodeStream *m_bs;
+    std::string m_error;
+    bool m_interning;
+    size_t m_num_interned;
+
+    template <typename T>
+    inline bool ReadOperand(T *ptr)
+    {
+        if (!m_bs->CanRead(sizeof(T))) {
+            return false;
+        }
+        m_bs->Read(ptr);
+        return true;
+    }
+
+    bool DecodeInstruction(uint8_t code, Instruction &ins);
+    bool DecodeFlat(Program &program);
+    bool DecodeContainer(Program &program);
+    void InternConstants(Program &program);
+    void SetError(const char *message, size_t position);
+};
+
+#endif
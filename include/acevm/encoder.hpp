@@ -0,0 +1,52 @@
+#ifndef ENCODER_HPP
+#define ENCODER_HPP
+
+#include <acevm/program.hpp>
+
+#include <vector>
+#include <cstring>
+#include <cstdint>
+
+/** Turns a Program back into raw bytecode, the inverse of the Decoder.
+    Instruction indices stored by STORE_STATIC_ADDRESS and
+    STORE_STATIC_FUNCTION are relocated to byte addresses. */
+class Encoder {
+public:
+    Encoder(const Program *program);
+    Encoder(const Encoder &other) = delete;
+
+    /** Encode every instruction except the EXIT that terminates
+        each decoded program. Returns false if the program holds
+        an instruction that has no encoding. */
+    bool Encode(std::vector<char> &out);
+
+    /** Encode the program as a version 2 container. The program has to
+        start with all of its STORE_STATIC_* instructions, as compiled
+        programs do. Returns false if it does not, or if it holds an
+        instruction that has no encoding. */
+    bool EncodeContainer(std::vector<char> &out);
+
+    /** Number of bytes the instruction takes up in bytecode. */
+    static size_t EncodedSize(const Instruction &ins);
+
+private:
+    const Program *m_program;
+
+    template <typename T>
+    inline void Write(std::vector<char> &out, T value)
+    {
+        char bytes[sizeof(T)];
+        std::memcpy(bytes, &value, sizeof(T));
+        out.insert(out.end(), bytes, bytes + sizeof(T));
+    }
+
+    /** Byte address in the flat format of each instruction, and of
+        the end of the program. Returns false if an instruction has no
+        encoding. */
+    bool ComputeAddresses(std::vector<uint32_t> &address_of);
+
+    void EncodeInstruction(const Instruction &ins, const std::vector<uint32_t> &address_of,
+        std::vector<char> &out);
+};
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef EXECUTABLE_MEMORY_HPP
+#define EXECUTABLE_MEMORY_HPP
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+/** Pages of memory that native code can be copied into and run from.
+    Pages are only writable while code is being installed. */
+class ExecutableMemory {
+public:
+    static const size_t chunk_size;
+
+public:
+    ExecutableMemory();
+    ExecutableMemory(const ExecutableMemory &other) = delete;
+    ~ExecutableMemory();
+
+    inline size_t GetUsed() const { return m_used; }
+
+    /** Copy code into executable memory, returns nullptr if no memory is left. */
+    void *Install(const uint8_t *code, size_t size);
+
+private:
+    struct Chunk {
+        uint8_t *m_data;
+        size_t m_size;
+        size_t m_offset;
+    };
+
+    std::vector<Chunk> m_chunks;
+    size_t m_used;
+};
+
+#endif
@@ -4,29 +4,164 @@
 #include <acevm/heap_value.hpp>
 
 #include <ostream>
+#include <cstdint>
+#include <cstddef>
 
-struct HeapNode {
-    HeapValue value;
-    HeapNode *before = nullptr;
-    HeapNode *after = nullptr;
+// a page of cells that all have the same size. a cell is the header
+// of a heap value followed by the value itself.
+struct HeapPage {
+    HeapPage *m_next;
+    // cells freed by the last sweep, each one
+    // holding a pointer to the next in its payload
+    HeapValue *m_free;
+    uint32_t m_cell_size;
+    // cells handed out by bumping, the rest have never been used
+    uint32_t m_num_used;
+    uint32_t m_num_cells;
+    // cleared when a sweep starts, and set once it gets to this page
+    bool m_swept;
+
+    inline HeapValue *GetCell(size_t index)
+    {
+        return reinterpret_cast<HeapValue*>(reinterpret_cast<char*>(this) +
+            cells_offset + index * m_cell_size);
+    }
+
+    static const size_t cells_offset;
 };
 
 class Heap {
     friend std::ostream &operator<<(std::ostream &os, const Heap &heap);
+public:
+    /** Bytes in each page of a size class. */
+    static const size_t page_size;
+    static const size_t num_size_classes = 10;
+    /** Cell size of each class. Values that are too large for
+        all of them get a page to themselves. */
+    static const uint32_t size_classes[num_size_classes];
+
 public:
     Heap();
     Heap(const Heap &other) = delete;
     ~Heap();
 
     inline size_t Size() const { return m_num_objects; }
+    /** Values allocated since the heap was made. */
+    inline size_t GetNumAllocated() const { return m_num_allocated; }
+    inline bool IsSweeping() const { return m_sweeping; }
 
-    /** Allocate a new value on the heap. */
-    HeapValue *Alloc();
-    /** Delete all nodes that are not marked */
+    /** Allocate a new value on the heap, with payload_size bytes
+        after its header. While sweeping, a value in a page that has
+        not been swept yet starts out marked, to be kept. */
+    HeapValue *Alloc(size_t payload_size);
+    /** Delete all values that are not marked, and free
+        the pages that have nothing left in them. */
     void Sweep();
+    /** Start a sweep that is done a few pages at a time. */
+    void StartSweep();
+    /** Sweep up to max_pages more pages. Returns true
+        once every page has been swept. */
+    bool SweepPages(size_t max_pages);
+
+    /** Call function with each allocated value, in page order. */
+    template <typename Function>
+    void ForEach(Function function) const
+    {
+        for (size_t i = 0; i <= num_size_classes; i++) {
+            for (HeapPage *page = m_classes[i].m_pages; page != nullptr; page = page->m_next) {
+                for (uint32_t j = 0; j < page->m_num_used; j++) {
+                    HeapValue *hv = page->GetCell(j);
+                    if (!(hv->GetFlags() & GC_FREE)) {
+                        function(hv);
+                    }
+                }
+            }
+        }
+    }
 
 private:
-    HeapNode *m_head;
+    struct SizeClass {
+        // oldest first, new pages are bumped from at the end
+        HeapPage *m_pages;
+        HeapPage *m_last;
+        // no page before this one has free cells
+        HeapPage *m_free_page;
+    };
+
+    HeapPage *NewPage(SizeClass &size_class, uint32_t cell_size, uint32_t num_cells);
+    /** Sweep page, which comes after prev in the pages of class index.
+        Returns false if the page was freed. */
+    bool SweepPage(size_t index, HeapPage *prev, HeapPage *page);
+
+    // one more than there are size classes, the last
+    // holds the pages made for a single large value
+    SizeClass m_classes[num_size_classes + 1];
+    size_t m_num_objects;
+    size_t m_num_allocated;
+
+    bool m_sweeping;
+    // the next page to sweep, and the page before it in its class
+    size_t m_sweep_class;
+    HeapPage *m_sweep_prev;
+    HeapPage *m_sweep_page;
+};
+
+/** A block that new values are allocated from by bumping a pointer.
+    The values that are still alive once it is full are moved to the
+    heap, and then the whole block is used again. */
+class Nursery {
+public:
+    static const size_t default_size;
+
+public:
+    /** Nothing fits into a nursery with a size of 0. */
+    explicit Nursery(size_t size = default_size);
+    Nursery(const Nursery &other) = delete;
+    ~Nursery();
+
+    inline size_t Size() const { return m_num_objects; }
+
+    inline bool Contains(const HeapValue *hv) const
+    {
+        const char *address = reinterpret_cast<const char*>(hv);
+        return address >= m_begin && address < m_end;
+    }
+
+    /** Whether a value with payload_size bytes after its header is
+        small enough to be allocated here. Larger ones go to the heap. */
+    inline bool CanHold(size_t payload_size) const
+    {
+        return CellSize(payload_size) <= (size_t)(m_end - m_begin) / 4;
+    }
+
+    /** Allocate a new value with payload_size bytes
+        after its header. Returns nullptr if it is full. */
+    inline HeapValue *Alloc(size_t payload_size)
+    {
+        size_t size = CellSize(payload_size);
+        if (size > (size_t)(m_end - m_top)) {
+            return nullptr;
+        }
+
+        HeapValue *hv = new (m_top) HeapValue(size - sizeof(HeapValue));
+        m_top += size;
+        m_num_objects++;
+
+        return hv;
+    }
+
+    /** Destroy the values that are left and start over. */
+    void Reset();
+
+private:
+    static inline size_t CellSize(size_t payload_size)
+    {
+        return (sizeof(HeapValue) + payload_size + 7) & ~(size_t)7;
+    }
+
+    char *m_begin;
+    char *m_top;
+    char *m_end;
     size_t m_num_objects;
 };
 
@@ -1,106 +1,130 @@
 #ifndef HEAP_VALUE_HPP
 #define HEAP_VALUE_HPP
 
-#include <type_traits>
 #include <typeinfo>
+#include <type_traits>
+#include <utility>
+#include <new>
+#include <cassert>
 #include <cstdint>
 #include <cstdlib>
 
+class Object;
+class StringBuilder;
+namespace utf { class Utf8String; }
+
 enum HeapValueFlags {
     GC_MARKED = 0x01,
+    GC_FREE = 0x02, // a cell of the heap that is not in use
+    GC_FORWARDED = 0x04, // moved out of the nursery, see MoveTo()
+    GC_REMEMBERED = 0x08, // an old value that may refer to the nursery
 };
 
-class HeapValue {
+// what a heap value holds
+enum HeapKind : uint8_t {
+    HEAP_NONE,
+    HEAP_OBJECT,
+    HEAP_STRING,
+    HEAP_STRING_BUILDER,
+};
+
+// the kind of each type that a heap value can hold. other
+// types are left undefined, so that assigning them fails to compile.
+template <typename T> struct HeapKindOf;
+template <> struct HeapKindOf<Object> { static const HeapKind kind = HEAP_OBJECT; };
+template <> struct HeapKindOf<utf::Utf8String> { static const HeapKind kind = HEAP_STRING; };
+template <> struct HeapKindOf<StringBuilder> { static const HeapKind kind = HEAP_STRING_BUILDER; };
+
+/** The header of a value on the heap. The value itself is stored
+    right after the header, in the same allocation. */
+class alignas(8) HeapValue {
+    friend class Heap;
+    friend class Nursery;
 public:
-    HeapValue();
+    /** A header with capacity bytes after it to hold a value in. */
+    explicit HeapValue(uint32_t capacity);
     HeapValue(const HeapValue &other) = delete;
     ~HeapValue();
 
     HeapValue &operator=(const HeapValue &other) = delete;
 
-    inline bool operator==(const HeapValue &other) const
-    {
-        if (!((intptr_t)m_holder ^ (intptr_t)other.m_holder) && m_holder != nullptr) {
-            return (*m_holder) == (*other.m_holder);
-        }
+    /** Values of the same kind are compared by that kind's operator==. */
+    bool operator==(const HeapValue &other) const;
 
-        return false;
-    }
+    /** Allocate a header on its own, with room for capacity bytes. */
+    static HeapValue *Create(size_t capacity);
+    /** Destroy and free a header from Create(). */
+    static void Delete(HeapValue *hv);
 
-    inline size_t GetTypeId() const { return m_holder != nullptr ? m_holder->m_type_id : 0; }
-    inline intptr_t GetId() const { return (intptr_t)m_ptr; }
-    inline bool IsNull() const { return m_holder == nullptr; }
-    inline int &GetFlags() { return m_flags; }
-    inline int GetFlags() const { return m_flags; }
+    template <typename T>
+    static inline size_t PayloadSize() { return sizeof(typename std::decay<T>::type); }
+
+    inline HeapKind GetKind() const { return (HeapKind)m_kind; }
+    inline intptr_t GetId() const { return (intptr_t)this; }
+    inline bool IsNull() const { return m_kind == HEAP_NONE; }
+    inline uint8_t &GetFlags() { return m_flags; }
+    inline uint8_t GetFlags() const { return m_flags; }
+    /** Bytes that the value takes up after the header, by its kind. */
+    size_t GetPayloadSize() const;
+
+    /** Move the value into other, which has room for GetPayloadSize()
+        bytes. This header is left pointing to where it went. */
+    void MoveTo(HeapValue *other);
+    inline HeapValue *GetForwardingAddress() const
+    {
+        assert((m_flags & GC_FORWARDED) && "value has not been moved");
+        return *reinterpret_cast<HeapValue *const*>(GetStorage());
+    }
 
     template <typename T>
-    inline bool TypeCompatible() const { return GetTypeId() == GetTypeId<typename std::decay<T>::type>(); }
+    inline bool TypeCompatible() const { return m_kind == HeapKindOf<typename std::decay<T>::type>::kind; }
 
     template <typename T>
-    inline void Assign(const T &value)
+    inline void Assign(T &&value) { Emplace<typename std::decay<T>::type>(std::forward<T>(value)); }
+
+    /** Construct a T after the header. An Object constructs
+        its members after itself, and needs Object::SizeFor(size). */
+    template <typename T, typename ...Args>
+    inline T &Emplace(Args &&...args)
     {
-        typedef typename std::decay<T>::type U;
-        if (m_holder != nullptr) { delete m_holder; }
-        auto holder = new DerivedHolder<U>(value);
-        m_ptr = reinterpret_cast<void*>(&holder->m_value);
-        m_holder = holder;
+        static_assert(alignof(T) <= alignof(HeapValue), "value is aligned more strictly than the header");
+        assert(sizeof(T) <= m_capacity && "not enough room for the value");
+        Clear();
+        T *value = new (GetStorage()) T(std::forward<Args>(args)...);
+        m_kind = HeapKindOf<T>::kind;
+        return *value;
     }
 
     template <typename T>
     inline T &Get()
     {
-        typedef typename std::decay<T>::type U;
         if (!TypeCompatible<T>()) { throw std::bad_cast(); }
-        return *reinterpret_cast<U*>(m_ptr);
+        return *reinterpret_cast<typename std::decay<T>::type*>(GetStorage());
     }
 
     template <typename T>
     inline const T &Get() const
     {
-        typedef typename std::decay<T>::type U;
         if (!TypeCompatible<T>()) { throw std::bad_cast(); }
-        return *reinterpret_cast<const U*>(m_ptr);
+        return *reinterpret_cast<const typename std::decay<T>::type*>(GetStorage());
     }
 
     template <typename T>
     inline auto GetPointer() -> typename std::decay<T>::type*
     {
-        typedef typename std::decay<T>::type U;
         if (!TypeCompatible<T>()) { return nullptr; }
-        return reinterpret_cast<U*>(m_ptr);
+        return reinterpret_cast<typename std::decay<T>::type*>(GetStorage());
     }
 
 private:
-    // base class for an 'any' holder with pure virtual functions
-    struct BaseHolder {
-        virtual ~BaseHolder() = default;
-        virtual bool operator==(const BaseHolder &other) const = 0;
-        size_t m_type_id;
-    };
-
-    // derived class that can hold any time
-    template <typename T> struct DerivedHolder : public BaseHolder {
-        explicit DerivedHolder(const T &value)
-            : m_value(value)
-        {
-            m_type_id = GetTypeId<T>();
-        }
-
-        virtual bool operator==(const BaseHolder &other) const override
-        {
-            const auto *other_casted = dynamic_cast<const DerivedHolder<T>*>(&other);
-            return (other_casted != nullptr && other_casted->m_value == m_value);
-        }
-
-        T m_value;
-    };
-
-    BaseHolder *m_holder;
-    void *m_ptr;
-    int m_flags;
-
-    template <typename T> struct Type { static void id() {} };
-    template <typename T> static inline size_t GetTypeId() { return reinterpret_cast<size_t>(&Type<T>::id); }
+    inline char *GetStorage() { return reinterpret_cast<char*>(this + 1); }
+    inline const char *GetStorage() const { return reinterpret_cast<const char*>(this + 1); }
+    /** Destroy the value, if any, by its kind. */
+    void Clear();
+
+    uint8_t m_kind;
+    uint8_t m_flags;
+    uint32_t m_capacity;
 };
 
 #endif
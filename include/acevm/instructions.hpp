@@ -1,6 +1,8 @@
 #ifndef INSTRUCTIONS_HPP
 #define INSTRUCTIONS_HPP
 
+#include <cstdint>
+
 // arguments should be placed in the format:
 // dest, src
 
@@ -82,6 +84,35 @@ enum Instructions : char {
 
     /* Signifies the end of the stream */
     EXIT,
+
+    /* Call a function in place of the current one. its arguments replace
+       the caller's, and it returns to the caller's caller */
+    TAIL_CALL, // tail_call [% function, u8 argc]
+};
+
+// instructions that only exist in decoded programs.
+// they are never read from bytecode.
+enum InternalInstructions : uint8_t {
+    /* Type-specialized forms of ADD, SUB, MUL, DIV and CMP that the VM
+       rewrites an instruction to once its operand types are stable */
+    ADD_I32_I32 = 0x60,
+    ADD_I64_I64,
+    ADD_F64_F64,
+    SUB_I32_I32,
+    SUB_I64_I64,
+    SUB_F64_F64,
+    MUL_I32_I32,
+    MUL_I64_I64,
+    MUL_F64_F64,
+    DIV_I32_I32,
+    DIV_I64_I64,
+    DIV_F64_F64,
+    CMP_I32_I32,
+    CMP_I64_I64,
+    CMP_F64_F64,
+
+    /* Replaces an opcode that the decoder did not recognize */
+    BAD_INSTRUCTION = 0xFF,
 };
 
 #endif
@@ -0,0 +1,79 @@
+#ifndef JIT_HPP
+#define JIT_HPP
+
+#include <acevm/executable_memory.hpp>
+#include <acevm/program.hpp>
+
+#include <vector>
+#include <cstdint>
+
+// the baseline JIT emits x86-64 code, and is only built on linux.
+// define ACEVM_NO_JIT to leave it out entirely. compiled code reads
+// the tagged layout of StackValue, so NaN-boxed builds leave it out too.
+#if defined(__x86_64__) && defined(__linux__) && !defined(ACEVM_NO_JIT) && !defined(ACEVM_NAN_BOXING)
+#define ACEVM_JIT
+#endif
+
+// calls or backward jumps to a pc before its code is compiled
+#define JIT_DEFAULT_THRESHOLD 1000
+// instructions in a single compiled region
+#define JIT_MAX_REGION_SIZE 4096
+
+class VM;
+
+// compiled code takes the VM and returns the pc that the
+// interpreter continues at. the pending exception flag of the
+// VM is set when code exited because an exception was thrown.
+typedef uint32_t (*JitFunction)(VM *vm);
+
+/** Template JIT that compiles hot regions of a program to native code.
+    A region starts at a function entry or at the target of a backward
+    jump, and native code hands control back to the interpreter for
+    anything it does not handle itself. */
+class Jit {
+public:
+    // returned by helpers when native code should keep running
+    static const uint32_t continue_native;
+
+public:
+    Jit(VM *vm);
+    Jit(const Jit &other) = delete;
+    ~Jit();
+
+    inline bool IsEnabled() const { return m_enabled; }
+    inline void SetEnabled(bool enabled) { m_enabled = enabled; }
+    inline uint32_t GetThreshold() const { return m_threshold; }
+    inline void SetThreshold(uint32_t threshold) { m_threshold = threshold; }
+    inline size_t GetNumCompiled() const { return m_num_compiled; }
+
+    /** Count an entry to the given pc, compiling it once it is hot.
+        Returns true if native code ran, in which case pc is set to
+        the instruction the interpreter should continue at. Functions
+        called from native code may have pushed frames by then. */
+    bool Enter(uint32_t &pc);
+
+private:
+    VM *m_vm;
+    bool m_enabled;
+    uint32_t m_threshold;
+    size_t m_num_compiled;
+
+    ExecutableMemory m_memory;
+    // per pc: entry counts and compiled code
+    std::vector<uint32_t> m_counters;
+    std::vector<JitFunction> m_code;
+
+    JitFunction Compile(uint32_t entry);
+
+    // slow paths called from native code
+    static uint32_t HelperEcho(VM *vm, const Instruction *ins, uint32_t pc);
+    static uint32_t HelperEchoNewline(VM *vm, const Instruction *ins, uint32_t pc);
+    static uint32_t HelperLoadMem(VM *vm, const Instruction *ins, uint32_t pc);
+    static uint32_t HelperMovMem(VM *vm, const Instruction *ins, uint32_t pc);
+    static uint32_t HelperNew(VM *vm, const Instruction *ins, uint32_t pc);
+    static uint32_t HelperCall(VM *vm, const Instruction *ins, uint32_t pc);
+
+    friend class JitCompiler;
+};
+
+#endif
@@ -3,22 +3,30 @@
 
 #include <acevm/stack_value.hpp>
 
-class Object {
+#include <cstddef>
+
+/** An object with its members stored right after it. It can only be
+    constructed in place, in at least SizeFor(size) bytes. */
+class alignas(alignof(StackValue)) Object {
 public:
-    Object(int size);
-    Object(const Object &other);
+    static inline size_t SizeFor(int size) { return sizeof(Object) + size * sizeof(StackValue); }
+
+    explicit Object(int size);
+    Object(const Object &other) = delete;
     ~Object();
 
-    Object &operator=(const Object &other);
+    Object &operator=(const Object &other) = delete;
     inline bool operator==(const Object &other) const { return this == &other; }
 
     inline int GetSize() const { return m_size; }
-    inline StackValue &GetMember(int index) { return m_members[index]; }
-    inline const StackValue &GetMember(int index) const { return m_members[index]; }
+    inline StackValue &GetMember(int index) { return GetMembers()[index]; }
+    inline const StackValue &GetMember(int index) const { return GetMembers()[index]; }
 
 private:
+    inline StackValue *GetMembers() { return reinterpret_cast<StackValue*>(this + 1); }
+    inline const StackValue *GetMembers() const { return reinterpret_cast<const StackValue*>(this + 1); }
+
     int m_size;
-    StackValue *m_members;
 };
 
 #endif
@@ -0,0 +1,83 @@
+#ifndef PROGRAM_HPP
+#define PROGRAM_HPP
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+// a single instruction, decoded once at load time.
+// operands are laid out as follows:
+//
+// STORE_STATIC_STRING   m_index = len, m_imm.str = bytes,
+//                       m_b = 1 if the bytes are followed by a NUL
+// STORE_STATIC_ADDRESS  m_imm.addr = instruction index
+// STORE_STATIC_FUNCTION m_imm.addr = instruction index, m_a = nargs
+// STORE_STATIC_TYPE     m_a = size
+// LOAD_I32 .. LOAD_F64  m_a = reg, m_imm = value
+// LOAD_LOCAL            m_a = reg, m_index = stack offset
+// LOAD_STATIC           m_a = reg, m_index = static index
+// LOAD_MEM              m_a = dst, m_b = src, m_c = member index
+// MOV                   m_a = src, m_index = stack offset
+// MOV_MEM               m_a = dst object, m_b = member index, m_c = src
+// CALL, TAIL_CALL       m_a = function, m_b = argc
+// NEW                   m_a = dst, m_index = type index
+// ADD, SUB, MUL, DIV    m_a = lhs, m_b = rhs, m_c = dst, m_index = site
+// CMP                   m_a = lhs, m_b = rhs, m_index = site
+// BAD_INSTRUCTION       m_a = opcode, m_index = byte offset in the bytecode
+//
+// all other instructions use m_a for their register operand, if any.
+struct alignas(16) Instruction {
+    uint8_t m_opcode;
+    uint8_t m_a;
+    uint8_t m_b;
+    uint8_t m_c;
+    uint32_t m_index;
+
+    union {
+        int32_t i32;
+        int64_t i64;
+        float f;
+        double d;
+        uint32_t addr;
+        const char *str;
+    } m_imm;
+};
+
+// type feedback for an instruction that can be quickened,
+// and counters for how well its typed form is doing
+struct QuickenSite {
+    uint32_t m_pc;
+    uint8_t m_opcode;    // the generic opcode
+    uint8_t m_lhs_type;  // operand types seen on the last run
+    uint8_t m_rhs_type;
+    uint8_t m_stable;    // consecutive runs with the same types
+    uint64_t m_generic;  // runs of the generic form
+    uint64_t m_hits;     // runs of the typed form
+    uint64_t m_deopts;   // times the typed form was rewritten back
+};
+
+class Program {
+public:
+    Program();
+    Program(const Program &other) = delete;
+    ~Program();
+
+    inline Instruction &operator[](size_t pc) { return m_instructions[pc]; }
+    inline const Instruction &operator[](size_t pc) const { return m_instructions[pc]; }
+
+    inline Instruction *GetInstructions() { return m_instructions.data(); }
+    /** Number of instructions, including the EXIT that terminates every program. */
+    inline size_t Size() const { return m_instructions.size(); }
+
+    inline QuickenSite &GetSite(uint32_t index) { return m_sites[index]; }
+    inline const std::vector<QuickenSite> &GetSites() const { return m_sites; }
+
+    void Append(const Instruction &ins);
+    void Clear();
+
+private:
+    std::vector<Instruction> m_instructions;
+    std::vector<QuickenSite> m_sites;
+};
+
+#endif
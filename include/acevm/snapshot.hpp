@@ -0,0 +1,95 @@
+#ifndef SNAPSHOT_HPP
+#define SNAPSHOT_HPP
+
+#include <acevm/vm.hpp>
+#include <acevm/program.hpp>
+#include <acevm/bytecode_file.hpp>
+
+#include <string>
+#include <cstdint>
+
+// layout of a snapshot file. like bytecode containers, every structure
+// is a multiple of 8 bytes, so the file can be mapped and read in place.
+//
+//   SnapshotHeader
+//   SnapshotValue[m_num_statics]   static memory, in slot order
+//   SnapshotObject[m_num_objects]  heap values
+//   SnapshotValue[m_num_members]   members of every object, in order
+//   string bytes, each followed by a NUL
+
+// "ACES" in file order
+#define SNAPSHOT_MAGIC 0x53454341u
+#define SNAPSHOT_VERSION 2
+
+struct SnapshotHeader {
+    uint32_t m_magic;
+    uint16_t m_version;
+    uint16_t m_reserved;
+    // Snapshot::ProgramHash() of the program it was taken from
+    uint64_t m_program_hash;
+    // first instruction after the initializers
+    uint32_t m_entry_pc;
+    uint32_t m_num_statics;
+    uint32_t m_num_objects;
+    uint32_t m_num_members;
+};
+
+struct SnapshotValue {
+    uint32_t m_type;
+    uint32_t m_reserved;
+    // the value as it is in the StackValue union. references
+    // are stored as the index of the object plus one, or 0 for null.
+    uint64_t m_bits;
+};
+
+enum SnapshotObjectKind : uint32_t {
+    SNAPSHOT_STATIC_STRING, // a string owned by static memory
+    SNAPSHOT_HEAP_STRING,   // a string on the garbage collected heap
+    SNAPSHOT_HEAP_OBJECT,   // an Object on the garbage collected heap
+};
+
+struct SnapshotObject {
+    uint32_t m_kind;
+    // bytes in the string, or number of members
+    uint32_t m_size;
+    // offset of the string from the start of the strings,
+    // or index of the first member
+    uint64_t m_offset;
+};
+
+static_assert(sizeof(SnapshotHeader) == 32, "snapshot header must be 32 bytes");
+static_assert(sizeof(SnapshotValue) == 16, "snapshot value must be 16 bytes");
+static_assert(sizeof(SnapshotObject) == 16, "snapshot object must be 16 bytes");
+
+/** Saves the state of a VM right after its initializers have run, and
+    restores it into a new VM for the same program, so that starting the
+    program again does not have to run them. */
+class Snapshot {
+public:
+    Snapshot(VM *vm);
+    Snapshot(const Snapshot &other) = delete;
+
+    inline const std::string &GetError() const { return m_error; }
+
+    /** Write static memory, the heap and entry_pc to a file. */
+    bool Save(const char *path, uint32_t entry_pc);
+    /** Restore a snapshot into a VM that has not run anything yet.
+        entry_pc is set to where the program continues. The snapshot is
+        opened into file, which must outlive the VM, as restored strings
+        point into it. Every static value is checked against what the
+        program header stores in its slot. */
+    bool Load(const char *path, BytecodeFile &file, uint32_t &entry_pc);
+
+    /** Hash of the decoded program, so that a snapshot is
+        only ever restored for the program it was taken from. */
+    static uint64_t ProgramHash(const Program &program);
+
+private:
+    /** Whether value is what the header instruction ins stores. */
+    static bool MatchesSlot(const Instruction &ins, const SnapshotValue &value);
+
+    VM *m_vm;
+    std::string m_error;
+};
+
+#endif
@@ -3,29 +3,44 @@
 
 #include <acevm/stack_value.hpp>
 
-#include <array>
 #include <cassert>
+#include <cstddef>
 
+/** The value stack of an execution thread. Room for limit values is
+    reserved up front, but pages are only committed once they are
+    written to, so a VM that never pushes much never pays for it.
+    A guard page after the last value traps anything that skips the
+    overflow checks. */
 class Stack {
 public:
-    static const uint16_t stack_size;
+    static const size_t default_limit;
+    /** The largest limit any stack can be given. */
+    static const size_t max_limit;
 
 public:
-    Stack();
+    Stack(size_t limit = default_limit);
     Stack(const Stack &other) = delete;
     ~Stack();
 
+    /** The number of values that fit, pushing past it is an overflow. */
+    inline size_t GetLimit() const { return m_limit; }
     inline size_t GetStackPointer() const { return m_sp; }
 
+    inline void SetStackPointer(size_t sp)
+    {
+        assert(sp <= m_limit && "stack overflow");
+        m_sp = sp;
+    }
+
     inline StackValue &operator[](size_t index)
     {
-        assert(index < stack_size && "out of bounds");
+        assert(index < m_limit && "out of bounds");
         return m_data[index];
     }
 
     inline const StackValue &operator[](size_t index) const
     {
-        assert(index < stack_size && "out of bounds");
+        assert(index < m_limit && "out of bounds");
         return m_data[index];
     }
 
@@ -46,7 +61,7 @@ public:
     // push a value to the stack
     inline void Push(const StackValue &value)
     {
-        assert(m_sp < stack_size && "stack overflow");
+        assert(m_sp < m_limit && "stack overflow");
         m_data[m_sp++] = value;
     }
 
@@ -60,6 +75,12 @@ public:
 private:
     StackValue *m_data;
     size_t m_sp;
+    size_t m_limit;
+    // bytes reserved for the values and the guard page, 0 if
+    // the values were allocated with new[] instead
+    size_t m_reserved;
+
+    friend class JitCompiler;
 };
 
 #endif
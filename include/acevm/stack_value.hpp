@@ -5,6 +5,27 @@
 
 #include <stdexcept>
 #include <cstdint>
+#include <cstring>
+
+// values are a type tag and a union, 16 bytes with padding. define
+// ACEVM_NAN_BOXING to pack them into 8 bytes instead: doubles are stored
+// as they are, and every other type lives in the payload of a quiet NaN.
+//
+//   sign, exponent, quiet bit  tag    payload
+//   1111111111111              3 bits 48 bits
+//
+// INT64 keeps 48 bits in that layout. the verifier rejects constants
+// outside of +/-2^47, and arithmetic with a result outside of it throws.
+// the JIT only knows the tagged layout, so it is left out.
+
+#ifdef ACEVM_NAN_BOXING
+// every boxed value has these bits set. doubles that are NaN are
+// stored as the positive quiet NaN, so they never match it.
+#define NAN_BOX_PREFIX 0xFFF8000000000000ull
+#define NAN_BOX_CANONICAL_NAN 0x7FF8000000000000ull
+#define NAN_BOX_TAG_SHIFT 48
+#define NAN_BOX_PAYLOAD_MASK 0x0000FFFFFFFFFFFFull
+#endif
 
 struct Function {
     uint32_t m_addr;
@@ -16,7 +37,7 @@ struct TypeInfo {
 };
 
 struct StackValue {
-    enum {
+    enum Type {
         INT32,
         INT64,
         FLOAT,
@@ -26,7 +47,12 @@ struct StackValue {
         FUNCTION,
         ADDRESS,
         TYPE_INFO,
-    } m_type;
+    };
+
+#ifdef ACEVM_NAN_BOXING
+    uint64_t m_bits;
+#else
+    Type m_type;
 
     union {
         int32_t i32;
@@ -39,13 +65,97 @@ struct StackValue {
         uint32_t addr;
         TypeInfo type_info;
     } m_value;
+#endif
+
+#ifdef ACEVM_NAN_BOXING
+    static const int64_t int64_min = -((int64_t)1 << 47);
+    static const int64_t int64_max = ((int64_t)1 << 47) - 1;
+#else
+    static const int64_t int64_min = INT64_MIN;
+    static const int64_t int64_max = INT64_MAX;
+#endif
 
     StackValue();
     explicit StackValue(const StackValue &other);
 
+    /** Whether i64 can be stored as an INT64 without losing bits. */
+    static inline bool Int64Fits(int64_t i64) { return i64 >= int64_min && i64 <= int64_max; }
+
+#ifdef ACEVM_NAN_BOXING
+    inline Type GetType() const
+    {
+        if ((m_bits & NAN_BOX_PREFIX) != NAN_BOX_PREFIX) {
+            return DOUBLE;
+        }
+        // DOUBLE has no tag, so the tags after it are one lower
+        uint32_t tag = (m_bits >> NAN_BOX_TAG_SHIFT) & 7;
+        return (Type)(tag < DOUBLE ? tag : tag + 1);
+    }
+
+    /** Cheaper than GetType() when type is a constant: a single compare. */
+    inline bool IsType(Type type) const
+    {
+        if (type == DOUBLE) {
+            return (m_bits & NAN_BOX_PREFIX) != NAN_BOX_PREFIX;
+        }
+        uint64_t tag = type < DOUBLE ? type : type - 1;
+        return (m_bits >> NAN_BOX_TAG_SHIFT) == ((NAN_BOX_PREFIX >> NAN_BOX_TAG_SHIFT) | tag);
+    }
+
+    inline int32_t GetInt32() const { return (int32_t)(uint32_t)m_bits; }
+    inline int64_t GetInt64() const { return (int64_t)(m_bits << 16) >> 16; }
+    inline float GetFloat() const { float f; uint32_t u = (uint32_t)m_bits; std::memcpy(&f, &u, sizeof(f)); return f; }
+    inline double GetDouble() const { double d; std::memcpy(&d, &m_bits, sizeof(d)); return d; }
+    inline bool GetBoolean() const { return (m_bits & 1) != 0; }
+    inline HeapValue *GetHeapPointer() const { return (HeapValue*)(uintptr_t)(m_bits & NAN_BOX_PAYLOAD_MASK); }
+    inline Function GetFunction() const { Function func; func.m_addr = (uint32_t)m_bits; func.m_nargs = (uint8_t)(m_bits >> 32); return func; }
+    inline uint32_t GetAddress() const { return (uint32_t)m_bits; }
+    inline TypeInfo GetTypeInfo() const { TypeInfo type_info; type_info.m_size = (uint8_t)m_bits; return type_info; }
+
+    inline void SetInt32(int32_t i32) { Box(INT32, (uint32_t)i32); }
+    inline void SetInt64(int64_t i64) { Box(INT64, (uint64_t)i64 & NAN_BOX_PAYLOAD_MASK); }
+    inline void SetFloat(float f) { uint32_t u; std::memcpy(&u, &f, sizeof(u)); Box(FLOAT, u); }
+    inline void SetDouble(double d)
+    {
+        if (d != d) {
+            m_bits = NAN_BOX_CANONICAL_NAN;
+        } else {
+            std::memcpy(&m_bits, &d, sizeof(m_bits));
+        }
+    }
+    inline void SetBoolean(bool b) { Box(BOOLEAN, b ? 1 : 0); }
+    inline void SetHeapPointer(HeapValue *ptr) { Box(HEAP_POINTER, (uintptr_t)ptr & NAN_BOX_PAYLOAD_MASK); }
+    inline void SetFunction(uint32_t addr, uint8_t nargs) { Box(FUNCTION, addr | ((uint64_t)nargs << 32)); }
+    inline void SetAddress(uint32_t addr) { Box(ADDRESS, addr); }
+    inline void SetTypeInfo(uint8_t size) { Box(TYPE_INFO, size); }
+#else
+    inline Type GetType() const { return m_type; }
+    inline bool IsType(Type type) const { return m_type == type; }
+
+    inline int32_t GetInt32() const { return m_value.i32; }
+    inline int64_t GetInt64() const { return m_value.i64; }
+    inline float GetFloat() const { return m_value.f; }
+    inline double GetDouble() const { return m_value.d; }
+    inline bool GetBoolean() const { return m_value.b; }
+    inline HeapValue *GetHeapPointer() const { return m_value.ptr; }
+    inline Function GetFunction() const { return m_value.func; }
+    inline uint32_t GetAddress() const { return m_value.addr; }
+    inline TypeInfo GetTypeInfo() const { return m_value.type_info; }
+
+    inline void SetInt32(int32_t i32) { m_type = INT32; m_value.i32 = i32; }
+    inline void SetInt64(int64_t i64) { m_type = INT64; m_value.i64 = i64; }
+    inline void SetFloat(float f) { m_type = FLOAT; m_value.f = f; }
+    inline void SetDouble(double d) { m_type = DOUBLE; m_value.d = d; }
+    inline void SetBoolean(bool b) { m_type = BOOLEAN; m_value.b = b; }
+    inline void SetHeapPointer(HeapValue *ptr) { m_type = HEAP_POINTER; m_value.ptr = ptr; }
+    inline void SetFunction(uint32_t addr, uint8_t nargs) { m_type = FUNCTION; m_value.func.m_addr = addr; m_value.func.m_nargs = nargs; }
+    inline void SetAddress(uint32_t addr) { m_type = ADDRESS; m_value.addr = addr; }
+    inline void SetTypeInfo(uint8_t size) { m_type = TYPE_INFO; m_value.type_info.m_size = size; }
+#endif
+
     inline const char *GetTypeString() const
     {
-        switch (m_type) {
+        switch (GetType()) {
         case INT32:
             return "int32";
         case INT64:
@@ -64,6 +174,15 @@ struct StackValue {
             return "undefined";
         }
     }
+
+#ifdef ACEVM_NAN_BOXING
+private:
+    inline void Box(Type type, uint64_t payload)
+    {
+        uint64_t tag = type < DOUBLE ? type : type - 1;
+        m_bits = NAN_BOX_PREFIX | (tag << NAN_BOX_TAG_SHIFT) | payload;
+    }
+#endif
 };
 
 #endif
@@ -4,38 +4,54 @@
 #include <acevm/stack_value.hpp>
 
 #include <cassert>
+#include <cstddef>
 
+/** The constant pool of a program, filled in by the STORE_STATIC_*
+    instructions. It grows as values are stored, up to max_size. */
 class StaticMemory {
 public:
-    static const uint16_t static_size;
+    /** Static indices are 16 bits wide in the instruction encoding. */
+    static const size_t max_size;
 
 public:
     StaticMemory();
     StaticMemory(const StaticMemory &other) = delete;
     ~StaticMemory();
 
+    inline size_t Size() const { return m_sp; }
+
     inline StackValue &operator[](size_t index)
     {
-        assert(index < static_size && "out of bounds");
+        assert(index < m_sp && "out of bounds");
         return m_data[index];
     }
 
     inline const StackValue &operator[](size_t index) const
     {
-        assert(index < static_size && "out of bounds");
+        assert(index < m_sp && "out of bounds");
         return m_data[index];
     }
 
     // push a value to the stack
     inline void Store(const StackValue &value)
     {
-        assert(m_sp < static_size && "not enough static memory");
+        assert(m_sp < max_size && "not enough static memory");
+        if (m_sp == m_capacity) {
+            Grow();
+        }
         m_data[m_sp++] = value;
     }
 
 private:
     StackValue *m_data;
     size_t m_sp;
+    size_t m_capacity;
+
+    /** Double the capacity. m_data moves, so compiled code
+        reads it again every time it loads a static. */
+    void Grow();
+
+    friend class JitCompiler;
 };
 
 #endif
@@ -0,0 +1,55 @@
+#ifndef STRING_BUILDER_HPP
+#define STRING_BUILDER_HPP
+
+#include <common/utf8.hpp>
+
+#include <memory>
+#include <cstddef>
+
+/** A string that is the result of concatenation. Builders never change,
+    appending makes a new one. The bytes are kept in a chain of chunks
+    that builders share: the newest builder ending in a chunk appends to
+    it in place, and appending to an older builder starts a new chunk
+    after the bytes it shares with the others. A loop like s = s + x is
+    linear overall, and so is one that also forks t = s + y each time.
+
+    It is only turned into a Utf8String when one is needed, and that
+    string is kept until the builder is freed. */
+class StringBuilder {
+public:
+    explicit StringBuilder(const utf::Utf8String &str);
+    StringBuilder(const StringBuilder &other) = default;
+    StringBuilder(StringBuilder &&other) = default;
+
+    StringBuilder &operator=(const StringBuilder &other) = default;
+    StringBuilder &operator=(StringBuilder &&other) = default;
+    bool operator==(const StringBuilder &other) const;
+
+    inline size_t GetByteLength() const { return m_num_bytes; }
+    inline size_t GetLength() const { return m_length; }
+
+    StringBuilder Append(const char *data, size_t size, size_t length) const;
+    inline StringBuilder Append(const utf::Utf8String &str) const
+        { return Append(str.GetData(), str.GetByteLength(), str.GetLength()); }
+    /** Copies the bytes of other first, so it may be this builder. */
+    StringBuilder Append(const StringBuilder &other) const;
+
+    /** The string built so far. */
+    const utf::Utf8String &Flatten() const;
+
+private:
+    struct Chunk;
+
+    StringBuilder(const std::shared_ptr<Chunk> &tail, size_t tail_bytes, size_t num_bytes, size_t length);
+
+    // the last chunk of this builder. only the first
+    // m_tail_bytes of it belong to this builder.
+    std::shared_ptr<Chunk> m_tail;
+    size_t m_tail_bytes;
+    size_t m_num_bytes;
+    size_t m_length;
+
+    mutable std::shared_ptr<utf::Utf8String> m_flat;
+};
+
+#endif
@@ -0,0 +1,79 @@
+#ifndef VERIFIER_HPP
+#define VERIFIER_HPP
+
+#include <acevm/program.hpp>
+
+#include <vector>
+#include <string>
+#include <cstdint>
+
+enum VerifyResult : int {
+    VERIFY_OK,        // safe to run without the runtime checks
+    VERIFY_UNPROVEN,  // well formed, but has to run with the runtime checks
+    VERIFY_MALFORMED, // cannot be run at all
+};
+
+/** Checks a decoded program before it is run.
+
+    Register operands and static indices are checked for every known
+    instruction. Past that, the verifier follows each path through the
+    program from the entry point and from every function, tracking the
+    stack depth, the open try blocks and which static address each
+    register holds. A program is only proven if every jump target is
+    known and every path agrees on the stack depth where paths meet.
+    A path that reaches an unknown instruction is not proven, and the
+    instruction is reported when it is run. */
+class Verifier {
+public:
+    Verifier(const Program *program);
+    Verifier(const Verifier &other) = delete;
+
+    inline const std::string &GetError() const { return m_error; }
+    /** Most stack slots used by the top level or any single function,
+        not counting the arguments of the function. */
+    inline uint32_t GetMaxStackDepth() const { return m_max_stack_depth; }
+
+    VerifyResult Verify();
+
+private:
+    struct State {
+        bool m_reached;
+        // the top level, rather than a function body
+        bool m_top_level;
+        // arguments of the current function
+        uint8_t m_nargs;
+        // stack slots above the frame
+        uint32_t m_depth;
+        // static slot held by each register, or -1
+        int32_t m_regs[8];
+        // stack depth at each open BEGIN_TRY, innermost last
+        std::vector<uint32_t> m_try_depths;
+    };
+
+    struct StaticSlot {
+        uint8_t m_opcode; // the STORE_STATIC_* that created the slot
+        uint8_t m_nargs;  // for functions
+        uint32_t m_addr;  // instruction index, for addresses and functions
+    };
+
+    const Program *m_program;
+    // static memory, in the order the header stores it
+    std::vector<StaticSlot> m_slots;
+    size_t m_header_size;
+
+    std::vector<State> m_states;
+    std::vector<uint32_t> m_worklist;
+
+    uint32_t m_max_stack_depth;
+    std::string m_error;
+
+    bool CheckOperands(size_t pc, const Instruction &ins);
+    bool ReadStaticSlots();
+    bool FollowPaths();
+    bool Flow(uint32_t pc, const State &state);
+    bool JumpTarget(uint32_t pc, const State &state, uint8_t reg, uint32_t &target);
+
+    void SetError(const char *message, size_t pc);
+};
+
+#endif
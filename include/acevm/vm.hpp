@@ -1,20 +1,55 @@
 #ifndef VM_HPP
 #define VM_HPP
 
-#include <acevm/bytecode_stream.hpp>
+#include <acevm/program.hpp>
 #include <acevm/stack_memory.hpp>
 #include <acevm/static_memory.hpp>
 #include <acevm/heap_memory.hpp>
+#include <acevm/concurrent_marker.hpp>
 #include <acevm/exception.hpp>
+#include <acevm/jit.hpp>
 
 #include <array>
+#include <vector>
+#include <chrono>
 #include <limits>
 #include <cstdint>
 #include <cstdio>
 
-#define GC_THRESHOLD_STEP 50
-#define GC_THRESHOLD_MIN 50
-#define GC_THRESHOLD_MAX 1000
+// new values are allocated in the nursery, and the ones that are alive
+// when it is full are moved to the heap. a full collection of the heap runs
+// once it holds GC_THRESHOLD_GROWTH times the objects that survived the
+// last one, and never below GC_THRESHOLD_MIN. with a pause budget, it is
+// marked and swept in slices that each run for about that long, and the
+// rest is done at once if the heap grows by GC_THRESHOLD_GROWTH again.
+#define GC_THRESHOLD_GROWTH 2
+#define GC_THRESHOLD_MIN 1024
+#define GC_THRESHOLD_MAX (1 << 20)
+
+// when the heap is marked on a thread of its own, marking starts once
+// the heap would reach its threshold by the time it is done, with
+// GC_PACING_MARGIN times the rate of allocation. the rate is measured
+// over GC_PACING_SAMPLE allocations, and the time that marking takes
+// from how long the last one took per object.
+#define GC_PACING_MARGIN 2
+#define GC_PACING_SAMPLE 1024
+// objects marked per second, until marking has been timed
+#define GC_PACING_MARK_RATE 1e7
+
+// runs with the same operand types before an instruction is quickened
+#define QUICKEN_THRESHOLD 8
+// deoptimizations after which an instruction stays generic
+#define QUICKEN_MAX_DEOPTS 4
+
+// nested function calls before a call throws
+#define FRAME_STACK_MAX 100000
+
+// use threaded dispatch through a label table when the compiler
+// supports computed goto (GCC, Clang). define ACEVM_NO_COMPUTED_GOTO
+// to build the portable switch-based interpreter loop instead.
+#if defined(__GNUC__) && !defined(ACEVM_NO_COMPUTED_GOTO)
+#define ACEVM_COMPUTED_GOTO
+#endif
 
 #define THROW_COMPARISON_ERROR(lhs, rhs) \
     do { \
@@ -25,15 +60,15 @@
     } while (0)
 
 #define IS_VALUE_INTEGER(stack_value) \
-    ((stack_value).m_type == StackValue::INT32 || \
-    (stack_value).m_type == StackValue::INT64)
+    ((stack_value).GetType() == StackValue::INT32 || \
+    (stack_value).GetType() == StackValue::INT64)
 
 #define IS_VALUE_FLOATING_POINT(stack_value) \
-    ((stack_value).m_type == StackValue::FLOAT || \
-    (stack_value).m_type == StackValue::DOUBLE)
+    ((stack_value).GetType() == StackValue::FLOAT || \
+    (stack_value).GetType() == StackValue::DOUBLE)
 
 #define MATCH_TYPES(lhs, rhs) \
-    ((lhs).m_type < (rhs).m_type) ? (rhs).m_type : (lhs).m_type
+    ((lhs).GetType() < (rhs).GetType()) ? (rhs).GetType() : (lhs).GetType()
 
 #define COMPARE_FLOATING_POINT(lhs, rhs) \
     do { \
@@ -54,10 +89,10 @@
 
 #define COMPARE_REFERENCES(lhs, rhs) \
     do { \
-        if (rhs.m_type == StackValue::HEAP_POINTER) { \
-            if (lhs.m_value.ptr > rhs.m_value.ptr) { \
+        if (rhs.GetType() == StackValue::HEAP_POINTER) { \
+            if (lhs.GetHeapPointer() > rhs.GetHeapPointer()) { \
                 m_exec_thread.m_regs.m_flags = GREATER; \
-            } else if (lhs.m_value.ptr == rhs.m_value.ptr) { \
+            } else if (lhs.GetHeapPointer() == rhs.GetHeapPointer()) { \
                 m_exec_thread.m_regs.m_flags = EQUAL; \
             } else { \
                 m_exec_thread.m_regs.m_flags = NONE; \
@@ -69,11 +104,11 @@
 
 #define COMPARE_FUNCTIONS(lhs, rhs) \
     do { \
-        if (rhs.m_type == StackValue::FUNCTION) { \
-            if (lhs.m_value.func.m_addr > rhs.m_value.func.m_addr) { \
+        if (rhs.GetType() == StackValue::FUNCTION) { \
+            if (lhs.GetFunction().m_addr > rhs.GetFunction().m_addr) { \
                 m_exec_thread.m_regs.m_flags = GREATER; \
-            } else if (lhs.m_value.func.m_addr == rhs.m_value.func.m_addr && \
-                rhs.m_value.func.m_nargs == lhs.m_value.func.m_nargs) { \
+            } else if (lhs.GetFunction().m_addr == rhs.GetFunction().m_addr && \
+                rhs.GetFunction().m_nargs == lhs.GetFunction().m_nargs) { \
                 m_exec_thread.m_regs.m_flags = EQUAL; \
             } else { \
                 m_exec_thread.m_regs.m_flags = NONE; \
@@ -93,6 +128,13 @@ enum CompareFlags : int {
     // use only the GREATER or EQUAL flags.
 };
 
+// the reason that VM::Run() handed control back to its caller
+enum RunResult : int {
+    RUN_HALTED,    // end of the bytecode stream, EXIT, or unhandled exception
+    RUN_RETURNED,  // RET was executed
+    RUN_EXCEPTION, // an exception is pending that only an enclosing Run() can catch
+};
+
 struct Registers {
     StackValue m_reg[8];
     int m_flags = 0;
@@ -103,64 +145,290 @@ struct Registers {
     }
 };
 
+// a try block that has been entered and not left yet
+struct TryHandler {
+    // address of the catch block
+    uint32_t m_catch_pc;
+    // stack pointer at BEGIN_TRY, to revert to on error
+    uint32_t m_sp;
+    // number of frames at BEGIN_TRY. functions called inside
+    // of the block are left on error as well.
+    uint32_t m_frame_depth;
+};
+
 struct ExceptionState {
     // incremented each time BEGIN_TRY is encountered,
     // decremented each time END_TRY is encountered
     int m_try_counter = 0;
 
     // set to true when an exception occurs,
-    // set to false when handled in BEGIN_TRY
+    // set to false when it is caught
     bool m_exception_occured = false;
+
+    // entered try blocks, innermost last. nothing is looked at
+    // until an exception is actually thrown.
+    std::vector<TryHandler> m_handlers;
+};
+
+// a function call that has not returned yet
+struct Frame {
+    // instruction to continue at after RET
+    uint32_t m_return_pc;
+    // stack pointer of the caller at the time of the call
+    uint32_t m_sp;
+    // stack index of the first argument
+    uint32_t m_base;
+    // set when TAIL_CALL replaced the function, RET then
+    // restores the caller's stack pointer
+    bool m_tail_called;
 };
 
 struct ExecutionThread {
+    ExecutionThread(size_t stack_limit)
+        : m_stack(stack_limit)
+    {
+    }
+
     Stack m_stack;
     ExceptionState m_exception_state;
     Registers m_regs;
+    std::vector<Frame> m_frames;
+};
+
+// what the gc has done so far
+struct GcStats {
+    size_t m_minor_collections = 0;
+    size_t m_major_collections = 0;
+    // values moved from the nursery to the heap
+    size_t m_promoted = 0;
+    double m_minor_seconds = 0;
+    double m_minor_max_seconds = 0;
+    double m_major_seconds = 0;
+    // time that the heap was being marked on a thread of its own
+    double m_concurrent_seconds = 0;
+    // how long each pause of a full collection took: the whole of it,
+    // or each slice of it when there is a pause budget
+    std::vector<double> m_slice_seconds;
+
+    /** The longest of the shortest fraction of slices. */
+    double SlicePercentile(double fraction) const;
 };
 
 class VM {
 public:
-    VM(BytecodeStream *bs);
+    /** stack_limit is the number of values the stack can hold
+        before a push throws a stack overflow. A nursery_size of 0
+        allocates everything on the heap, without a nursery. */
+    VM(Program *program, size_t stack_limit = Stack::default_limit,
+        size_t nursery_size = Nursery::default_size);
     VM(const VM &other) = delete;
     ~VM();
 
     inline Heap &GetHeap() { return m_heap; }
+    inline StaticMemory &GetStaticMemory() { return m_static_memory; }
     inline ExecutionThread &GetExecutionThread() { return m_exec_thread; }
+    inline Jit &GetJit() { return m_jit; }
+    inline Nursery &GetNursery() { return m_nursery; }
+    inline const GcStats &GetGcStats() const { return m_gc_stats; }
+    /** Mark the heap in slices of about microseconds each,
+        instead of all at once. 0 stops the world again. */
+    inline void SetGcPauseBudget(uint32_t microseconds) { m_gc_pause_budget_us = microseconds; }
+    inline bool IsMarking() const { return m_marking; }
+    /** Mark the heap on a thread of its own while the program keeps
+        running, instead of in pauses. Must be set before the first
+        collection. A pause budget then only applies to sweeping. */
+    inline void SetGcConcurrent(bool concurrent) { m_gc_concurrent = concurrent; }
+    inline bool IsVerified() const { return m_verified; }
+    /** Run without the checks that the Verifier has proven unnecessary.
+        max_stack_depth is what it found for the largest frame. A stack
+        that is too small for that frame keeps its checks. */
+    void SetVerified(uint32_t max_stack_depth);
 
-    HeapValue *HeapAlloc();
-    void MarkObject(StackValue &object);
+    /** Allocate a value with payload_size bytes after its header,
+        running the gc first if the nursery or the heap is full. */
+    HeapValue *HeapAlloc(size_t payload_size);
+    /** Move everything in the nursery that can be reached from the
+        roots, or from the remembered values, to the heap. */
+    void CollectNursery();
+    /** Mark everything that can be reached from the roots:
+        the stack and registers of thread, and static memory. */
     void MarkObjects(ExecutionThread *thread);
+    /** Store value into member, which belongs to obj. While the heap is
+        marked on a thread of its own, what member referred to before is
+        marked as well (snapshot at the beginning), with the lock held. */
+    inline void StoreMember(HeapValue *obj, StackValue &member, const StackValue &value)
+    {
+        if (m_concurrent_marking) {
+            StoreMemberConcurrent(obj, member, value);
+            return;
+        }
+
+        WriteBarrier(obj, value);
+        member = value;
+    }
+    /** Must be called when value is stored into obj. An old value that
+        comes to refer to the nursery is remembered until the next
+        minor collection, which treats its members as roots. While the
+        heap is being marked, an old value that is stored is marked as
+        well, so that no marked object refers to one that is not. */
+    inline void WriteBarrier(HeapValue *obj, const StackValue &value)
+    {
+        if (value.GetType() != StackValue::HEAP_POINTER) {
+            return;
+        }
+
+        if (m_nursery.Contains(value.GetHeapPointer())) {
+            if (!m_nursery.Contains(obj) && !(obj->GetFlags() & GC_REMEMBERED)) {
+                obj->GetFlags() |= GC_REMEMBERED;
+                m_remembered.push_back(obj);
+            }
+        } else if (m_marking && value.GetHeapPointer() != nullptr &&
+            !(value.GetHeapPointer()->GetFlags() & GC_MARKED)) {
+            m_mark_stack.push_back(value.GetHeapPointer());
+        }
+    }
     void Echo(StackValue &value);
+    /** Concatenate two strings into result. Returns false if
+        either operand is not a string. */
+    bool AddStrings(StackValue &lhs, StackValue &rhs, StackValue &result);
     void InvokeFunction(StackValue &value, uint8_t num_args);
-    void HandleInstruction(uint8_t code);
-    void Execute();
+    /** Run instructions from the current position until a RET, an
+        exception that is not caught inside of this Run(), or the end
+        of the stream is reached. */
+    inline RunResult Run() { return Run(m_exec_thread.m_frames.size()); }
+    /** Same as Run(), where RET with base_depth frames left
+        returns instead of popping a frame. */
+    RunResult Run(size_t base_depth);
+    /** Run the STORE_STATIC_* instructions that the program starts with,
+        and return the index of the first instruction after them. */
+    uint32_t Initialize();
+    /** Run the program from entry_pc, which is past the initializers
+        if they were run by Initialize() or restored from a snapshot. */
+    void Execute(uint32_t entry_pc = 0);
+    /** Print the hit and deoptimization counters of each quickened site. */
+    void PrintQuickeningStats() const;
 
 private:
     StaticMemory m_static_memory;
     Heap m_heap;
+    Nursery m_nursery;
     ExecutionThread m_exec_thread;
-    int m_max_heap_objects;
+    size_t m_max_heap_objects;
+    // objects that have been reached but not looked into yet. it
+    // is kept between runs of the gc so that it is only grown once.
+    std::vector<HeapValue*> m_mark_stack;
+    // set while the heap is marked in slices
+    bool m_marking;
+    uint32_t m_gc_pause_budget_us;
+    ConcurrentMarker m_marker;
+    bool m_gc_concurrent;
+    // set from when the roots are handed to m_marker until it is finished
+    bool m_concurrent_marking;
+    std::chrono::high_resolution_clock::time_point m_marking_start;
+    // what the pacing of concurrent marking is based on
+    double m_alloc_rate;
+    double m_mark_rate;
+    size_t m_pacing_allocated;
+    std::chrono::high_resolution_clock::time_point m_pacing_time;
+    // promoted objects whose members have not been forwarded yet
+    std::vector<HeapValue*> m_promoted;
+    // old values that were given a reference to the nursery
+    std::vector<HeapValue*> m_remembered;
+    GcStats m_gc_stats;
+
+    Program *m_program;
+    // index of the instruction to continue at when a nested Run() returns
+    uint32_t m_pc;
+
+    bool m_verified;
+    // stack slots that each call has to leave room for
+    uint32_t m_max_stack_depth;
+
+    Jit m_jit;
+
+    /** The interpreter loop. Unchecked programs are run with
+        checked set to true. */
+    template <bool checked>
+    RunResult Interpret(size_t base_depth);
 
-    BytecodeStream *m_bs;
+    /** Push value onto the mark stack if it refers to the heap. The
+        nursery is left to minor collections, which push the values
+        they promote while the heap is being marked. */
+    inline void MarkValue(const StackValue &value)
+    {
+        HeapValue *hv = value.GetType() == StackValue::HEAP_POINTER ? value.GetHeapPointer() : nullptr;
+        if (hv != nullptr && !m_nursery.Contains(hv)) {
+            m_mark_stack.push_back(hv);
+        }
+    }
+    /** Push the registers and stack of thread, and static memory. */
+    void MarkRoots(ExecutionThread *thread);
+    /** Mark everything reachable from the mark stack, looking at the
+        clock every so often. Returns false if deadline passed first. */
+    bool DrainMarkStack(std::chrono::high_resolution_clock::time_point deadline =
+        std::chrono::high_resolution_clock::time_point::max());
+    /** Whether a collection of the heap should start. */
+    bool ShouldCollectHeap();
+    /** Start or continue a collection of the heap, with the nursery
+        empty. Throws and returns false if too much of it is still alive. */
+    bool CollectHeap();
+    /** Same as CollectHeap(), with the marking done by m_marker. */
+    bool CollectHeapConcurrent();
+    /** Sweep until deadline, finishing the collection if it is done.
+        Throws and returns false if too much of the heap is still alive. */
+    bool SweepHeap(std::chrono::high_resolution_clock::time_point deadline);
+    /** Add the time since start to the pauses of full collections. */
+    void RecordPause(std::chrono::high_resolution_clock::time_point start);
+    void StoreMemberConcurrent(HeapValue *obj, StackValue &member, const StackValue &value);
+    // pages swept between looks at the clock
+    static const size_t sweep_slice_pages = 4;
+
+    /** Point value to where its referent was moved,
+        if it refers to the nursery. */
+    inline void ForwardValue(StackValue &value)
+    {
+        if (value.GetType() == StackValue::HEAP_POINTER && m_nursery.Contains(value.GetHeapPointer())) {
+            value.SetHeapPointer(Promote(value.GetHeapPointer()));
+        }
+    }
+    /** Move hv from the nursery to the heap, once. Objects are pushed
+        onto the mark stack to have their members forwarded. */
+    HeapValue *Promote(HeapValue *hv);
+
+    /** Fill in the next static memory slot from a STORE_STATIC_* instruction. */
+    void StoreStatic(const Instruction &ins);
 
     void ThrowException(const Exception &exception);
+    /** Forget the try blocks entered by frames at or above depth. */
+    void PopHandlers(size_t depth);
+
+    /** Push a frame for calling value with num_args arguments that are
+        already on the stack. Throws and returns false if it cannot be called. */
+    bool PushFrame(const StackValue &value, uint8_t num_args, uint32_t return_pc);
+
+    /** Record the operand types of a generic instruction,
+        rewriting it to a typed form once they are stable. */
+    void ProfileSite(Instruction &ins, const StackValue &lhs, const StackValue &rhs);
+    /** Rewrite a typed instruction back to its generic form. */
+    void Deoptimize(Instruction &ins);
 
-    inline bool HasNextInstruction() const { return m_bs->Position() < m_bs->Size(); }
+    friend class Jit;
+    friend class JitCompiler;
+    friend class Snapshot;
 
     inline int64_t GetValueInt64(const StackValue &stack_value)
     {
-        switch (stack_value.m_type) {
+        switch (stack_value.GetType()) {
         case StackValue::INT32:
-            return (int64_t)stack_value.m_value.i32;
+            return (int64_t)stack_value.GetInt32();
         case StackValue::INT64:
-            return stack_value.m_value.i64;
+            return stack_value.GetInt64();
         case StackValue::FLOAT:
-            return (int64_t)stack_value.m_value.f;
+            return (int64_t)stack_value.GetFloat();
         case StackValue::DOUBLE:
-            return (int64_t)stack_value.m_value.d;
+            return (int64_t)stack_value.GetDouble();
         case StackValue::BOOLEAN:
-            return (int64_t)stack_value.m_value.b;
+            return (int64_t)stack_value.GetBoolean();
         default:
         {
             char buffer[256];
@@ -175,17 +443,17 @@ private:
 
     inline double GetValueDouble(const StackValue &stack_value)
     {
-        switch (stack_value.m_type) {
+        switch (stack_value.GetType()) {
         case StackValue::INT32:
-            return (double)stack_value.m_value.i32;
+            return (double)stack_value.GetInt32();
         case StackValue::INT64:
-            return (double)stack_value.m_value.i64;
+            return (double)stack_value.GetInt64();
         case StackValue::FLOAT:
-            return (double)stack_value.m_value.f;
+            return (double)stack_value.GetFloat();
         case StackValue::DOUBLE:
-            return stack_value.m_value.d;
+            return stack_value.GetDouble();
         case StackValue::BOOLEAN:
-            return (double)stack_value.m_value.b;
+            return (double)stack_value.GetBoolean();
         default:
         {
             char buffer[256];
@@ -0,0 +1,117 @@
+#ifndef OPTIMIZER_HPP
+#define OPTIMIZER_HPP
+
+#include <acevm/program.hpp>
+
+#include <vector>
+#include <string>
+#include <cstdint>
+
+// passes run over the whole program until nothing changes anymore,
+// or this many times
+#define OPT_MAX_ROUNDS 16
+
+// registers 0 to 7, and the compare flags as a pseudo register
+#define OPT_NUM_REGS 9
+#define OPT_FLAGS_REG 8
+
+typedef uint16_t RegisterSet;
+
+#define OPT_ALL_REGS ((RegisterSet)((1 << OPT_NUM_REGS) - 1))
+
+/** Counters for what each pass did. */
+struct OptimizerStats {
+    size_t m_folded_constants = 0;
+    size_t m_folded_branches = 0;
+    size_t m_threaded_jumps = 0;
+    size_t m_redundant_loads = 0;
+    size_t m_dead_stores = 0;
+    size_t m_dead_instructions = 0;
+    size_t m_peephole = 0;
+    size_t m_rounds = 0;
+};
+
+/** Offline optimizer for decoded programs.
+
+    Jumps take their address from a register, so targets are found by
+    following LOAD_STATIC of an address within a basic block. Static
+    memory is only known when all STORE_STATIC_* instructions come
+    first in the program, which is what the compiler emits. Every other
+    program is left as it is. */
+class Optimizer {
+public:
+    Optimizer(const Program *program);
+    Optimizer(const Optimizer &other) = delete;
+
+    inline const std::string &GetError() const { return m_error; }
+    inline const OptimizerStats &GetStats() const { return m_stats; }
+
+    /** Optimize the program into out. Returns false if the program
+        cannot be analyzed, in which case GetError() says why. */
+    bool Optimize(Program &out);
+
+private:
+    struct StaticSlot {
+        uint8_t m_opcode; // the STORE_STATIC_* that created the slot
+        uint32_t m_addr;  // instruction index, for addresses and functions
+    };
+
+    struct Block {
+        uint32_t m_begin;
+        uint32_t m_end;
+        std::vector<uint32_t> m_succs;
+        bool m_reachable;
+        // liveness at the start of the block
+        RegisterSet m_live_in;
+        // static slot held by each register at the start of the block
+        int32_t m_avail_in[8];
+        bool m_visited;
+    };
+
+    std::vector<Instruction> m_code;
+    // instructions that a pass has removed, until the next Compact()
+    std::vector<bool> m_removed;
+    std::vector<StaticSlot> m_slots;
+    size_t m_header_size;
+
+    std::vector<Block> m_blocks;
+    // block that each instruction belongs to
+    std::vector<uint32_t> m_block_of;
+    // resolved jump target of each instruction, or -1
+    std::vector<int64_t> m_targets;
+    // instruction that loaded the jump address, for resolved jumps
+    std::vector<int64_t> m_target_loads;
+    // blocks that may be entered from anywhere
+    std::vector<uint32_t> m_roots;
+    // blocks that an exception can continue at
+    std::vector<uint32_t> m_handlers;
+    // live registers after each instruction
+    std::vector<RegisterSet> m_live_out;
+
+    std::string m_error;
+    OptimizerStats m_stats;
+
+    bool ReadStaticSlots();
+    int64_t SlotAddress(uint32_t index) const;
+
+    void BuildCfg();
+    void ComputeLiveness();
+    RegisterSet HandlerLiveness() const;
+
+    bool FoldConstants();
+    bool ThreadJumps();
+    bool RemoveRedundantLoads();
+    bool RemoveDeadStores();
+    bool Peephole();
+    bool RemoveDeadCode();
+    void Compact();
+
+    static bool IsJump(uint8_t opcode);
+    static bool IsTerminator(uint8_t opcode);
+    static bool CanThrow(uint8_t opcode);
+    static RegisterSet Uses(const Instruction &ins);
+    static RegisterSet Defs(const Instruction &ins);
+    static bool IsPureLoad(uint8_t opcode);
+};
+
+#endif
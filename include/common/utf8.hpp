@@ -60,6 +60,19 @@ inline bool utf32_isalpha(u32char ch)
                             (ch >= (u32char)'a' && ch <= (u32char)'z'));
 }
 
+// the kernels behind utf8_strlen, utf8_strcmp and utf8_charat. the
+// fastest one the CPU supports is picked on first use. the scalar
+// kernels are the reference that the others give the same results as.
+enum Utf8Kernels {
+    UTF8_KERNELS_SCALAR,
+    UTF8_KERNELS_SSE2,
+    UTF8_KERNELS_AVX2,
+};
+
+Utf8Kernels utf8_get_kernels();
+/** Use kernels, or the fastest supported ones below them. */
+void utf8_set_kernels(Utf8Kernels kernels);
+
 int utf8_strlen(const char *str);
 int utf32_strlen(const u32char *str);
 int utf8_strcmp(const char *s1, const char *s2);
@@ -77,24 +90,63 @@ u32char utf8_charat(const char *str, int index);
 void utf8_charat(const char *str, char *dst, int index);
 
 class Utf8String {
+public:
+    /** Strings with fewer bytes than this, including the NUL,
+        are stored in the string itself instead of on the heap. */
+    static const size_t inline_size = 24;
+    /** operator[] remembers where every this many characters start. */
+    static const size_t breadcrumb_interval = 32;
+
 public:
     Utf8String();
     explicit Utf8String(size_t size);
     Utf8String(const char *str);
+    /** Copy size bytes of str, which does not have to end in a NUL. */
+    Utf8String(const char *str, size_t size);
+    /** Copies of the string share the bytes. Borrowed strings are only
+        copied by operations that change them. */
     Utf8String(const Utf8String &other);
+    Utf8String(Utf8String &&other);
     ~Utf8String();
 
+    /** A string that points at size bytes of str instead of copying them.
+        str[size] must be a NUL, and str has to outlive every copy. */
+    static Utf8String Borrow(const char *str, size_t size);
+
+    /** The bytes of a borrowed string may be read-only. */
     inline char *GetData() const { return m_data; }
     inline size_t GetBufferSize() const { return m_size; }
     inline size_t GetLength() const { return m_length; }
+    /** Number of bytes, not counting the NUL. */
+    inline size_t GetByteLength() const { return m_num_bytes; }
+    inline bool IsBorrowed() const { return m_borrowed; }
+    inline bool IsInline() const { return m_data == m_inline; }
+    /** Every character is one byte, so indexing needs no scan. */
+    inline bool IsAscii() const { return m_length == m_num_bytes; }
+
+    /** FNV-1a hash of the bytes, computed the first time it is needed. */
+    inline uint32_t GetHash() const
+    {
+        if (!m_hashed) {
+            m_hash = Hash(m_data, m_num_bytes);
+            m_hashed = true;
+        }
+        return m_hash;
+    }
 
     Utf8String &operator=(const char *str);
     Utf8String &operator=(const Utf8String &other);
+    Utf8String &operator=(Utf8String &&other);
 
     inline bool operator==(const char *str) const
         { return !(strcmp(m_data, str)); }
     inline bool operator==(const Utf8String &other) const
-        { return !(strcmp(m_data, other.m_data)); }
+    {
+        // hashes are only compared once both are known
+        return m_num_bytes == other.m_num_bytes &&
+            (!m_hashed || !other.m_hashed || m_hash == other.m_hash) &&
+            !std::memcmp(m_data, other.m_data, m_num_bytes);
+    }
     inline bool operator<(const char *str) const
         { return (utf8_strcmp(m_data, str) == -1); }
     inline bool operator<(const Utf8String &other) const
@@ -132,14 +184,41 @@ public:
     Utf8String operator+(const Utf8String &other) const;
     Utf8String &operator+=(const char *str);
     Utf8String &operator+=(const Utf8String &other);
+    /** The character at index. Strings that are not ASCII are
+        scanned once to find where characters start. */
     u32char operator[](size_t index) const;
 
     friend utf8_ostream &operator<<(utf8_ostream &os, const Utf8String &str);
 
 private:
+    Utf8String(char *data, size_t size, size_t length, bool borrowed);
+
+    static uint32_t Hash(const char *data, size_t size);
+
+    /** Make room for size bytes and a NUL, keeping the contents
+        if keep is set. Borrowed strings get bytes of their own. */
+    void Reserve(size_t size, bool keep);
+    /** Go back to the inline buffer, freeing the one on the heap. */
+    void Release();
+    /** Replace the contents with size bytes of str. */
+    void Assign(const char *str, size_t size, size_t length);
+    void Append(const char *str, size_t size, size_t length);
+    /** Forget what was computed from the contents. */
+    void Changed();
+    void BuildBreadcrumbs() const;
+
     char *m_data;
     size_t m_size; // buffer size (not length)
+    size_t m_num_bytes;
     size_t m_length;
+    mutable uint32_t m_hash;
+    mutable bool m_hashed;
+    // byte offset of every breadcrumb_interval'th character,
+    // built by the first operator[] that needs it
+    mutable size_t *m_breadcrumbs;
+    // m_data belongs to someone else, and is never written or freed
+    bool m_borrowed;
+    char m_inline[inline_size];
 };
 
 } // namespace utf
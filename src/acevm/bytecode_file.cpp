@@ -0,0 +1,104 @@
+#include <acevm/bytecode_file.hpp>
+
+#include <fstream>
+#include <iterator>
+#include <vector>
+#include <cstring>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#define ACEVM_HAS_MMAP
+#endif
+
+BytecodeFile::BytecodeFile()
+    : m_data(nullptr),
+      m_size(0),
+      m_mapped(false)
+{
+}
+
+BytecodeFile::~BytecodeFile()
+{
+    Close();
+}
+
+void BytecodeFile::Close()
+{
+#ifdef ACEVM_HAS_MMAP
+    if (m_mapped) {
+        munmap(m_data, m_size);
+    } else {
+        delete[] m_data;
+    }
+#else
+    delete[] m_data;
+#endif
+
+    m_data = nullptr;
+    m_size = 0;
+    m_mapped = false;
+}
+
+bool BytecodeFile::Open(const char *path)
+{
+    Close();
+
+#ifdef ACEVM_HAS_MMAP
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void *data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            // the decoder reads the file once from start to end,
+            // and everything is needed right away
+            madvise(data, st.st_size, MADV_SEQUENTIAL);
+            madvise(data, st.st_size, MADV_WILLNEED);
+
+            close(fd);
+
+            m_data = static_cast<char*>(data);
+            m_size = st.st_size;
+            m_mapped = true;
+            return true;
+        }
+    }
+
+    // a pipe, or a file that cannot be mapped. its size is
+    // not known up front, so read it in blocks until the end.
+    std::vector<char> contents;
+    char block[64 * 1024];
+    for (;;) {
+        ssize_t count = read(fd, block, sizeof(block));
+        if (count < 0) {
+            close(fd);
+            return false;
+        } else if (count == 0) {
+            break;
+        }
+        contents.insert(contents.end(), block, block + count);
+    }
+    close(fd);
+#else
+    std::ifstream file(path, std::ios::in | std::ios::binary);
+    if (!file.is_open()) {
+        return false;
+    }
+
+    std::vector<char> contents((std::istreambuf_iterator<char>(file)),
+        std::istreambuf_iterator<char>());
+#endif
+
+    // new[] is aligned for any entry of a bytecode container
+    m_data = new char[contents.size()];
+    std::memcpy(m_data, contents.data(), contents.size());
+    m_size = contents.size();
+
+    return true;
+}
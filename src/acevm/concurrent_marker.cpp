@@ -0,0 +1,120 @@
+#include <acevm/concurrent_marker.hpp>
+#include <acevm/object.hpp>
+
+ConcurrentMarker::Guard::Guard(ConcurrentMarker *marker)
+    : m_marker(marker)
+{
+    if (m_marker != nullptr) {
+        m_marker->m_num_waiting++;
+        m_marker->m_lock.lock();
+        m_marker->m_num_waiting--;
+    }
+}
+
+ConcurrentMarker::Guard::~Guard()
+{
+    if (m_marker != nullptr) {
+        m_marker->m_lock.unlock();
+    }
+}
+
+ConcurrentMarker::ConcurrentMarker(const Nursery *nursery)
+    : m_nursery(nursery),
+      m_num_marked(0),
+      m_marking(false),
+      m_stopping(false),
+      m_done(true),
+      m_num_waiting(0)
+{
+}
+
+ConcurrentMarker::~ConcurrentMarker()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_stopping = true;
+    }
+    m_wake.notify_one();
+
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+}
+
+void ConcurrentMarker::Start()
+{
+    m_num_marked = 0;
+    m_marking = true;
+    m_done.store(false, std::memory_order_release);
+
+    if (!m_thread.joinable()) {
+        m_thread = std::thread(&ConcurrentMarker::Run, this);
+    }
+    m_wake.notify_one();
+}
+
+void ConcurrentMarker::Finish()
+{
+    Drain((size_t)-1);
+    m_marking = false;
+    m_done.store(true, std::memory_order_release);
+}
+
+void ConcurrentMarker::Run()
+{
+    std::unique_lock<std::mutex> lock(m_lock);
+
+    while (true) {
+        m_wake.wait(lock, [this]() {
+            return m_stopping || (m_marking && !m_done.load(std::memory_order_relaxed));
+        });
+        if (m_stopping) {
+            return;
+        }
+
+        while (!m_stack.empty()) {
+            Drain(batch_size);
+
+            // the VM is held up for one batch at most
+            lock.unlock();
+            while (m_num_waiting.load(std::memory_order_relaxed) != 0) {
+                std::this_thread::yield();
+            }
+            lock.lock();
+
+            if (m_stopping) {
+                return;
+            }
+        }
+
+        m_done.store(true, std::memory_order_release);
+    }
+}
+
+void ConcurrentMarker::Drain(size_t max_values)
+{
+    for (size_t i = 0; i < max_values && !m_stack.empty(); i++) {
+        HeapValue *hv = m_stack.back();
+        m_stack.pop_back();
+
+        if (!m_stack.empty()) {
+            __builtin_prefetch(m_stack.back());
+        }
+
+        if (hv->GetFlags() & GC_MARKED) {
+            continue;
+        }
+        hv->GetFlags() |= GC_MARKED;
+        m_num_marked++;
+
+        if (Object *obj_ptr = hv->GetPointer<Object>()) {
+            int obj_size = obj_ptr->GetSize();
+            for (int j = 0; j < obj_size; j++) {
+                const StackValue &member = obj_ptr->GetMember(j);
+                if (member.GetType() == StackValue::HEAP_POINTER) {
+                    Push(member.GetHeapPointer());
+                }
+            }
+        }
+    }
+}
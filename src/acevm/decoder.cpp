@@ -0,0 +1,433 @@
+#include <acevm/decoder.hpp>
+#include <acevm/container.hpp>
+#include <acevm/instructions.hpp>
+
+#include <vector>
+#include <map>
+#include <string>
+#include <tuple>
+#include <cstdio>
+#include <cstring>
+
+Decoder::Decoder(BytecodeStream *bs)
+    : m_bs(bs),
+      m_interning(true),
+      m_num_interned(0)
+{
+}
+
+void Decoder::SetError(const char *message, size_t position)
+{
+    char buffer[256];
+    std::sprintf(buffer, "%s at location: 0x%08x", message, (int)position);
+    m_error = buffer;
+}
+
+bool Decoder::DecodeInstruction(uint8_t code, Instruction &ins)
+{
+    switch (code) {
+    case NOP:
+    case POP:
+    case ECHO_NEWLINE:
+    case RET:
+    case END_TRY:
+    case EXIT:
+        return true;
+    case STORE_STATIC_STRING:
+        if (!ReadOperand(&ins.m_index) || !m_bs->CanRead(ins.m_index)) {
+            return false;
+        }
+        // strings are not copied, they point into the bytecode buffer
+        ins.m_imm.str = m_bs->GetBuffer() + m_bs->Position();
+        m_bs->Skip(ins.m_index);
+        return true;
+    case STORE_STATIC_ADDRESS:
+        return ReadOperand(&ins.m_imm.addr);
+    case STORE_STATIC_FUNCTION:
+        return ReadOperand(&ins.m_imm.addr) && ReadOperand(&ins.m_a);
+    case STORE_STATIC_TYPE:
+        return ReadOperand(&ins.m_a);
+    case LOAD_I32:
+        return ReadOperand(&ins.m_a) && ReadOperand(&ins.m_imm.i32);
+    case LOAD_I64:
+        return ReadOperand(&ins.m_a) && ReadOperand(&ins.m_imm.i64);
+    case LOAD_F32:
+        return ReadOperand(&ins.m_a) && ReadOperand(&ins.m_imm.f);
+    case LOAD_F64:
+        return ReadOperand(&ins.m_a) && ReadOperand(&ins.m_imm.d);
+    case LOAD_LOCAL:
+    case LOAD_STATIC:
+    case NEW:
+    {
+        uint16_t index;
+        if (!ReadOperand(&ins.m_a) || !ReadOperand(&index)) {
+            return false;
+        }
+        ins.m_index = index;
+        return true;
+    }
+    case MOV:
+    {
+        uint16_t offset;
+        if (!ReadOperand(&offset) || !ReadOperand(&ins.m_a)) {
+            return false;
+        }
+        ins.m_index = offset;
+        return true;
+    }
+    case LOAD_NULL:
+    case LOAD_TRUE:
+    case LOAD_FALSE:
+    case PUSH:
+    case ECHO:
+    case JMP:
+    case JE:
+    case JNE:
+    case JG:
+    case JGE:
+    case BEGIN_TRY:
+    case CMPZ:
+        return ReadOperand(&ins.m_a);
+    case CALL:
+    case TAIL_CALL:
+    case CMP:
+        return ReadOperand(&ins.m_a) && ReadOperand(&ins.m_b);
+    case LOAD_MEM:
+    case MOV_MEM:
+    case ADD:
+    case SUB:
+    case MUL:
+    case DIV:
+        return ReadOperand(&ins.m_a) && ReadOperand(&ins.m_b) && ReadOperand(&ins.m_c);
+    default:
+        // unknown instructions are reported when they are reached.
+        // their length is not known, so nothing after them can be decoded.
+        ins.m_opcode = BAD_INSTRUCTION;
+        ins.m_a = code;
+        ins.m_index = m_bs->Position() - 1;
+        m_bs->Seek(m_bs->Size());
+        return true;
+    }
+}
+
+bool Decoder::Decode(Program &program)
+{
+    program.Clear();
+    m_num_interned = 0;
+
+    uint32_t magic = 0;
+    if (m_bs->Size() >= sizeof(ContainerHeader)) {
+        std::memcpy(&magic, m_bs->GetBuffer(), sizeof(magic));
+    }
+
+    // no flat program starts with the magic, the first byte is not an opcode
+    bool decoded = magic == CONTAINER_MAGIC ? DecodeContainer(program) : DecodeFlat(program);
+
+    if (decoded && m_interning) {
+        InternConstants(program);
+    }
+
+    return decoded;
+}
+
+void Decoder::InternConstants(Program &program)
+{
+    // the header is where static memory is filled in
+    size_t header_size = 0;
+    while (header_size < program.Size() && (program[header_size].m_opcode == NOP ||
+        (program[header_size].m_opcode >= STORE_STATIC_STRING &&
+        program[header_size].m_opcode <= STORE_STATIC_TYPE))) {
+        header_size++;
+    }
+
+    // slots are numbered in the order they are stored. one stored after
+    // the header would no longer get the index the program expects.
+    for (size_t pc = header_size; pc < program.Size(); pc++) {
+        if (program[pc].m_opcode >= STORE_STATIC_STRING && program[pc].m_opcode <= STORE_STATIC_TYPE) {
+            return;
+        }
+    }
+
+    // opcode, the string or the address, nargs or size. equal strings
+    // become the same reference, so CMP finds them EQUAL from now on.
+    typedef std::tuple<uint8_t, std::string, uint32_t, uint8_t> Key;
+
+    std::map<Key, uint32_t> slot_of;
+    // new slot for each slot of the original program
+    std::vector<uint32_t> remap;
+
+    for (size_t pc = 0; pc < header_size; pc++) {
+        Instruction &ins = program[pc];
+        if (ins.m_opcode == NOP) {
+            continue;
+        }
+
+        Key key(ins.m_opcode, std::string(), 0, ins.m_a);
+        if (ins.m_opcode == STORE_STATIC_STRING) {
+            std::get<1>(key).assign(ins.m_imm.str, ins.m_index);
+        } else if (ins.m_opcode != STORE_STATIC_TYPE) {
+            std::get<2>(key) = ins.m_imm.addr;
+        }
+
+        auto it = slot_of.find(key);
+        if (it == slot_of.end()) {
+            it = slot_of.insert(std::make_pair(key, (uint32_t)slot_of.size())).first;
+        } else {
+            ins = Instruction();
+            ins.m_opcode = NOP;
+            m_num_interned++;
+        }
+        remap.push_back(it->second);
+    }
+
+    if (m_num_interned == 0) {
+        return;
+    }
+
+    for (size_t pc = header_size; pc < program.Size(); pc++) {
+        Instruction &ins = program[pc];
+        // indices past the constants stay out of bounds, there are fewer slots now
+        if ((ins.m_opcode == LOAD_STATIC || ins.m_opcode == NEW) && ins.m_index < remap.size()) {
+            ins.m_index = remap[ins.m_index];
+        }
+    }
+}
+
+bool Decoder::DecodeFlat(Program &program)
+{
+    // instruction index for each byte offset that starts an instruction
+    std::vector<uint32_t> index_of(m_bs->Size() + 1, UINT32_MAX);
+
+    while (!m_bs->Eof()) {
+        size_t position = m_bs->Position();
+        index_of[position] = program.Size();
+
+        uint8_t code;
+        m_bs->Read(&code);
+
+        Instruction ins = Instruction();
+        ins.m_opcode = code;
+
+        if (!DecodeInstruction(code, ins)) {
+            SetError("truncated instruction", position);
+            return false;
+        }
+
+        program.Append(ins);
+    }
+
+    // every program ends in EXIT, so the interpreter
+    // never has to check for the end of the stream
+    index_of[m_bs->Size()] = program.Size();
+
+    Instruction exit = Instruction();
+    exit.m_opcode = EXIT;
+    program.Append(exit);
+
+    // remap byte addresses to instruction indices
+    for (size_t pc = 0; pc < program.Size(); pc++) {
+        Instruction &ins = program[pc];
+        if (ins.m_opcode == STORE_STATIC_ADDRESS || ins.m_opcode == STORE_STATIC_FUNCTION) {
+            if (ins.m_imm.addr > m_bs->Size() || index_of[ins.m_imm.addr] == UINT32_MAX) {
+                SetError("address is not on an instruction boundary", ins.m_imm.addr);
+                return false;
+            }
+            ins.m_imm.addr = index_of[ins.m_imm.addr];
+        }
+    }
+
+    return true;
+}
+
+bool Decoder::DecodeContainer(Program &program)
+{
+    const size_t size = m_bs->Size();
+    const char *buffer = m_bs->GetBuffer();
+
+    const ContainerHeader *header = m_bs->ReadAligned<ContainerHeader>();
+    if (header->m_version != CONTAINER_VERSION) {
+        SetError("unsupported container version", 4);
+        return false;
+    } else if (header->m_size != size || size % CONTAINER_ALIGNMENT != 0) {
+        SetError("container size does not match the file", 8);
+        return false;
+    } else if (ContainerChecksum(buffer + sizeof(ContainerHeader), size - sizeof(ContainerHeader)) !=
+        header->m_checksum) {
+        SetError("checksum mismatch", 12);
+        return false;
+    } else if (!m_bs->CanRead(header->m_num_sections * sizeof(SectionEntry))) {
+        SetError("truncated section table", m_bs->Position());
+        return false;
+    }
+
+    const SectionEntry *constants = nullptr;
+    const SectionEntry *types = nullptr;
+    const SectionEntry *code = nullptr;
+    const SectionEntry *debug = nullptr;
+
+    const size_t table_end = m_bs->Position() + header->m_num_sections * sizeof(SectionEntry);
+
+    for (uint16_t i = 0; i < header->m_num_sections; i++) {
+        size_t position = m_bs->Position();
+        const SectionEntry *section = m_bs->ReadAligned<SectionEntry>();
+
+        if (section->m_offset % CONTAINER_ALIGNMENT != 0 || section->m_offset < table_end ||
+            (uint64_t)section->m_offset + section->m_size > size) {
+            SetError("section out of bounds", position);
+            return false;
+        }
+
+        const SectionEntry **slot = nullptr;
+        size_t entry_size = 0;
+        switch (section->m_kind) {
+        case SECTION_CONSTANTS:
+            slot = &constants;
+            entry_size = sizeof(ConstantEntry);
+            break;
+        case SECTION_TYPES:
+            slot = &types;
+            entry_size = sizeof(TypeEntry);
+            break;
+        case SECTION_CODE:
+            slot = &code;
+            entry_size = sizeof(CodeEntry);
+            break;
+        case SECTION_DEBUG:
+            slot = &debug;
+            entry_size = sizeof(uint32_t);
+            break;
+        default:
+            // sections added by later versions are skipped
+            continue;
+        }
+
+        if (*slot != nullptr) {
+            SetError("duplicate section", position);
+            return false;
+        } else if ((uint64_t)section->m_count * entry_size > section->m_size) {
+            SetError("section is too small for its entries", position);
+            return false;
+        }
+        *slot = section;
+    }
+
+    if (code == nullptr) {
+        SetError("missing code section", sizeof(ContainerHeader));
+        return false;
+    } else if (debug != nullptr && debug->m_count != code->m_count) {
+        SetError("debug section does not match the code section", debug->m_offset);
+        return false;
+    }
+
+    const uint32_t num_constants = constants != nullptr ? constants->m_count : 0;
+    const uint32_t num_types = types != nullptr ? types->m_count : 0;
+
+    // static memory is filled in first, code starts right after
+    for (uint32_t i = 0; i < num_constants; i++) {
+        m_bs->Seek(constants->m_offset + i * sizeof(ConstantEntry));
+        size_t position = m_bs->Position();
+        const ConstantEntry *entry = m_bs->ReadAligned<ConstantEntry>();
+
+        Instruction ins = Instruction();
+        ins.m_opcode = entry->m_opcode;
+
+        switch (entry->m_opcode) {
+        case STORE_STATIC_STRING:
+            if (entry->m_string_offset < (uint64_t)num_constants * sizeof(ConstantEntry) ||
+                entry->m_string_offset + entry->m_value > constants->m_size) {
+                SetError("string out of bounds", position);
+                return false;
+            }
+            // strings are not copied, they point into the bytecode buffer
+            ins.m_index = entry->m_value;
+            ins.m_imm.str = buffer + constants->m_offset + entry->m_string_offset;
+            // containers written before strings were terminated are still read
+            ins.m_b = entry->m_string_offset + entry->m_value < constants->m_size &&
+                ins.m_imm.str[entry->m_value] == '\0';
+            break;
+        case STORE_STATIC_ADDRESS:
+        case STORE_STATIC_FUNCTION:
+            // the end of the code is the EXIT that every program ends with
+            if (entry->m_value > code->m_count) {
+                SetError("address out of bounds", position);
+                return false;
+            }
+            ins.m_imm.addr = num_constants + entry->m_value;
+            ins.m_a = entry->m_nargs;
+            break;
+        case STORE_STATIC_TYPE:
+        {
+            if (entry->m_value >= num_types) {
+                SetError("type index out of bounds", position);
+                return false;
+            }
+            m_bs->Seek(types->m_offset + entry->m_value * sizeof(TypeEntry));
+            const TypeEntry *type = m_bs->ReadAligned<TypeEntry>();
+            if (type->m_size > UINT8_MAX) {
+                SetError("type has too many members", m_bs->Position() - sizeof(TypeEntry));
+                return false;
+            }
+            ins.m_a = type->m_size;
+            break;
+        }
+        default:
+            SetError("invalid constant", position);
+            return false;
+        }
+
+        program.Append(ins);
+    }
+
+    m_bs->Seek(code->m_offset);
+    for (uint32_t i = 0; i < code->m_count; i++) {
+        size_t position = m_bs->Position();
+        const CodeEntry *entry = m_bs->ReadAligned<CodeEntry>();
+
+        Instruction ins = Instruction();
+        ins.m_opcode = entry->m_opcode;
+        ins.m_a = entry->m_a;
+        ins.m_b = entry->m_b;
+        ins.m_c = entry->m_c;
+        std::memcpy(&ins.m_imm, &entry->m_imm, sizeof(entry->m_imm));
+
+        switch (entry->m_opcode) {
+        case LOAD_LOCAL:
+        case LOAD_STATIC:
+        case NEW:
+        case MOV:
+            // 16 bits wide in the flat format, and in the interpreter
+            if (entry->m_index > UINT16_MAX) {
+                SetError("operand out of range", position);
+                return false;
+            }
+            ins.m_index = entry->m_index;
+            break;
+        case STORE_STATIC_STRING:
+        case STORE_STATIC_ADDRESS:
+        case STORE_STATIC_FUNCTION:
+        case STORE_STATIC_TYPE:
+            SetError("static memory is written from the code section", position);
+            return false;
+        default:
+            if (entry->m_opcode > TAIL_CALL || entry->m_opcode == MOD) {
+                // reported when it is reached, like in a flat program
+                ins.m_opcode = BAD_INSTRUCTION;
+                ins.m_a = entry->m_opcode;
+                ins.m_index = position;
+                if (debug != nullptr) {
+                    std::memcpy(&ins.m_index, buffer + debug->m_offset + i * sizeof(uint32_t),
+                        sizeof(uint32_t));
+                }
+            }
+            break;
+        }
+
+        program.Append(ins);
+    }
+
+    Instruction exit = Instruction();
+    exit.m_opcode = EXIT;
+    program.Append(exit);
+
+    return true;
+}
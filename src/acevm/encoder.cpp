@@ -0,0 +1,343 @@
+#include <acevm/encoder.hpp>
+#include <acevm/container.hpp>
+#include <acevm/instructions.hpp>
+
+#include <algorithm>
+
+Encoder::Encoder(const Program *program)
+    : m_program(program)
+{
+}
+
+size_t Encoder::EncodedSize(const Instruction &ins)
+{
+    switch (ins.m_opcode) {
+    case NOP:
+    case POP:
+    case ECHO_NEWLINE:
+    case RET:
+    case END_TRY:
+    case EXIT:
+        return 1;
+    case STORE_STATIC_STRING:
+        return 1 + sizeof(uint32_t) + ins.m_index;
+    case STORE_STATIC_ADDRESS:
+        return 1 + sizeof(uint32_t);
+    case STORE_STATIC_FUNCTION:
+        return 1 + sizeof(uint32_t) + 1;
+    case STORE_STATIC_TYPE:
+        return 1 + 1;
+    case LOAD_I32:
+        return 1 + 1 + sizeof(int32_t);
+    case LOAD_I64:
+        return 1 + 1 + sizeof(int64_t);
+    case LOAD_F32:
+        return 1 + 1 + sizeof(float);
+    case LOAD_F64:
+        return 1 + 1 + sizeof(double);
+    case LOAD_LOCAL:
+    case LOAD_STATIC:
+    case NEW:
+    case MOV:
+        return 1 + 1 + sizeof(uint16_t);
+    case LOAD_NULL:
+    case LOAD_TRUE:
+    case LOAD_FALSE:
+    case PUSH:
+    case ECHO:
+    case JMP:
+    case JE:
+    case JNE:
+    case JG:
+    case JGE:
+    case BEGIN_TRY:
+    case CMPZ:
+        return 1 + 1;
+    case CALL:
+    case TAIL_CALL:
+    case CMP:
+        return 1 + 2;
+    case LOAD_MEM:
+    case MOV_MEM:
+    case ADD:
+    case SUB:
+    case MUL:
+    case DIV:
+        return 1 + 3;
+    default:
+        return 0;
+    }
+}
+
+void Encoder::EncodeInstruction(const Instruction &ins, const std::vector<uint32_t> &address_of,
+    std::vector<char> &out)
+{
+    Write<uint8_t>(out, ins.m_opcode);
+
+    switch (ins.m_opcode) {
+    case STORE_STATIC_STRING:
+        Write<uint32_t>(out, ins.m_index);
+        out.insert(out.end(), ins.m_imm.str, ins.m_imm.str + ins.m_index);
+        break;
+    case STORE_STATIC_ADDRESS:
+        Write<uint32_t>(out, address_of[ins.m_imm.addr]);
+        break;
+    case STORE_STATIC_FUNCTION:
+        Write<uint32_t>(out, address_of[ins.m_imm.addr]);
+        Write<uint8_t>(out, ins.m_a);
+        break;
+    case STORE_STATIC_TYPE:
+        Write<uint8_t>(out, ins.m_a);
+        break;
+    case LOAD_I32:
+        Write<uint8_t>(out, ins.m_a);
+        Write<int32_t>(out, ins.m_imm.i32);
+        break;
+    case LOAD_I64:
+        Write<uint8_t>(out, ins.m_a);
+        Write<int64_t>(out, ins.m_imm.i64);
+        break;
+    case LOAD_F32:
+        Write<uint8_t>(out, ins.m_a);
+        Write<float>(out, ins.m_imm.f);
+        break;
+    case LOAD_F64:
+        Write<uint8_t>(out, ins.m_a);
+        Write<double>(out, ins.m_imm.d);
+        break;
+    case LOAD_LOCAL:
+    case LOAD_STATIC:
+    case NEW:
+        Write<uint8_t>(out, ins.m_a);
+        Write<uint16_t>(out, ins.m_index);
+        break;
+    case MOV:
+        Write<uint16_t>(out, ins.m_index);
+        Write<uint8_t>(out, ins.m_a);
+        break;
+    case LOAD_NULL:
+    case LOAD_TRUE:
+    case LOAD_FALSE:
+    case PUSH:
+    case ECHO:
+    case JMP:
+    case JE:
+    case JNE:
+    case JG:
+    case JGE:
+    case BEGIN_TRY:
+    case CMPZ:
+        Write<uint8_t>(out, ins.m_a);
+        break;
+    case CALL:
+    case TAIL_CALL:
+    case CMP:
+        Write<uint8_t>(out, ins.m_a);
+        Write<uint8_t>(out, ins.m_b);
+        break;
+    case LOAD_MEM:
+    case MOV_MEM:
+    case ADD:
+    case SUB:
+    case MUL:
+    case DIV:
+        Write<uint8_t>(out, ins.m_a);
+        Write<uint8_t>(out, ins.m_b);
+        Write<uint8_t>(out, ins.m_c);
+        break;
+    default:
+        break;
+    }
+}
+
+bool Encoder::ComputeAddresses(std::vector<uint32_t> &address_of)
+{
+    // the last instruction is the EXIT every decoded program ends with.
+    // addresses that refer to it point to the end of the bytecode.
+    size_t count = m_program->Size() - 1;
+
+    address_of.assign(m_program->Size(), 0);
+
+    uint32_t address = 0;
+    for (size_t pc = 0; pc < count; pc++) {
+        size_t size = EncodedSize((*m_program)[pc]);
+        if (size == 0) {
+            return false;
+        }
+        address_of[pc] = address;
+        address += size;
+    }
+    address_of[count] = address;
+
+    return true;
+}
+
+bool Encoder::Encode(std::vector<char> &out)
+{
+    size_t count = m_program->Size() - 1;
+
+    // byte address of each instruction index
+    std::vector<uint32_t> address_of;
+    if (!ComputeAddresses(address_of)) {
+        return false;
+    }
+
+    out.reserve(out.size() + address_of[count]);
+
+    for (size_t pc = 0; pc < count; pc++) {
+        EncodeInstruction((*m_program)[pc], address_of, out);
+    }
+
+    return true;
+}
+
+bool Encoder::EncodeContainer(std::vector<char> &out)
+{
+    size_t count = m_program->Size() - 1;
+
+    // the flat addresses go into the debug section
+    std::vector<uint32_t> address_of;
+    if (!ComputeAddresses(address_of)) {
+        return false;
+    }
+
+    size_t num_constants = 0;
+    while (num_constants < count) {
+        uint8_t opcode = (*m_program)[num_constants].m_opcode;
+        if (opcode < STORE_STATIC_STRING || opcode > STORE_STATIC_TYPE) {
+            break;
+        }
+        num_constants++;
+    }
+
+    std::vector<char> constants;
+    std::vector<char> types;
+    std::vector<char> code;
+    std::vector<char> debug;
+
+    // strings follow the constant entries in the same section
+    std::vector<char> strings;
+    std::vector<uint8_t> type_sizes;
+
+    for (size_t pc = 0; pc < num_constants; pc++) {
+        const Instruction &ins = (*m_program)[pc];
+
+        ConstantEntry entry = ConstantEntry();
+        entry.m_opcode = ins.m_opcode;
+
+        switch (ins.m_opcode) {
+        case STORE_STATIC_STRING:
+            entry.m_value = ins.m_index;
+            entry.m_string_offset = num_constants * sizeof(ConstantEntry) + strings.size();
+            strings.insert(strings.end(), ins.m_imm.str, ins.m_imm.str + ins.m_index);
+            // so the VM can use the string where it is
+            strings.push_back('\0');
+            break;
+        case STORE_STATIC_ADDRESS:
+        case STORE_STATIC_FUNCTION:
+            if (ins.m_imm.addr < num_constants) {
+                // only code can be jumped to
+                return false;
+            }
+            entry.m_value = ins.m_imm.addr - num_constants;
+            entry.m_nargs = ins.m_a;
+            break;
+        case STORE_STATIC_TYPE:
+        {
+            // types of the same size share an entry
+            size_t index = std::find(type_sizes.begin(), type_sizes.end(), ins.m_a) - type_sizes.begin();
+            if (index == type_sizes.size()) {
+                type_sizes.push_back(ins.m_a);
+
+                TypeEntry type = TypeEntry();
+                type.m_size = ins.m_a;
+                Write(types, type);
+            }
+            entry.m_value = index;
+            break;
+        }
+        }
+
+        Write(constants, entry);
+    }
+    constants.insert(constants.end(), strings.begin(), strings.end());
+
+    for (size_t pc = num_constants; pc < count; pc++) {
+        const Instruction &ins = (*m_program)[pc];
+        if (ins.m_opcode >= STORE_STATIC_STRING && ins.m_opcode <= STORE_STATIC_TYPE) {
+            // static memory is written after the program has started
+            return false;
+        }
+
+        CodeEntry entry = CodeEntry();
+        entry.m_opcode = ins.m_opcode;
+        entry.m_a = ins.m_a;
+        entry.m_b = ins.m_b;
+        entry.m_c = ins.m_c;
+
+        switch (ins.m_opcode) {
+        case LOAD_I32:
+        case LOAD_I64:
+        case LOAD_F32:
+        case LOAD_F64:
+            std::memcpy(&entry.m_imm, &ins.m_imm, sizeof(entry.m_imm));
+            break;
+        case LOAD_LOCAL:
+        case LOAD_STATIC:
+        case NEW:
+        case MOV:
+            entry.m_index = ins.m_index;
+            break;
+        default:
+            break;
+        }
+
+        Write(code, entry);
+        Write(debug, address_of[pc]);
+    }
+
+    const uint32_t kinds[] = { SECTION_CONSTANTS, SECTION_TYPES, SECTION_CODE, SECTION_DEBUG };
+    const uint32_t counts[] = {
+        (uint32_t)num_constants,
+        (uint32_t)type_sizes.size(),
+        (uint32_t)(count - num_constants),
+        (uint32_t)(count - num_constants)
+    };
+    const std::vector<char> *contents[] = { &constants, &types, &code, &debug };
+    const uint16_t num_sections = 4;
+
+    const size_t base = out.size();
+
+    ContainerHeader header = ContainerHeader();
+    header.m_magic = CONTAINER_MAGIC;
+    header.m_version = CONTAINER_VERSION;
+    header.m_num_sections = num_sections;
+    Write(out, header);
+
+    // sections start on an aligned offset after the table
+    uint32_t offset = sizeof(ContainerHeader) + num_sections * sizeof(SectionEntry);
+    for (uint16_t i = 0; i < num_sections; i++) {
+        SectionEntry section = SectionEntry();
+        section.m_kind = kinds[i];
+        section.m_count = counts[i];
+        section.m_offset = offset;
+        section.m_size = contents[i]->size();
+        Write(out, section);
+
+        offset += (section.m_size + CONTAINER_ALIGNMENT - 1) & ~(CONTAINER_ALIGNMENT - 1);
+    }
+
+    for (uint16_t i = 0; i < num_sections; i++) {
+        out.insert(out.end(), contents[i]->begin(), contents[i]->end());
+        while ((out.size() - base) % CONTAINER_ALIGNMENT != 0) {
+            out.push_back(0);
+        }
+    }
+
+    header.m_size = out.size() - base;
+    header.m_checksum = ContainerChecksum(&out[base + sizeof(ContainerHeader)],
+        header.m_size - sizeof(ContainerHeader));
+    std::memcpy(&out[base], &header, sizeof(header));
+
+    return true;
+}
@@ -0,0 +1,78 @@
+#include <acevm/executable_memory.hpp>
+
+#include <cstring>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <unistd.h>
+#define ACEVM_HAS_MMAP
+#endif
+
+const size_t ExecutableMemory::chunk_size = 256 * 1024;
+
+ExecutableMemory::ExecutableMemory()
+    : m_used(0)
+{
+}
+
+ExecutableMemory::~ExecutableMemory()
+{
+#ifdef ACEVM_HAS_MMAP
+    for (Chunk &chunk : m_chunks) {
+        munmap(chunk.m_data, chunk.m_size);
+    }
+#endif
+}
+
+void *ExecutableMemory::Install(const uint8_t *code, size_t size)
+{
+#ifdef ACEVM_HAS_MMAP
+    // keep every function 16-byte aligned
+    size_t aligned_size = (size + 15) & ~size_t(15);
+
+    if (m_chunks.empty() || m_chunks.back().m_offset + aligned_size > m_chunks.back().m_size) {
+        size_t page_size = sysconf(_SC_PAGESIZE);
+        size_t map_size = aligned_size > chunk_size ? aligned_size : chunk_size;
+        map_size = (map_size + page_size - 1) & ~(page_size - 1);
+
+        void *data = mmap(nullptr, map_size, PROT_READ | PROT_EXEC,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (data == MAP_FAILED) {
+            return nullptr;
+        }
+
+        Chunk chunk;
+        chunk.m_data = static_cast<uint8_t*>(data);
+        chunk.m_size = map_size;
+        chunk.m_offset = 0;
+        m_chunks.push_back(chunk);
+    }
+
+    Chunk &chunk = m_chunks.back();
+    uint8_t *dst = chunk.m_data + chunk.m_offset;
+
+    // only the pages being written to are made writable, and never
+    // executable at the same time. no native code runs meanwhile.
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    uint8_t *page_begin = reinterpret_cast<uint8_t*>(
+        reinterpret_cast<uintptr_t>(dst) & ~(uintptr_t)(page_size - 1));
+    size_t protect_size = (dst + aligned_size) - page_begin;
+
+    if (mprotect(page_begin, protect_size, PROT_READ | PROT_WRITE) != 0) {
+        return nullptr;
+    }
+    std::memcpy(dst, code, size);
+    if (mprotect(page_begin, protect_size, PROT_READ | PROT_EXEC) != 0) {
+        return nullptr;
+    }
+
+    chunk.m_offset += aligned_size;
+    m_used += aligned_size;
+
+    return dst;
+#else
+    (void)code;
+    (void)size;
+    return nullptr;
+#endif
+}
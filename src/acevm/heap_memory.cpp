@@ -1,95 +1,256 @@
 #include <acevm/heap_memory.hpp>
 
 #include <iostream>
+#include <new>
+
+// cells start 16-byte aligned, after the page header
+const size_t HeapPage::cells_offset = (sizeof(HeapPage) + 15) & ~(size_t)15;
+
+const size_t Heap::page_size = 64 * 1024;
+const uint32_t Heap::size_classes[Heap::num_size_classes] = { 32, 48, 64, 96, 128, 192, 256, 320, 384, 512 };
+
+const size_t Nursery::default_size = 256 * 1024;
 
 std::ostream &operator<<(std::ostream &os, const Heap &heap)
 {
-    HeapNode *tmp_head = heap.m_head;
-    while (tmp_head != nullptr) {
-        os  << tmp_head->value.GetId() << "\t"
-            << tmp_head->value.GetFlags() << "\t"
+    heap.ForEach([&](HeapValue *hv) {
+        os  << hv->GetId() << "\t"
+            << hv->GetFlags() << "\t"
             << "\n";
-
-        tmp_head = tmp_head->before;
-    }
+    });
     return os;
 }
 
 Heap::Heap()
-    : m_head(nullptr),
-      m_num_objects(0)
+    : m_num_objects(0),
+      m_num_allocated(0),
+      m_sweeping(false),
+      m_sweep_class(0),
+      m_sweep_prev(nullptr),
+      m_sweep_page(nullptr)
 {
+    for (SizeClass &size_class : m_classes) {
+        size_class.m_pages = nullptr;
+        size_class.m_last = nullptr;
+        size_class.m_free_page = nullptr;
+    }
 }
 
 Heap::~Heap()
 {
     // clean up all allocated objects
-    while (m_head != nullptr) {
-        HeapNode *tmp = m_head;
-        m_head = tmp->before;
-        delete tmp;
+    for (SizeClass &size_class : m_classes) {
+        while (size_class.m_pages != nullptr) {
+            HeapPage *page = size_class.m_pages;
+            for (uint32_t i = 0; i < page->m_num_used; i++) {
+                page->GetCell(i)->~HeapValue();
+            }
+            size_class.m_pages = page->m_next;
+            ::operator delete(page);
+        }
     }
 }
 
-HeapValue *Heap::Alloc()
+HeapPage *Heap::NewPage(SizeClass &size_class, uint32_t cell_size, uint32_t num_cells)
 {
-    HeapNode *node = new HeapNode;
-    node->value.GetFlags() |= GC_MARKED; // mark objects on first allocation
+    HeapPage *page = static_cast<HeapPage*>(::operator new(HeapPage::cells_offset + cell_size * num_cells));
+    page->m_next = nullptr;
+    page->m_free = nullptr;
+    page->m_cell_size = cell_size;
+    page->m_num_used = 0;
+    page->m_num_cells = num_cells;
+    // there is nothing on it for a sweep to delete
+    page->m_swept = true;
 
-    if (m_head != nullptr) {
-        m_head->after = node;
+    if (size_class.m_last != nullptr) {
+        size_class.m_last->m_next = page;
+    } else {
+        size_class.m_pages = page;
     }
-    node->before = m_head;
-    m_head = node;
+    size_class.m_last = page;
 
-    m_num_objects++;
+    return page;
+}
+
+HeapValue *Heap::Alloc(size_t payload_size)
+{
+    size_t size = sizeof(HeapValue) + payload_size;
+
+    size_t index = 0;
+    while (index < num_size_classes && size_classes[index] < size) {
+        index++;
+    }
+
+    SizeClass &size_class = m_classes[index];
+
+    HeapPage *page = size_class.m_free_page;
+    while (page != nullptr && page->m_free == nullptr) {
+        page = page->m_next;
+    }
+    size_class.m_free_page = page;
 
-    std::cout << "Alloc() called\n";
+    HeapValue *cell;
+    if (page != nullptr) {
+        cell = page->m_free;
+        page->m_free = *reinterpret_cast<HeapValue**>(cell->GetStorage());
+    } else {
+        page = size_class.m_last;
 
-    return &m_head->value;
+        if (index == num_size_classes) {
+            // too large for any class
+            page = NewPage(size_class, (size + 15) & ~(size_t)15, 1);
+        } else if (page == nullptr || page->m_num_used == page->m_num_cells) {
+            uint32_t cell_size = size_classes[index];
+            page = NewPage(size_class, cell_size, (page_size - HeapPage::cells_offset) / cell_size);
+        }
+
+        cell = page->GetCell(page->m_num_used++);
+    }
+
+    size_t capacity = index == num_size_classes ? size : size_classes[index];
+    HeapValue *hv = new (cell) HeapValue(capacity - sizeof(HeapValue));
+    if (m_sweeping && !page->m_swept) {
+        // it is not garbage, whatever the sweep finds
+        hv->GetFlags() |= GC_MARKED;
+    }
+
+    m_num_objects++;
+    m_num_allocated++;
+
+    return hv;
 }
 
 void Heap::Sweep()
 {
-    HeapNode *last = m_head;
-    while (last != nullptr) {
-        if (!(last->value.GetFlags() & GC_MARKED)) {
-            // unmarked object, so delete it
+    StartSweep();
+    SweepPages((size_t)-1);
+}
+
+void Heap::StartSweep()
+{
+    for (SizeClass &size_class : m_classes) {
+        for (HeapPage *page = size_class.m_pages; page != nullptr; page = page->m_next) {
+            page->m_swept = false;
+        }
+    }
 
-            HeapNode *after = last->after;
-            HeapNode *before = last->before;
+    m_sweeping = true;
+    m_sweep_class = 0;
+    m_sweep_prev = nullptr;
+    m_sweep_page = m_classes[0].m_pages;
+}
 
-            if (before != nullptr) {
-                before->after = after;
-            }
+bool Heap::SweepPages(size_t max_pages)
+{
+    while (m_sweeping && max_pages != 0) {
+        if (m_sweep_page == nullptr) {
+            // cells freed in the class are used
+            // again from its first page on
+            m_classes[m_sweep_class].m_free_page = m_classes[m_sweep_class].m_pages;
 
-            if (after != nullptr) {
-                // removing an item from the middle, so
-                // make the nodes to the other sides now
-                // point to each other
-                after->before = before;
-
-                // delete the middle node
-                delete last;
-                last = before;
-            } else {
-                delete last;
-
-                // since there are no nodes after this,
-                // set the head to be this node here
-                m_head = before;
-                last = m_head;
+            if (++m_sweep_class > num_size_classes) {
+                m_sweeping = false;
+                break;
             }
+            m_sweep_prev = nullptr;
+            m_sweep_page = m_classes[m_sweep_class].m_pages;
+            continue;
+        }
 
-            // decrement number of currently allocated
-            // objects
-            m_num_objects--;
+        HeapPage *next = m_sweep_page->m_next;
+        // pages made since the sweep started are skipped
+        if (m_sweep_page->m_swept || SweepPage(m_sweep_class, m_sweep_prev, m_sweep_page)) {
+            m_sweep_prev = m_sweep_page;
+        }
+        m_sweep_page = next;
+        max_pages--;
+    }
+
+    return !m_sweeping;
+}
+
+bool Heap::SweepPage(size_t index, HeapPage *prev, HeapPage *page)
+{
+    SizeClass &size_class = m_classes[index];
+    HeapValue *free = nullptr;
+    uint32_t num_live = 0;
+
+    for (uint32_t j = 0; j < page->m_num_used; j++) {
+        HeapValue *hv = page->GetCell(j);
 
+        if (hv->GetFlags() & GC_FREE) {
+            // already free
+        } else if (!(hv->GetFlags() & GC_MARKED)) {
+            // unmarked object, so delete it
+            hv->Clear();
+            hv->GetFlags() = GC_FREE;
+            m_num_objects--;
         } else {
             // the object is currently marked, so
             // we unmark it for the next time
-            last->value.GetFlags() &= ~GC_MARKED;
-            last = last->before;
+            hv->GetFlags() &= ~GC_MARKED;
+            num_live++;
+            continue;
         }
+
+        *reinterpret_cast<HeapValue**>(hv->GetStorage()) = free;
+        free = hv;
     }
+
+    page->m_free = free;
+    page->m_swept = true;
+
+    // the last page of a class is kept to bump from, except
+    // for large values, which never share a page
+    if (num_live == 0 && (page != size_class.m_last || index == num_size_classes)) {
+        for (uint32_t j = 0; j < page->m_num_used; j++) {
+            page->GetCell(j)->~HeapValue();
+        }
+
+        if (prev != nullptr) {
+            prev->m_next = page->m_next;
+        } else {
+            size_class.m_pages = page->m_next;
+        }
+        if (size_class.m_last == page) {
+            size_class.m_last = prev;
+        }
+        if (size_class.m_free_page == page) {
+            size_class.m_free_page = page->m_next;
+        }
+        ::operator delete(page);
+
+        return false;
+    }
+
+    return true;
+}
+
+Nursery::Nursery(size_t size)
+    : m_begin(size != 0 ? static_cast<char*>(::operator new(size)) : nullptr),
+      m_top(m_begin),
+      m_end(m_begin + size),
+      m_num_objects(0)
+{
+}
+
+Nursery::~Nursery()
+{
+    Reset();
+    ::operator delete(m_begin);
+}
+
+void Nursery::Reset()
+{
+    // values are laid out one after another, each
+    // header giving the size of what follows it
+    char *address = m_begin;
+    while (address < m_top) {
+        HeapValue *hv = reinterpret_cast<HeapValue*>(address);
+        address += sizeof(HeapValue) + hv->m_capacity;
+        hv->~HeapValue();
+    }
+
+    m_top = m_begin;
+    m_num_objects = 0;
 }
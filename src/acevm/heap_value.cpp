@@ -1,15 +1,110 @@
 #include <acevm/heap_value.hpp>
+#include <acevm/object.hpp>
+#include <acevm/string_builder.hpp>
 
-HeapValue::HeapValue()
-    : m_holder(nullptr),
-      m_ptr(nullptr),
-      m_flags(0)
+#include <common/utf8.hpp>
+
+HeapValue::HeapValue(uint32_t capacity)
+    : m_kind(HEAP_NONE),
+      m_flags(0),
+      m_capacity(capacity)
 {
 }
 
 HeapValue::~HeapValue()
 {
-    if (m_holder != nullptr) {
-        delete m_holder;
+    Clear();
+}
+
+HeapValue *HeapValue::Create(size_t capacity)
+{
+    void *memory = ::operator new(sizeof(HeapValue) + capacity);
+    return new (memory) HeapValue(capacity);
+}
+
+void HeapValue::Delete(HeapValue *hv)
+{
+    hv->~HeapValue();
+    ::operator delete(hv);
+}
+
+bool HeapValue::operator==(const HeapValue &other) const
+{
+    if (m_kind != other.m_kind) {
+        return false;
+    }
+
+    switch (m_kind) {
+    case HEAP_OBJECT:
+        return Get<Object>() == other.Get<Object>();
+    case HEAP_STRING:
+        return Get<utf::Utf8String>() == other.Get<utf::Utf8String>();
+    case HEAP_STRING_BUILDER:
+        return Get<StringBuilder>() == other.Get<StringBuilder>();
+    default:
+        return false;
+    }
+}
+
+size_t HeapValue::GetPayloadSize() const
+{
+    switch (m_kind) {
+    case HEAP_OBJECT:
+        return Object::SizeFor(Get<Object>().GetSize());
+    case HEAP_STRING:
+        return PayloadSize<utf::Utf8String>();
+    case HEAP_STRING_BUILDER:
+        return PayloadSize<StringBuilder>();
+    default:
+        return 0;
+    }
+}
+
+void HeapValue::MoveTo(HeapValue *other)
+{
+    switch (m_kind) {
+    case HEAP_OBJECT:
+    {
+        Object &from = Get<Object>();
+        Object &to = other->Emplace<Object>(from.GetSize());
+        for (int i = 0; i < from.GetSize(); i++) {
+            to.GetMember(i) = from.GetMember(i);
+        }
+        break;
+    }
+    case HEAP_STRING:
+        other->Emplace<utf::Utf8String>(std::move(Get<utf::Utf8String>()));
+        break;
+    case HEAP_STRING_BUILDER:
+        other->Emplace<StringBuilder>(std::move(Get<StringBuilder>()));
+        break;
+    default:
+        break;
+    }
+
+    Clear();
+
+    // the payload is no longer in use, so it holds the new address
+    assert(m_capacity >= sizeof(HeapValue*) && "no room for the forwarding address");
+    *reinterpret_cast<HeapValue**>(GetStorage()) = other;
+    m_flags |= GC_FORWARDED;
+}
+
+void HeapValue::Clear()
+{
+    switch (m_kind) {
+    case HEAP_OBJECT:
+        Get<Object>().~Object();
+        break;
+    case HEAP_STRING:
+        Get<utf::Utf8String>().~Utf8String();
+        break;
+    case HEAP_STRING_BUILDER:
+        Get<StringBuilder>().~StringBuilder();
+        break;
+    default:
+        break;
     }
+
+    m_kind = HEAP_NONE;
 }
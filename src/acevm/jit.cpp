@@ -0,0 +1,1039 @@
+#include <acevm/jit.hpp>
+#include <acevm/vm.hpp>
+#include <acevm/instructions.hpp>
+#include <acevm/object.hpp>
+
+#include <common/utf8.hpp>
+
+#include <vector>
+#include <cstring>
+#include <cstddef>
+
+const uint32_t Jit::continue_native = UINT32_MAX;
+
+#ifdef ACEVM_JIT
+
+enum X64Register : int {
+    RAX = 0, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+    R8, R9, R10, R11, R12, R13, R14, R15,
+};
+
+enum X64Condition : int {
+    CC_B = 0x2, CC_AE = 0x3, CC_E = 0x4, CC_NE = 0x5,
+    CC_A = 0x7, CC_P = 0xA, CC_NP = 0xB, CC_L = 0xC, CC_G = 0xF,
+};
+
+/** Encodes the handful of x86-64 instructions the JIT needs.
+    Memory operands are always [base + disp32]. */
+class X64Emitter {
+public:
+    inline std::vector<uint8_t> &GetCode() { return m_code; }
+    inline size_t Position() const { return m_code.size(); }
+
+    inline void Byte(uint8_t value) { m_code.push_back(value); }
+
+    inline void Int32(int32_t value)
+    {
+        uint8_t bytes[4];
+        std::memcpy(bytes, &value, 4);
+        m_code.insert(m_code.end(), bytes, bytes + 4);
+    }
+
+    inline void Int64(int64_t value)
+    {
+        uint8_t bytes[8];
+        std::memcpy(bytes, &value, 8);
+        m_code.insert(m_code.end(), bytes, bytes + 8);
+    }
+
+    inline void Patch32(size_t at, int32_t value) { std::memcpy(&m_code[at], &value, 4); }
+
+    // opcode prefix. REX is only emitted when it is needed
+    inline void Rex(bool wide, int reg, int base)
+    {
+        uint8_t rex = 0x40 | (wide << 3) | ((reg >> 3) << 2) | (base >> 3);
+        if (rex != 0x40) {
+            Byte(rex);
+        }
+    }
+
+    inline void Mem(int reg, int base, int32_t disp)
+    {
+        Byte(0x80 | ((reg & 7) << 3) | (base & 7));
+        if ((base & 7) == RSP) {
+            // rsp and r12 need a SIB byte as base
+            Byte(0x24);
+        }
+        Int32(disp);
+    }
+
+    inline void Direct(int reg, int rm) { Byte(0xC0 | ((reg & 7) << 3) | (rm & 7)); }
+
+    // mov r64, imm64
+    inline void MovImm64(int dst, int64_t value) { Rex(true, 0, dst); Byte(0xB8 + (dst & 7)); Int64(value); }
+    // mov r32, imm32
+    inline void MovImm32(int dst, int32_t value) { Rex(false, 0, dst); Byte(0xB8 + (dst & 7)); Int32(value); }
+    // mov r64, r64
+    inline void Mov64(int dst, int src) { Rex(true, src, dst); Byte(0x89); Direct(src, dst); }
+    // mov r32, [base + disp]
+    inline void Load32(int dst, int base, int32_t disp) { Rex(false, dst, base); Byte(0x8B); Mem(dst, base, disp); }
+    // mov r64, [base + disp]
+    inline void Load64(int dst, int base, int32_t disp) { Rex(true, dst, base); Byte(0x8B); Mem(dst, base, disp); }
+    // movsxd r64, dword [base + disp]
+    inline void LoadSx32(int dst, int base, int32_t disp) { Rex(true, dst, base); Byte(0x63); Mem(dst, base, disp); }
+    // mov [base + disp], r32
+    inline void Store32(int base, int32_t disp, int src) { Rex(false, src, base); Byte(0x89); Mem(src, base, disp); }
+    // mov [base + disp], r64
+    inline void Store64(int base, int32_t disp, int src) { Rex(true, src, base); Byte(0x89); Mem(src, base, disp); }
+    // mov dword [base + disp], imm32
+    inline void StoreImm32(int base, int32_t disp, int32_t value) { Rex(false, 0, base); Byte(0xC7); Mem(0, base, disp); Int32(value); }
+    // mov qword [base + disp], imm32 (sign extended)
+    inline void StoreImm64(int base, int32_t disp, int32_t value) { Rex(true, 0, base); Byte(0xC7); Mem(0, base, disp); Int32(value); }
+    // mov byte [base + disp], imm8
+    inline void StoreImm8(int base, int32_t disp, uint8_t value) { Rex(false, 0, base); Byte(0xC6); Mem(0, base, disp); Byte(value); }
+
+    // add/sub/imul r64, r64
+    inline void Add64(int dst, int src) { Rex(true, src, dst); Byte(0x01); Direct(src, dst); }
+    inline void Sub64(int dst, int src) { Rex(true, src, dst); Byte(0x29); Direct(src, dst); }
+    inline void Imul64(int dst, int src) { Rex(true, dst, src); Byte(0x0F); Byte(0xAF); Direct(dst, src); }
+    // cqo; idiv r64
+    inline void Cqo() { Byte(0x48); Byte(0x99); }
+    inline void Idiv64(int src) { Rex(true, 0, src); Byte(0xF7); Direct(7, src); }
+    // mov r32, r32
+    inline void Mov32(int dst, int src) { Rex(false, src, dst); Byte(0x89); Direct(src, dst); }
+    // sub r32, imm32
+    inline void SubImm32(int dst, int32_t value) { Rex(false, 0, dst); Byte(0x81); Direct(5, dst); Int32(value); }
+    // lea r64, [rip + rel32], returns the position of rel32 for patching
+    inline size_t LeaRip(int dst) { Rex(true, dst, 0); Byte(0x8D); Byte(0x05 | ((dst & 7) << 3)); Int32(0); return Position() - 4; }
+    // movsxd r64, dword [base + index * 4]
+    inline void LoadSxIndexed(int dst, int base, int index)
+    {
+        Byte(0x48 | ((dst >> 3) << 2) | ((index >> 3) << 1) | (base >> 3));
+        Byte(0x63);
+        Byte(0x04 | ((dst & 7) << 3));
+        Byte(0x80 | ((index & 7) << 3) | (base & 7));
+    }
+    // add r32, r32
+    inline void Add32(int dst, int src) { Rex(false, src, dst); Byte(0x01); Direct(src, dst); }
+    // sub r64, imm32
+    inline void SubImm64(int dst, int32_t value) { Rex(true, 0, dst); Byte(0x81); Direct(5, dst); Int32(value); }
+    // shl r64, imm8
+    inline void ShlImm64(int dst, uint8_t value) { Rex(true, 0, dst); Byte(0xC1); Direct(4, dst); Byte(value); }
+    // inc/dec qword [base + disp]
+    inline void IncMem64(int base, int32_t disp) { Rex(true, 0, base); Byte(0xFF); Mem(0, base, disp); }
+    inline void DecMem64(int base, int32_t disp) { Rex(true, 0, base); Byte(0xFF); Mem(1, base, disp); }
+
+    // cmp r32, [base + disp]
+    inline void Cmp32(int lhs, int base, int32_t disp) { Rex(false, lhs, base); Byte(0x3B); Mem(lhs, base, disp); }
+    // cmp r64, [base + disp]
+    inline void Cmp64(int lhs, int base, int32_t disp) { Rex(true, lhs, base); Byte(0x3B); Mem(lhs, base, disp); }
+    // cmp dword [base + disp], imm32
+    inline void CmpImm32(int base, int32_t disp, int32_t value) { Rex(false, 0, base); Byte(0x81); Mem(7, base, disp); Int32(value); }
+    // cmp qword [base + disp], imm32
+    inline void CmpImm64(int base, int32_t disp, int32_t value) { Rex(true, 0, base); Byte(0x81); Mem(7, base, disp); Int32(value); }
+    // cmp byte [base + disp], imm8
+    inline void CmpImm8(int base, int32_t disp, uint8_t value) { Rex(false, 0, base); Byte(0x80); Mem(7, base, disp); Byte(value); }
+    // cmp r64, imm32
+    inline void CmpRegImm64(int lhs, int32_t value) { Rex(true, 0, lhs); Byte(0x81); Direct(7, lhs); Int32(value); }
+    // cmp r32, imm32
+    inline void CmpRegImm32(int lhs, int32_t value) { Rex(false, 0, lhs); Byte(0x81); Direct(7, lhs); Int32(value); }
+    // test r64, r64
+    inline void Test64(int lhs, int rhs) { Rex(true, rhs, lhs); Byte(0x85); Direct(rhs, lhs); }
+
+    // setcc r8 (al, cl, dl and bl only); movzx r32, r8
+    inline void Setcc(int cc, int dst) { Byte(0x0F); Byte(0x90 + cc); Direct(0, dst); }
+    inline void Movzx8(int dst, int src) { Byte(0x0F); Byte(0xB6); Direct(dst, src); }
+    // and r8, r8
+    inline void And8(int dst, int src) { Byte(0x20); Direct(src, dst); }
+
+    // movdqu xmm, [base + disp]; movdqu [base + disp], xmm
+    inline void LoadXmm128(int dst, int base, int32_t disp) { Byte(0xF3); Rex(false, dst, base); Byte(0x0F); Byte(0x6F); Mem(dst, base, disp); }
+    inline void StoreXmm128(int base, int32_t disp, int src) { Byte(0xF3); Rex(false, src, base); Byte(0x0F); Byte(0x7F); Mem(src, base, disp); }
+    // movsd xmm, [base + disp]; movsd [base + disp], xmm
+    inline void LoadSd(int dst, int base, int32_t disp) { Byte(0xF2); Rex(false, dst, base); Byte(0x0F); Byte(0x10); Mem(dst, base, disp); }
+    inline void StoreSd(int base, int32_t disp, int src) { Byte(0xF2); Rex(false, src, base); Byte(0x0F); Byte(0x11); Mem(src, base, disp); }
+    // addsd (0x58), mulsd (0x59), subsd (0x5C), divsd (0x5E) xmm, [base + disp]
+    inline void ArithSd(uint8_t op, int dst, int base, int32_t disp) { Byte(0xF2); Rex(false, dst, base); Byte(0x0F); Byte(op); Mem(dst, base, disp); }
+    // ucomisd xmm, [base + disp]
+    inline void Ucomisd(int lhs, int base, int32_t disp) { Byte(0x66); Rex(false, lhs, base); Byte(0x0F); Byte(0x2E); Mem(lhs, base, disp); }
+    // xorpd xmm, xmm
+    inline void Xorpd(int dst, int src) { Byte(0x66); Byte(0x0F); Byte(0x57); Direct(dst, src); }
+
+    // jumps return the position of their rel32 operand, for patching
+    inline size_t Jcc(int cc) { Byte(0x0F); Byte(0x80 + cc); Int32(0); return Position() - 4; }
+    inline size_t Jmp() { Byte(0xE9); Int32(0); return Position() - 4; }
+    inline void PatchJump(size_t at, size_t target) { Patch32(at, (int32_t)(target - (at + 4))); }
+
+    inline void CallReg(int reg) { Rex(false, 0, reg); Byte(0xFF); Direct(2, reg); }
+    inline void JmpReg(int reg) { Rex(false, 0, reg); Byte(0xFF); Direct(4, reg); }
+    inline void Push(int reg) { Rex(false, 0, reg); Byte(0x50 + (reg & 7)); }
+    inline void Pop(int reg) { Rex(false, 0, reg); Byte(0x58 + (reg & 7)); }
+    inline void Ret() { Byte(0xC3); }
+
+private:
+    std::vector<uint8_t> m_code;
+};
+
+// register assignment inside of compiled code
+#define JIT_REGS RBX   // &Registers::m_reg[0]
+#define JIT_VM R12     // VM *
+#define JIT_SP R13     // &Stack::m_sp
+#define JIT_STACK R14  // Stack::m_data
+
+#define JIT_TYPE(reg) ((int32_t)((reg) * sizeof(StackValue) + offsetof(StackValue, m_type)))
+#define JIT_VALUE(reg) ((int32_t)((reg) * sizeof(StackValue) + offsetof(StackValue, m_value)))
+#define JIT_FLAGS ((int32_t)offsetof(Registers, m_flags))
+
+static_assert(sizeof(StackValue) == 16, "registers and stack slots are copied as 16 bytes");
+
+/** Compiles a single region of a program. */
+class JitCompiler {
+public:
+    JitCompiler(VM *vm, uint32_t entry)
+        : m_vm(vm),
+          m_program(*vm->m_program),
+          m_entry(entry),
+          m_end(entry)
+    {
+    }
+
+    bool Compile();
+
+    inline std::vector<uint8_t> &GetCode() { return m_emit.GetCode(); }
+
+private:
+    struct Fixup {
+        size_t m_at;
+        uint32_t m_pc;
+    };
+
+    VM *m_vm;
+    Program &m_program;
+    uint32_t m_entry;
+    uint32_t m_end;
+
+    X64Emitter m_emit;
+    // jump target of each instruction in the region, if it is known
+    std::vector<int64_t> m_targets;
+    // native offset of each instruction in the region
+    std::vector<size_t> m_native;
+    // jumps to instructions inside of the region
+    std::vector<Fixup> m_jumps;
+    // jumps to side exits that resume the interpreter at a pc
+    std::vector<Fixup> m_exits;
+    // jumps to the epilogue, which returns the pc in eax
+    std::vector<size_t> m_returns;
+    // references to the table of native offsets, used by jumps
+    // whose target is only known at runtime
+    std::vector<size_t> m_table_refs;
+
+    void ResolveTargets();
+    void FindRegionEnd();
+
+    bool InRegion(int64_t pc) const { return pc >= m_entry && pc < m_end; }
+
+    void EmitInstruction(uint32_t pc, const Instruction &ins);
+    void EmitExit(uint32_t pc);
+    void EmitExitIf(int cc, uint32_t pc);
+    void EmitStackOffsetCheck(uint32_t pc, const Instruction &ins);
+    void EmitJump(uint32_t pc, const Instruction &ins, int cc, bool always);
+    void EmitHelper(uint32_t (*helper)(VM*, const Instruction*, uint32_t), uint32_t pc, const Instruction &ins);
+    void EmitTypeGuard(uint8_t reg, int type, uint32_t pc);
+    void EmitArithmetic(uint32_t pc, const Instruction &ins, uint8_t generic, int type);
+    void EmitCompare(uint32_t pc, const Instruction &ins, int type);
+    void EmitCompareZero(uint32_t pc, const Instruction &ins);
+    void EmitSetFlags();
+};
+
+void JitCompiler::ResolveTargets()
+{
+    size_t limit = std::min(m_program.Size(), (size_t)m_entry + JIT_MAX_REGION_SIZE);
+    m_targets.assign(limit - m_entry, -1);
+
+    StaticMemory &static_memory = m_vm->m_static_memory;
+
+    // any address in static memory may be jumped to from elsewhere,
+    // so nothing is known about registers at those instructions
+    std::vector<bool> is_label(m_program.Size(), false);
+    for (size_t i = 0; i < static_memory.Size(); i++) {
+        if (static_memory[i].GetType() == StackValue::ADDRESS &&
+            static_memory[i].GetAddress() < m_program.Size()) {
+            is_label[static_memory[i].GetAddress()] = true;
+        }
+    }
+
+    // the address held by each register, when it was loaded
+    // from static memory earlier in the same block
+    int64_t known[8];
+    std::fill(known, known + 8, -1);
+
+    for (size_t pc = m_entry; pc < limit; pc++) {
+        if (is_label[pc]) {
+            std::fill(known, known + 8, -1);
+        }
+
+        const Instruction &ins = m_program[pc];
+
+        switch (ins.m_opcode) {
+        case LOAD_STATIC:
+            known[ins.m_a & 7] = -1;
+            if (ins.m_index < static_memory.Size() &&
+                static_memory[ins.m_index].GetType() == StackValue::ADDRESS) {
+                known[ins.m_a & 7] = static_memory[ins.m_index].GetAddress();
+            }
+            break;
+        case JMP:
+        case JE:
+        case JNE:
+        case JG:
+        case JGE:
+            m_targets[pc - m_entry] = known[ins.m_a & 7];
+            break;
+        case LOAD_I32:
+        case LOAD_I64:
+        case LOAD_F32:
+        case LOAD_F64:
+        case LOAD_LOCAL:
+        case LOAD_NULL:
+        case LOAD_TRUE:
+        case LOAD_FALSE:
+        case LOAD_MEM:
+        case NEW:
+            known[ins.m_a & 7] = -1;
+            break;
+        case ADD: case ADD_I32_I32: case ADD_I64_I64: case ADD_F64_F64:
+        case SUB: case SUB_I32_I32: case SUB_I64_I64: case SUB_F64_F64:
+        case MUL: case MUL_I32_I32: case MUL_I64_I64: case MUL_F64_F64:
+        case DIV: case DIV_I32_I32: case DIV_I64_I64: case DIV_F64_F64:
+            known[ins.m_c & 7] = -1;
+            break;
+        case CALL:
+            // the callee may write to any register
+            std::fill(known, known + 8, -1);
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+void JitCompiler::FindRegionEnd()
+{
+    // the region runs up to the first instruction that never falls
+    // through, unless a known jump goes past it
+    int64_t furthest = m_entry;
+    size_t limit = m_entry + m_targets.size();
+
+    for (size_t pc = m_entry; pc < limit; pc++) {
+        int64_t target = m_targets[pc - m_entry];
+        if (target >= m_entry && target < (int64_t)limit && target > furthest) {
+            furthest = target;
+        }
+
+        uint8_t code = m_program[pc].m_opcode;
+        bool falls_through = !(code == JMP || code == RET || code == EXIT ||
+            code == TAIL_CALL || code == BAD_INSTRUCTION);
+
+        if (!falls_through && furthest <= (int64_t)pc) {
+            m_end = pc + 1;
+            return;
+        }
+    }
+
+    m_end = limit;
+}
+
+void JitCompiler::EmitExit(uint32_t pc)
+{
+    m_exits.push_back({ m_emit.Jmp(), pc });
+}
+
+void JitCompiler::EmitExitIf(int cc, uint32_t pc)
+{
+    m_exits.push_back({ m_emit.Jcc(cc), pc });
+}
+
+// with the stack pointer in rcx, leave offsets that are out of bounds to
+// the interpreter, which throws. the verifier rules them out in advance.
+void JitCompiler::EmitStackOffsetCheck(uint32_t pc, const Instruction &ins)
+{
+    if (m_vm->m_verified) {
+        return;
+    }
+    if (ins.m_index == 0) {
+        EmitExit(pc);
+        return;
+    }
+    m_emit.CmpRegImm64(RCX, ins.m_index);
+    EmitExitIf(CC_B, pc);
+}
+
+void JitCompiler::EmitTypeGuard(uint8_t reg, int type, uint32_t pc)
+{
+    m_emit.CmpImm32(JIT_REGS, JIT_TYPE(reg), type);
+    EmitExitIf(CC_NE, pc);
+}
+
+void JitCompiler::EmitHelper(uint32_t (*helper)(VM*, const Instruction*, uint32_t),
+    uint32_t pc, const Instruction &ins)
+{
+    m_emit.Mov64(RDI, JIT_VM);
+    m_emit.MovImm64(RSI, (int64_t)&ins);
+    m_emit.MovImm32(RDX, pc);
+    m_emit.MovImm64(RAX, (int64_t)helper);
+    m_emit.CallReg(RAX);
+
+    // anything but continue_native is the pc to leave at
+    m_emit.CmpRegImm32(RAX, (int32_t)Jit::continue_native);
+    m_returns.push_back(m_emit.Jcc(CC_NE));
+}
+
+void JitCompiler::EmitSetFlags()
+{
+    // flags = (greater ? GREATER : 0) | (equal ? EQUAL : 0),
+    // with the conditions already in al (greater) and cl (equal)
+    m_emit.Movzx8(RAX, RAX);
+    m_emit.Add32(RAX, RAX);
+    m_emit.Movzx8(RCX, RCX);
+    m_emit.Add32(RAX, RCX);
+    m_emit.Store32(JIT_REGS, JIT_FLAGS, RAX);
+}
+
+void JitCompiler::EmitArithmetic(uint32_t pc, const Instruction &ins, uint8_t generic, int type)
+{
+    // generic instructions get an int32 and a double path,
+    // typed ones only the path for their type
+    bool is_div = generic == DIV;
+
+    size_t skip_int = 0;
+    std::vector<size_t> done;
+
+    if (type == StackValue::INT32 || type == StackValue::INT64 || type == -1) {
+        int int_type = type == -1 ? StackValue::INT32 : type;
+        bool wide = int_type == StackValue::INT64;
+
+        m_emit.CmpImm32(JIT_REGS, JIT_TYPE(ins.m_a), int_type);
+        size_t not_int_lhs = m_emit.Jcc(CC_NE);
+        m_emit.CmpImm32(JIT_REGS, JIT_TYPE(ins.m_b), int_type);
+        size_t not_int_rhs = m_emit.Jcc(CC_NE);
+
+        if (wide) {
+            m_emit.Load64(RAX, JIT_REGS, JIT_VALUE(ins.m_a));
+            m_emit.Load64(RCX, JIT_REGS, JIT_VALUE(ins.m_b));
+        } else {
+            m_emit.LoadSx32(RAX, JIT_REGS, JIT_VALUE(ins.m_a));
+            m_emit.LoadSx32(RCX, JIT_REGS, JIT_VALUE(ins.m_b));
+        }
+
+        switch (generic) {
+        case ADD:
+            m_emit.Add64(RAX, RCX);
+            break;
+        case SUB:
+            m_emit.Sub64(RAX, RCX);
+            break;
+        case MUL:
+            m_emit.Imul64(RAX, RCX);
+            break;
+        case DIV:
+            // division by zero throws, and INT64_MIN / -1 traps,
+            // so both are left to the interpreter
+            m_emit.Test64(RCX, RCX);
+            EmitExitIf(CC_E, pc);
+            if (wide) {
+                m_emit.CmpRegImm64(RCX, -1);
+                EmitExitIf(CC_E, pc);
+            }
+            m_emit.Cqo();
+            m_emit.Idiv64(RCX);
+            break;
+        }
+
+        m_emit.StoreImm32(JIT_REGS, JIT_TYPE(ins.m_c), int_type);
+        if (wide) {
+            m_emit.Store64(JIT_REGS, JIT_VALUE(ins.m_c), RAX);
+        } else {
+            m_emit.Store32(JIT_REGS, JIT_VALUE(ins.m_c), RAX);
+        }
+        done.push_back(m_emit.Jmp());
+
+        m_emit.PatchJump(not_int_lhs, m_emit.Position());
+        m_emit.PatchJump(not_int_rhs, m_emit.Position());
+        skip_int = 1;
+    }
+
+    if (type == StackValue::DOUBLE || type == -1) {
+        EmitTypeGuard(ins.m_a, StackValue::DOUBLE, pc);
+        EmitTypeGuard(ins.m_b, StackValue::DOUBLE, pc);
+
+        if (is_div) {
+            // dividing by 0.0 throws in the interpreter
+            m_emit.Xorpd(1, 1);
+            m_emit.Ucomisd(1, JIT_REGS, JIT_VALUE(ins.m_b));
+            size_t unordered = m_emit.Jcc(CC_P);
+            EmitExitIf(CC_E, pc);
+            m_emit.PatchJump(unordered, m_emit.Position());
+        }
+
+        static const uint8_t sse_ops[] = { 0x58, 0x5C, 0x59, 0x5E }; // add, sub, mul, div
+        m_emit.LoadSd(0, JIT_REGS, JIT_VALUE(ins.m_a));
+        m_emit.ArithSd(sse_ops[generic - ADD], 0, JIT_REGS, JIT_VALUE(ins.m_b));
+        m_emit.StoreImm32(JIT_REGS, JIT_TYPE(ins.m_c), StackValue::DOUBLE);
+        m_emit.StoreSd(JIT_REGS, JIT_VALUE(ins.m_c), 0);
+    } else if (skip_int) {
+        // operands of other types are left to the interpreter
+        EmitExit(pc);
+    }
+
+    for (size_t at : done) {
+        m_emit.PatchJump(at, m_emit.Position());
+    }
+}
+
+void JitCompiler::EmitCompare(uint32_t pc, const Instruction &ins, int type)
+{
+    std::vector<size_t> done;
+
+    if (type == StackValue::INT32 || type == StackValue::INT64 || type == -1) {
+        int int_type = type == -1 ? StackValue::INT32 : type;
+
+        m_emit.CmpImm32(JIT_REGS, JIT_TYPE(ins.m_a), int_type);
+        size_t not_int_lhs = m_emit.Jcc(CC_NE);
+        m_emit.CmpImm32(JIT_REGS, JIT_TYPE(ins.m_b), int_type);
+        size_t not_int_rhs = m_emit.Jcc(CC_NE);
+
+        if (int_type == StackValue::INT64) {
+            m_emit.Load64(RDX, JIT_REGS, JIT_VALUE(ins.m_a));
+            m_emit.Cmp64(RDX, JIT_REGS, JIT_VALUE(ins.m_b));
+        } else {
+            m_emit.Load32(RDX, JIT_REGS, JIT_VALUE(ins.m_a));
+            m_emit.Cmp32(RDX, JIT_REGS, JIT_VALUE(ins.m_b));
+        }
+        m_emit.Setcc(CC_G, RAX);
+        m_emit.Setcc(CC_E, RCX);
+        EmitSetFlags();
+        done.push_back(m_emit.Jmp());
+
+        m_emit.PatchJump(not_int_lhs, m_emit.Position());
+        m_emit.PatchJump(not_int_rhs, m_emit.Position());
+    }
+
+    if (type == StackValue::DOUBLE || type == -1) {
+        EmitTypeGuard(ins.m_a, StackValue::DOUBLE, pc);
+        EmitTypeGuard(ins.m_b, StackValue::DOUBLE, pc);
+
+        // unordered operands compare as neither greater nor equal
+        m_emit.LoadSd(0, JIT_REGS, JIT_VALUE(ins.m_a));
+        m_emit.Ucomisd(0, JIT_REGS, JIT_VALUE(ins.m_b));
+        m_emit.Setcc(CC_A, RAX);
+        m_emit.Setcc(CC_E, RCX);
+        m_emit.Setcc(CC_NP, RDX);
+        m_emit.And8(RCX, RDX);
+        EmitSetFlags();
+    } else {
+        EmitExit(pc);
+    }
+
+    for (size_t at : done) {
+        m_emit.PatchJump(at, m_emit.Position());
+    }
+}
+
+void JitCompiler::EmitCompareZero(uint32_t pc, const Instruction &ins)
+{
+    std::vector<size_t> done;
+
+    struct {
+        int m_type;
+        int m_width;
+    } const cases[] = {
+        { StackValue::INT32, 4 },
+        { StackValue::INT64, 8 },
+        { StackValue::BOOLEAN, 1 },
+        { StackValue::HEAP_POINTER, 8 },
+    };
+
+    for (const auto &c : cases) {
+        m_emit.CmpImm32(JIT_REGS, JIT_TYPE(ins.m_a), c.m_type);
+        size_t next = m_emit.Jcc(CC_NE);
+
+        switch (c.m_width) {
+        case 1:
+            m_emit.CmpImm8(JIT_REGS, JIT_VALUE(ins.m_a), 0);
+            break;
+        case 4:
+            m_emit.CmpImm32(JIT_REGS, JIT_VALUE(ins.m_a), 0);
+            break;
+        case 8:
+            m_emit.CmpImm64(JIT_REGS, JIT_VALUE(ins.m_a), 0);
+            break;
+        }
+
+        // zero, false and null set EQUAL, anything else NONE
+        m_emit.Setcc(CC_E, RAX);
+        m_emit.Movzx8(RAX, RAX);
+        m_emit.Store32(JIT_REGS, JIT_FLAGS, RAX);
+        done.push_back(m_emit.Jmp());
+
+        m_emit.PatchJump(next, m_emit.Position());
+    }
+
+    // floating point, functions and errors are left to the interpreter
+    EmitExit(pc);
+
+    for (size_t at : done) {
+        m_emit.PatchJump(at, m_emit.Position());
+    }
+}
+
+void JitCompiler::EmitJump(uint32_t pc, const Instruction &ins, int cc, bool always)
+{
+    size_t not_taken = 0;
+
+    if (!always) {
+        if (cc == CC_NE && ins.m_opcode == JGE) {
+            // GREATER or EQUAL, i.e. the flags are not NONE
+            m_emit.CmpImm32(JIT_REGS, JIT_FLAGS, NONE);
+        } else {
+            m_emit.CmpImm32(JIT_REGS, JIT_FLAGS, ins.m_opcode == JG ? GREATER : EQUAL);
+        }
+        // skip over the jump when the condition does not hold
+        not_taken = m_emit.Jcc(cc ^ 1);
+    }
+
+    int64_t target = m_targets[pc - m_entry];
+
+    if (InRegion(target)) {
+        m_jumps.push_back({ m_emit.Jmp(), (uint32_t)target });
+    } else if (target != -1) {
+        EmitExit((uint32_t)target);
+    } else {
+        // the address is only known at runtime. targets inside of the
+        // region are found through the table, anything else is left
+        // to the interpreter, as is a register without an address
+        EmitTypeGuard(ins.m_a, StackValue::ADDRESS, pc);
+        m_emit.Load32(RAX, JIT_REGS, JIT_VALUE(ins.m_a));
+        m_emit.Mov32(RCX, RAX);
+        m_emit.SubImm32(RCX, m_entry);
+        m_emit.CmpRegImm32(RCX, m_end - m_entry);
+        m_returns.push_back(m_emit.Jcc(CC_AE));
+        m_table_refs.push_back(m_emit.LeaRip(RDX));
+        m_emit.LoadSxIndexed(RCX, RDX, RCX);
+        m_emit.Add64(RCX, RDX);
+        m_emit.JmpReg(RCX);
+    }
+
+    if (!always) {
+        m_emit.PatchJump(not_taken, m_emit.Position());
+    }
+}
+
+void JitCompiler::EmitInstruction(uint32_t pc, const Instruction &ins)
+{
+    switch (ins.m_opcode) {
+    case NOP:
+        break;
+    case LOAD_I32:
+        m_emit.StoreImm32(JIT_REGS, JIT_TYPE(ins.m_a), StackValue::INT32);
+        m_emit.StoreImm32(JIT_REGS, JIT_VALUE(ins.m_a), ins.m_imm.i32);
+        break;
+    case LOAD_I64:
+        m_emit.StoreImm32(JIT_REGS, JIT_TYPE(ins.m_a), StackValue::INT64);
+        m_emit.MovImm64(RAX, ins.m_imm.i64);
+        m_emit.Store64(JIT_REGS, JIT_VALUE(ins.m_a), RAX);
+        break;
+    case LOAD_F32:
+    {
+        int32_t bits;
+        std::memcpy(&bits, &ins.m_imm.f, sizeof(bits));
+        m_emit.StoreImm32(JIT_REGS, JIT_TYPE(ins.m_a), StackValue::FLOAT);
+        m_emit.StoreImm32(JIT_REGS, JIT_VALUE(ins.m_a), bits);
+        break;
+    }
+    case LOAD_F64:
+        m_emit.StoreImm32(JIT_REGS, JIT_TYPE(ins.m_a), StackValue::DOUBLE);
+        m_emit.MovImm64(RAX, ins.m_imm.i64);
+        m_emit.Store64(JIT_REGS, JIT_VALUE(ins.m_a), RAX);
+        break;
+    case LOAD_NULL:
+        m_emit.StoreImm32(JIT_REGS, JIT_TYPE(ins.m_a), StackValue::HEAP_POINTER);
+        m_emit.StoreImm64(JIT_REGS, JIT_VALUE(ins.m_a), 0);
+        break;
+    case LOAD_TRUE:
+    case LOAD_FALSE:
+        m_emit.StoreImm32(JIT_REGS, JIT_TYPE(ins.m_a), StackValue::BOOLEAN);
+        m_emit.StoreImm8(JIT_REGS, JIT_VALUE(ins.m_a), ins.m_opcode == LOAD_TRUE);
+        break;
+    case LOAD_STATIC:
+        if (ins.m_index >= m_vm->m_static_memory.Size()) {
+            // not stored yet, leave it to the interpreter
+            EmitExit(pc);
+            break;
+        }
+        // static memory may move when it grows, so load its address each time
+        m_emit.MovImm64(RAX, (int64_t)&m_vm->m_static_memory.m_data);
+        m_emit.Load64(RAX, RAX, 0);
+        m_emit.LoadXmm128(0, RAX, ins.m_index * sizeof(StackValue));
+        m_emit.StoreXmm128(JIT_REGS, JIT_TYPE(ins.m_a), 0);
+        break;
+    case LOAD_LOCAL:
+        // stack[sp - offset]
+        m_emit.Load64(RCX, JIT_SP, 0);
+        EmitStackOffsetCheck(pc, ins);
+        m_emit.SubImm64(RCX, ins.m_index);
+        m_emit.ShlImm64(RCX, 4);
+        m_emit.Add64(RCX, JIT_STACK);
+        m_emit.LoadXmm128(0, RCX, 0);
+        m_emit.StoreXmm128(JIT_REGS, JIT_TYPE(ins.m_a), 0);
+        break;
+    case MOV:
+        m_emit.Load64(RCX, JIT_SP, 0);
+        EmitStackOffsetCheck(pc, ins);
+        m_emit.SubImm64(RCX, ins.m_index);
+        m_emit.ShlImm64(RCX, 4);
+        m_emit.Add64(RCX, JIT_STACK);
+        m_emit.LoadXmm128(0, JIT_REGS, JIT_TYPE(ins.m_a));
+        m_emit.StoreXmm128(RCX, 0, 0);
+        break;
+    case PUSH:
+        // a full stack is left to the interpreter. verified
+        // programs have made room for the frame on entry.
+        m_emit.Load64(RCX, JIT_SP, 0);
+        if (!m_vm->m_verified) {
+            m_emit.CmpRegImm64(RCX, (int32_t)m_vm->m_exec_thread.m_stack.GetLimit());
+            EmitExitIf(CC_AE, pc);
+        }
+        m_emit.ShlImm64(RCX, 4);
+        m_emit.Add64(RCX, JIT_STACK);
+        m_emit.LoadXmm128(0, JIT_REGS, JIT_TYPE(ins.m_a));
+        m_emit.StoreXmm128(RCX, 0, 0);
+        m_emit.IncMem64(JIT_SP, 0);
+        break;
+    case POP:
+        if (!m_vm->m_verified) {
+            m_emit.CmpImm64(JIT_SP, 0, 0);
+            EmitExitIf(CC_E, pc);
+        }
+        m_emit.DecMem64(JIT_SP, 0);
+        break;
+    case ECHO:
+        EmitHelper(&Jit::HelperEcho, pc, ins);
+        break;
+    case ECHO_NEWLINE:
+        EmitHelper(&Jit::HelperEchoNewline, pc, ins);
+        break;
+    case LOAD_MEM:
+        EmitHelper(&Jit::HelperLoadMem, pc, ins);
+        break;
+    case MOV_MEM:
+        EmitHelper(&Jit::HelperMovMem, pc, ins);
+        break;
+    case NEW:
+        EmitHelper(&Jit::HelperNew, pc, ins);
+        break;
+    case CALL:
+        EmitHelper(&Jit::HelperCall, pc, ins);
+        break;
+    case JMP:
+        EmitJump(pc, ins, 0, true);
+        break;
+    case JE:
+    case JG:
+        EmitJump(pc, ins, CC_E, false);
+        break;
+    case JNE:
+        EmitJump(pc, ins, CC_NE, false);
+        break;
+    case JGE:
+        EmitJump(pc, ins, CC_NE, false);
+        break;
+    case CMP:
+        EmitCompare(pc, ins, -1);
+        break;
+    case CMP_I32_I32:
+        EmitCompare(pc, ins, StackValue::INT32);
+        break;
+    case CMP_I64_I64:
+        EmitCompare(pc, ins, StackValue::INT64);
+        break;
+    case CMP_F64_F64:
+        EmitCompare(pc, ins, StackValue::DOUBLE);
+        break;
+    case CMPZ:
+        EmitCompareZero(pc, ins);
+        break;
+    case ADD:
+    case SUB:
+    case MUL:
+    case DIV:
+        EmitArithmetic(pc, ins, ins.m_opcode, -1);
+        break;
+    case ADD_I32_I32: case SUB_I32_I32: case MUL_I32_I32: case DIV_I32_I32:
+    case ADD_I64_I64: case SUB_I64_I64: case MUL_I64_I64: case DIV_I64_I64:
+    case ADD_F64_F64: case SUB_F64_F64: case MUL_F64_F64: case DIV_F64_F64:
+    {
+        static const int types[] = { StackValue::INT32, StackValue::INT64, StackValue::DOUBLE };
+        int variant = (ins.m_opcode - ADD_I32_I32) % 3;
+        uint8_t generic = ADD + (ins.m_opcode - ADD_I32_I32) / 3;
+        EmitArithmetic(pc, ins, generic, types[variant]);
+        break;
+    }
+    default:
+        // RET, EXIT, TAIL_CALL, try blocks, static stores and
+        // unknown instructions are all run by the interpreter
+        EmitExit(pc);
+        break;
+    }
+}
+
+bool JitCompiler::Compile()
+{
+    ResolveTargets();
+    FindRegionEnd();
+
+    // prologue. five pushes keep the stack 16-byte aligned for calls
+    m_emit.Push(RBX);
+    m_emit.Push(R12);
+    m_emit.Push(R13);
+    m_emit.Push(R14);
+    m_emit.Push(R15);
+
+    ExecutionThread &thread = m_vm->m_exec_thread;
+    m_emit.Mov64(JIT_VM, RDI);
+    m_emit.MovImm64(JIT_REGS, (int64_t)&thread.m_regs.m_reg[0]);
+    m_emit.MovImm64(JIT_SP, (int64_t)&thread.m_stack.m_sp);
+    m_emit.MovImm64(JIT_STACK, (int64_t)thread.m_stack.m_data);
+
+    m_native.assign(m_end - m_entry, 0);
+
+    for (uint32_t pc = m_entry; pc < m_end; pc++) {
+        m_native[pc - m_entry] = m_emit.Position();
+        EmitInstruction(pc, m_program[pc]);
+    }
+
+    // falling off the end of the region continues in the interpreter
+    EmitExit(m_end);
+
+    for (const Fixup &jump : m_jumps) {
+        m_emit.PatchJump(jump.m_at, m_native[jump.m_pc - m_entry]);
+    }
+
+    // side exits, out of line so the common paths stay straight
+    for (const Fixup &exit : m_exits) {
+        m_emit.PatchJump(exit.m_at, m_emit.Position());
+        m_emit.MovImm32(RAX, exit.m_pc);
+        m_returns.push_back(m_emit.Jmp());
+    }
+
+    // epilogue, returns the pc in eax
+    size_t epilogue = m_emit.Position();
+    m_emit.Pop(R15);
+    m_emit.Pop(R14);
+    m_emit.Pop(R13);
+    m_emit.Pop(R12);
+    m_emit.Pop(RBX);
+    m_emit.Ret();
+
+    for (size_t at : m_returns) {
+        m_emit.PatchJump(at, epilogue);
+    }
+
+    if (!m_table_refs.empty()) {
+        while (m_emit.Position() % 4 != 0) {
+            m_emit.Byte(0xCC);
+        }
+
+        size_t table = m_emit.Position();
+        for (size_t native : m_native) {
+            m_emit.Int32((int32_t)(native - table));
+        }
+
+        for (size_t at : m_table_refs) {
+            m_emit.PatchJump(at, table);
+        }
+    }
+
+    return true;
+}
+
+#endif
+
+Jit::Jit(VM *vm)
+    : m_vm(vm),
+#ifdef ACEVM_JIT
+      m_enabled(true),
+#else
+      m_enabled(false),
+#endif
+      m_threshold(JIT_DEFAULT_THRESHOLD),
+      m_num_compiled(0)
+{
+}
+
+Jit::~Jit()
+{
+}
+
+bool Jit::Enter(uint32_t &pc)
+{
+#ifdef ACEVM_JIT
+    if (m_code.empty()) {
+        m_counters.assign(m_vm->m_program->Size(), 0);
+        m_code.assign(m_vm->m_program->Size(), nullptr);
+    }
+
+    std::vector<Frame> &frames = m_vm->m_exec_thread.m_frames;
+    bool entered = false;
+
+    for (;;) {
+        JitFunction code = m_code[pc];
+
+        if (code == nullptr) {
+            uint32_t &counter = m_counters[pc];
+            if (counter == UINT32_MAX || ++counter < m_threshold) {
+                return entered;
+            }
+
+            if ((code = Compile(pc)) == nullptr) {
+                // never try to compile this pc again
+                counter = UINT32_MAX;
+                return entered;
+            }
+
+            m_code[pc] = code;
+        }
+
+        size_t depth = frames.size();
+        pc = code(m_vm);
+        entered = true;
+
+        if (pc >= m_code.size()) {
+            m_vm->ThrowException(Exception("jump out of bounds"));
+            return true;
+        }
+
+        // native code leaves at a CALL once the callee's frame is pushed.
+        // that is an entry to the callee, which may be compiled as well.
+        if (frames.size() <= depth || m_vm->m_exec_thread.m_exception_state.m_exception_occured) {
+            return true;
+        }
+    }
+#else
+    (void)pc;
+    return false;
+#endif
+}
+
+JitFunction Jit::Compile(uint32_t entry)
+{
+#ifdef ACEVM_JIT
+    JitCompiler compiler(m_vm, entry);
+    if (!compiler.Compile()) {
+        return nullptr;
+    }
+
+    std::vector<uint8_t> &code = compiler.GetCode();
+    void *native = m_memory.Install(code.data(), code.size());
+    if (native == nullptr) {
+        return nullptr;
+    }
+
+    m_num_compiled++;
+
+    return reinterpret_cast<JitFunction>(native);
+#else
+    (void)entry;
+    return nullptr;
+#endif
+}
+
+uint32_t Jit::HelperEcho(VM *vm, const Instruction *ins, uint32_t pc)
+{
+    (void)pc;
+    vm->Echo(vm->m_exec_thread.m_regs[ins->m_a]);
+    return continue_native;
+}
+
+uint32_t Jit::HelperEchoNewline(VM *vm, const Instruction *ins, uint32_t pc)
+{
+    (void)vm;
+    (void)ins;
+    (void)pc;
+    utf::cout << "\n";
+    return continue_native;
+}
+
+uint32_t Jit::HelperLoadMem(VM *vm, const Instruction *ins, uint32_t pc)
+{
+    StackValue &sv = vm->m_exec_thread.m_regs[ins->m_b];
+    if (sv.GetType() != StackValue::HEAP_POINTER || sv.GetHeapPointer() == nullptr) {
+        // let the interpreter run it again and throw
+        return pc;
+    }
+
+    Object *objptr = sv.GetHeapPointer()->GetPointer<Object>();
+    if (objptr == nullptr || ins->m_c >= objptr->GetSize()) {
+        return pc;
+    }
+
+    vm->m_exec_thread.m_regs[ins->m_a] = objptr->GetMember(ins->m_c);
+    return continue_native;
+}
+
+uint32_t Jit::HelperMovMem(VM *vm, const Instruction *ins, uint32_t pc)
+{
+    StackValue &sv = vm->m_exec_thread.m_regs[ins->m_a];
+    if (sv.GetType() != StackValue::HEAP_POINTER || sv.GetHeapPointer() == nullptr) {
+        // let the interpreter run it again and throw
+        return pc;
+    }
+
+    Object *objptr = sv.GetHeapPointer()->GetPointer<Object>();
+    if (objptr == nullptr || ins->m_b >= objptr->GetSize()) {
+        return pc;
+    }
+
+    vm->StoreMember(sv.GetHeapPointer(), objptr->GetMember(ins->m_b), vm->m_exec_thread.m_regs[ins->m_c]);
+    return continue_native;
+}
+
+uint32_t Jit::HelperNew(VM *vm, const Instruction *ins, uint32_t pc)
+{
+    // unverified programs are checked by the interpreter
+    if (ins->m_index >= vm->m_static_memory.Size()) {
+        return pc;
+    }
+
+    StackValue &type_sv = vm->m_static_memory[ins->m_index];
+    if (type_sv.GetType() != StackValue::TYPE_INFO) {
+        return pc;
+    }
+
+    // allocating may run the gc or throw
+    int size = type_sv.GetTypeInfo().m_size;
+    HeapValue *hv = vm->HeapAlloc(Object::SizeFor(size));
+    if (hv == nullptr || vm->m_exec_thread.m_exception_state.m_exception_occured) {
+        return pc + 1;
+    }
+
+    hv->Emplace<Object>(size);
+
+    StackValue &sv = vm->m_exec_thread.m_regs[ins->m_a];
+    sv.SetHeapPointer(hv);
+
+    return continue_native;
+}
+
+uint32_t Jit::HelperCall(VM *vm, const Instruction *ins, uint32_t pc)
+{
+    StackValue &func = vm->m_exec_thread.m_regs[ins->m_a];
+
+    // calls never nest on the native stack. the frame is pushed
+    // here, and the function is entered from Enter()
+    if (!vm->PushFrame(func, ins->m_b, pc + 1)) {
+        // an exception is pending
+        return pc + 1;
+    }
+
+    return func.GetFunction().m_addr;
+}
@@ -1,8 +1,12 @@
 #include <iostream>
-#include <fstream>
 
 #include <acevm/vm.hpp>
+#include <acevm/bytecode_file.hpp>
 #include <acevm/bytecode_stream.hpp>
+#include <acevm/decoder.hpp>
+#include <acevm/verifier.hpp>
+#include <acevm/snapshot.hpp>
+#include <acevm/program.hpp>
 #include <acevm/instructions.hpp>
 
 #include <common/utf8.hpp>
@@ -10,6 +14,7 @@
 #include <chrono>
 #include <string>
 #include <algorithm>
+#include <cstdlib>
 
 /** check if the option is set */
 inline bool has_option(char **begin, char **end, const std::string &opt)
@@ -27,37 +32,162 @@ inline char *get_option_value(char **begin, char **end, const std::string &opt)
     return nullptr;
 }
 
+/** retrieve the text after an option of the form --name=value */
+inline const char *get_option_suffix(char **begin, char **end, const std::string &prefix)
+{
+    for (char **it = begin; it != end; ++it) {
+        if (std::string(*it).compare(0, prefix.length(), prefix) == 0) {
+            return *it + prefix.length();
+        }
+    }
+    return nullptr;
+}
+
 int main(int argc, char *argv[])
 {
     std::chrono::time_point<std::chrono::high_resolution_clock> start, end;
     start = std::chrono::high_resolution_clock::now();
 
     if (argc == 1) {
-        utf::cout << "\tUsage: " << argv[0] << " <file>\n";
+        utf::cout << "\tUsage: " << argv[0] << " <file> [--stats] [--checked] [--jit=off|on|threshold=N]"
+            << " [--stack-size=N] [--gc-pause-budget-us=N] [--gc-concurrent]"
+            << " [--snapshot-out=<file>|--snapshot-in=<file>]\n";
 
     } else if (argc >= 2) {
         utf::Utf8String filename(argv[1]);
 
-        // load bytecode from file
-        std::ifstream file(filename.GetData(), std::ios::in | std::ios::binary | std::ios::ate);
-        if (!file.is_open()) {
+        // load bytecode from file. it stays mapped until the program ends.
+        BytecodeFile file;
+        if (!file.Open(filename.GetData())) {
             utf::cout << "Could not open file " << filename << "\n";
             return 1;
         }
 
-        size_t bytecode_size = file.tellg();
-        file.seekg(0, std::ios::beg);
+        BytecodeStream bytecode_stream(file.GetData(), file.GetSize());
 
-        char *bytecodes = new char[bytecode_size];
-        file.read(bytecodes, bytecode_size);
-        file.close();
+        // decode all instructions up front
+        Program program;
+        Decoder decoder(&bytecode_stream);
+        if (!decoder.Decode(program)) {
+            utf::cout << "Could not load file " << filename << ": "
+                << decoder.GetError().c_str() << "\n";
+            return 1;
+        }
+
+        Verifier verifier(&program);
+        VerifyResult verify_result = verifier.Verify();
+        if (verify_result == VERIFY_MALFORMED) {
+            utf::cout << "Could not load file " << filename << ": "
+                << verifier.GetError().c_str() << "\n";
+            return 1;
+        }
 
-        BytecodeStream bytecode_stream(bytecodes, bytecode_size);
+        // the stack is only committed as it is used, so a large
+        // limit costs nothing until a program needs it
+        size_t stack_limit = Stack::default_limit;
+        if (const char *stack_option = get_option_suffix(argv, argv + argc, "--stack-size=")) {
+            stack_limit = std::strtoul(stack_option, nullptr, 10);
+            if (stack_limit == 0 || stack_limit > Stack::max_limit) {
+                utf::cout << "--stack-size must be between 1 and " << (int)Stack::max_limit << "\n";
+                return 1;
+            }
+        }
 
-        VM vm(&bytecode_stream);
-        vm.Execute();
+        // a restored snapshot stays mapped, like the bytecode,
+        // since strings in static memory and the heap point into it
+        BytecodeFile snapshot_file;
 
-        delete[] bytecodes;
+        VM vm(&program, stack_limit);
+
+        // the heap is marked in slices of about this long,
+        // instead of stopping everything until it is done
+        if (const char *budget_option = get_option_suffix(argv, argv + argc, "--gc-pause-budget-us=")) {
+            vm.SetGcPauseBudget(std::strtoul(budget_option, nullptr, 10));
+        }
+        // or on a thread of its own, while the program keeps running
+        if (has_option(argv, argv + argc, "--gc-concurrent")) {
+            vm.SetGcConcurrent(true);
+        }
+
+        // programs that could not be proven safe keep their runtime checks
+        if (verify_result == VERIFY_OK && !has_option(argv, argv + argc, "--checked")) {
+            vm.SetVerified(verifier.GetMaxStackDepth());
+        }
+
+        if (const char *jit_option = get_option_suffix(argv, argv + argc, "--jit=")) {
+            std::string value(jit_option);
+            if (value == "off") {
+                vm.GetJit().SetEnabled(false);
+            } else if (value == "on") {
+                vm.GetJit().SetEnabled(true);
+            } else if (value.compare(0, 10, "threshold=") == 0) {
+                vm.GetJit().SetEnabled(true);
+                vm.GetJit().SetThreshold(std::strtoul(value.c_str() + 10, nullptr, 10));
+            } else {
+                utf::cout << "Unknown --jit option " << jit_option << "\n";
+                return 1;
+            }
+        }
+
+        // a snapshot holds the state of the VM right after the
+        // initializers, so they only ever have to run once
+        uint32_t entry_pc = 0;
+        if (const char *snapshot_path = get_option_suffix(argv, argv + argc, "--snapshot-in=")) {
+            Snapshot snapshot(&vm);
+            if (!snapshot.Load(snapshot_path, snapshot_file, entry_pc)) {
+                utf::cout << "Could not load snapshot " << snapshot_path << ": "
+                    << snapshot.GetError().c_str() << "\n";
+                return 1;
+            }
+        } else {
+            entry_pc = vm.Initialize();
+
+            if (const char *snapshot_path = get_option_suffix(argv, argv + argc, "--snapshot-out=")) {
+                Snapshot snapshot(&vm);
+                if (!snapshot.Save(snapshot_path, entry_pc)) {
+                    utf::cout << "Could not save snapshot " << snapshot_path << ": "
+                        << snapshot.GetError().c_str() << "\n";
+                    return 1;
+                }
+            }
+        }
+
+        auto ready = std::chrono::high_resolution_clock::now();
+
+        vm.Execute(entry_pc);
+
+        if (has_option(argv, argv + argc, "--stats")) {
+            auto startup_ms = std::chrono::duration_cast<std::chrono::duration<double, std::milli>>(ready - start).count();
+            utf::cout << "startup: " << startup_ms << "ms\n";
+            vm.PrintQuickeningStats();
+            utf::cout << "jit: " << (int)vm.GetJit().GetNumCompiled() << " regions compiled\n";
+            const GcStats &gc_stats = vm.GetGcStats();
+            utf::cout << "gc: " << (int)gc_stats.m_minor_collections << " minor collections ("
+                << gc_stats.m_minor_seconds * 1000 << "ms, longest "
+                << gc_stats.m_minor_max_seconds * 1000 << "ms, "
+                << (int)gc_stats.m_promoted << " values promoted), "
+                << (int)gc_stats.m_major_collections << " full collections ("
+                << gc_stats.m_major_seconds * 1000 << "ms paused, "
+                << gc_stats.m_concurrent_seconds * 1000 << "ms marking concurrently)\n";
+            if (!gc_stats.m_slice_seconds.empty()) {
+                utf::cout << "gc pauses: " << (int)gc_stats.m_slice_seconds.size() << ", median "
+                    << gc_stats.SlicePercentile(0.5) * 1e6 << "us, p90 "
+                    << gc_stats.SlicePercentile(0.9) * 1e6 << "us, p99 "
+                    << gc_stats.SlicePercentile(0.99) * 1e6 << "us, longest "
+                    << gc_stats.SlicePercentile(1.0) * 1e6 << "us\n";
+            }
+            utf::cout << "static memory: " << (int)vm.GetStaticMemory().Size() << " slots, "
+                << (int)decoder.GetNumInterned() << " duplicate constants interned\n";
+            if (vm.IsVerified()) {
+                utf::cout << "verifier: verified, max stack depth "
+                    << (int)verifier.GetMaxStackDepth() << "\n";
+            } else if (verify_result == VERIFY_OK) {
+                utf::cout << "verifier: running with checks, --checked was given\n";
+            } else {
+                utf::cout << "verifier: running with checks, "
+                    << verifier.GetError().c_str() << "\n";
+            }
+        }
 
         end = std::chrono::high_resolution_clock::now();
         auto elapsed_ms = std::chrono::duration_cast<std::chrono::duration<double, std::ratio<1>>>(end - start).count();
@@ -1,39 +1,20 @@
 #include <acevm/object.hpp>
 
-Object::Object(int size)
-    : m_size(size),
-      m_members(new StackValue[size])
-{
-}
+#include <new>
 
-Object::Object(const Object &other)
-    : m_size(other.m_size),
-      m_members(new StackValue[other.m_size])
+Object::Object(int size)
+    : m_size(size)
 {
-    // copy all members
+    StackValue *members = GetMembers();
     for (int i = 0; i < m_size; i++) {
-        m_members[i] = other.m_members[i];
+        new (&members[i]) StackValue();
     }
 }
 
 Object::~Object()
 {
-    delete[] m_members;
-}
-
-Object &Object::operator=(const Object &other)
-{
-    if (m_members != nullptr) {
-        delete[] m_members;
-    }
-
-    m_size = other.m_size;
-    m_members = new StackValue[other.m_size];
-
-    // copy all members
+    StackValue *members = GetMembers();
     for (int i = 0; i < m_size; i++) {
-        m_members[i] = other.m_members[i];
+        members[i].~StackValue();
     }
-
-    return *this;
 }
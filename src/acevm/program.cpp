@@ -0,0 +1,42 @@
+#include <acevm/program.hpp>
+#include <acevm/instructions.hpp>
+
+Program::Program()
+{
+}
+
+Program::~Program()
+{
+}
+
+void Program::Append(const Instruction &ins)
+{
+    m_instructions.push_back(ins);
+
+    switch (ins.m_opcode) {
+    case ADD:
+    case SUB:
+    case MUL:
+    case DIV:
+    case CMP:
+    {
+        // give each instruction that can be quickened a profile
+        QuickenSite site = QuickenSite();
+        site.m_pc = m_instructions.size() - 1;
+        site.m_opcode = ins.m_opcode;
+
+        m_instructions.back().m_index = m_sites.size();
+        m_sites.push_back(site);
+
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+void Program::Clear()
+{
+    m_instructions.clear();
+    m_sites.clear();
+}
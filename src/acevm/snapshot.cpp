@@ -0,0 +1,478 @@
+#include <acevm/snapshot.hpp>
+#include <acevm/bytecode_file.hpp>
+#include <acevm/bytecode_stream.hpp>
+#include <acevm/instructions.hpp>
+#include <acevm/object.hpp>
+
+#include <common/utf8.hpp>
+
+#include <fstream>
+#include <unordered_map>
+#include <vector>
+#include <cstring>
+
+static inline void HashBytes(uint64_t &hash, const void *data, size_t size)
+{
+    const unsigned char *bytes = static_cast<const unsigned char*>(data);
+    size_t i = 0;
+
+    // a word at a time, since every string of the program is hashed
+    for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+        uint64_t word;
+        std::memcpy(&word, bytes + i, sizeof(word));
+        hash = (hash ^ word) * 0x100000001b3ull;
+        hash ^= hash >> 29;
+    }
+    for (; i < size; i++) {
+        hash = (hash ^ bytes[i]) * 0x100000001b3ull;
+    }
+}
+
+/** The value of a StackValue that is not a reference, laid out the
+    same way whichever representation of values the VM was built with. */
+static uint64_t EncodeBits(const StackValue &sv)
+{
+    uint64_t bits = 0;
+
+    switch (sv.GetType()) {
+    case StackValue::INT32:
+        bits = (uint32_t)sv.GetInt32();
+        break;
+    case StackValue::INT64:
+        bits = (uint64_t)sv.GetInt64();
+        break;
+    case StackValue::FLOAT:
+    {
+        float f = sv.GetFloat();
+        uint32_t u;
+        std::memcpy(&u, &f, sizeof(u));
+        bits = u;
+        break;
+    }
+    case StackValue::DOUBLE:
+    {
+        double d = sv.GetDouble();
+        std::memcpy(&bits, &d, sizeof(bits));
+        break;
+    }
+    case StackValue::BOOLEAN:
+        bits = sv.GetBoolean() ? 1 : 0;
+        break;
+    case StackValue::FUNCTION:
+        bits = sv.GetFunction().m_addr | ((uint64_t)sv.GetFunction().m_nargs << 32);
+        break;
+    case StackValue::ADDRESS:
+        bits = sv.GetAddress();
+        break;
+    case StackValue::TYPE_INFO:
+        bits = sv.GetTypeInfo().m_size;
+        break;
+    default:
+        break;
+    }
+
+    return bits;
+}
+
+static void DecodeBits(uint32_t type, uint64_t bits, StackValue &sv)
+{
+    switch (type) {
+    case StackValue::INT32:
+        sv.SetInt32((int32_t)(uint32_t)bits);
+        break;
+    case StackValue::INT64:
+        sv.SetInt64((int64_t)bits);
+        break;
+    case StackValue::FLOAT:
+    {
+        uint32_t u = (uint32_t)bits;
+        float f;
+        std::memcpy(&f, &u, sizeof(f));
+        sv.SetFloat(f);
+        break;
+    }
+    case StackValue::DOUBLE:
+    {
+        double d;
+        std::memcpy(&d, &bits, sizeof(d));
+        sv.SetDouble(d);
+        break;
+    }
+    case StackValue::BOOLEAN:
+        sv.SetBoolean(bits != 0);
+        break;
+    case StackValue::FUNCTION:
+        sv.SetFunction((uint32_t)bits, (uint8_t)(bits >> 32));
+        break;
+    case StackValue::ADDRESS:
+        sv.SetAddress((uint32_t)bits);
+        break;
+    case StackValue::TYPE_INFO:
+        sv.SetTypeInfo((uint8_t)bits);
+        break;
+    }
+}
+
+Snapshot::Snapshot(VM *vm)
+    : m_vm(vm)
+{
+}
+
+uint64_t Snapshot::ProgramHash(const Program &program)
+{
+    uint64_t hash = 0xcbf29ce484222325ull;
+
+    for (size_t pc = 0; pc < program.Size(); pc++) {
+        const Instruction &ins = program[pc];
+        HashBytes(hash, &ins.m_opcode, 4 * sizeof(uint8_t));
+        HashBytes(hash, &ins.m_index, sizeof(ins.m_index));
+
+        // strings point into the file, so the bytes are hashed instead
+        if (ins.m_opcode == STORE_STATIC_STRING) {
+            HashBytes(hash, ins.m_imm.str, ins.m_index);
+        } else {
+            HashBytes(hash, &ins.m_imm.i64, sizeof(ins.m_imm.i64));
+        }
+    }
+
+    return hash;
+}
+
+bool Snapshot::MatchesSlot(const Instruction &ins, const SnapshotValue &value)
+{
+    switch (ins.m_opcode) {
+    case STORE_STATIC_STRING:
+        return value.m_type == StackValue::HEAP_POINTER && value.m_bits != 0;
+    case STORE_STATIC_ADDRESS:
+        return value.m_type == StackValue::ADDRESS && value.m_bits == ins.m_imm.addr;
+    case STORE_STATIC_FUNCTION:
+        return value.m_type == StackValue::FUNCTION &&
+            value.m_bits == (ins.m_imm.addr | ((uint64_t)ins.m_a << 32));
+    case STORE_STATIC_TYPE:
+        return value.m_type == StackValue::TYPE_INFO && value.m_bits == ins.m_a;
+    default:
+        return false;
+    }
+}
+
+bool Snapshot::Save(const char *path, uint32_t entry_pc)
+{
+    StaticMemory &statics = m_vm->m_static_memory;
+
+    std::unordered_map<const HeapValue*, uint32_t> index_of;
+    std::vector<HeapValue*> values;
+    std::vector<SnapshotObject> objects;
+
+    // strings stored by the initializers belong to static memory
+    for (size_t i = 0; i < statics.Size(); i++) {
+        const StackValue &sv = statics[i];
+        HeapValue *hv = sv.GetType() == StackValue::HEAP_POINTER ? sv.GetHeapPointer() : nullptr;
+        if (hv == nullptr || index_of.count(hv)) {
+            continue;
+        }
+        if (!hv->TypeCompatible<utf::Utf8String>()) {
+            m_error = "static memory holds a value that cannot be saved";
+            return false;
+        }
+
+        SnapshotObject object = SnapshotObject();
+        object.m_kind = SNAPSHOT_STATIC_STRING;
+
+        index_of[hv] = values.size();
+        values.push_back(hv);
+        objects.push_back(object);
+    }
+
+    // everything else is on the heap. it is saved in page order,
+    // so that it is laid out the same way when restored.
+    std::vector<HeapValue*> heap_values;
+    m_vm->m_heap.ForEach([&](HeapValue *hv) {
+        heap_values.push_back(hv);
+    });
+    for (HeapValue *hv : heap_values) {
+        SnapshotObject object = SnapshotObject();
+        if (hv->TypeCompatible<utf::Utf8String>()) {
+            object.m_kind = SNAPSHOT_HEAP_STRING;
+        } else if (hv->TypeCompatible<Object>()) {
+            object.m_kind = SNAPSHOT_HEAP_OBJECT;
+        } else {
+            m_error = "the heap holds a value that cannot be saved";
+            return false;
+        }
+
+        index_of[hv] = values.size();
+        values.push_back(hv);
+        objects.push_back(object);
+    }
+
+    bool encode_failed = false;
+    auto encode = [&](const StackValue &sv) {
+        SnapshotValue value = SnapshotValue();
+        value.m_type = sv.GetType();
+
+        if (sv.GetType() == StackValue::HEAP_POINTER) {
+            if (sv.GetHeapPointer() != nullptr) {
+                auto it = index_of.find(sv.GetHeapPointer());
+                if (it == index_of.end()) {
+                    encode_failed = true;
+                } else {
+                    value.m_bits = it->second + 1;
+                }
+            }
+        } else {
+            value.m_bits = EncodeBits(sv);
+        }
+
+        return value;
+    };
+
+    std::vector<SnapshotValue> static_values;
+    for (size_t i = 0; i < statics.Size(); i++) {
+        static_values.push_back(encode(statics[i]));
+    }
+
+    std::vector<SnapshotValue> members;
+    std::vector<char> strings;
+
+    for (size_t i = 0; i < values.size(); i++) {
+        SnapshotObject &object = objects[i];
+
+        if (object.m_kind == SNAPSHOT_HEAP_OBJECT) {
+            const Object &obj = values[i]->Get<Object>();
+            object.m_size = obj.GetSize();
+            object.m_offset = members.size();
+            for (int j = 0; j < obj.GetSize(); j++) {
+                members.push_back(encode(obj.GetMember(j)));
+            }
+        } else {
+            const utf::Utf8String &str = values[i]->Get<utf::Utf8String>();
+            const char *data = str.GetData() != nullptr ? str.GetData() : "";
+            object.m_size = std::strlen(data);
+            object.m_offset = strings.size();
+            strings.insert(strings.end(), data, data + object.m_size + 1);
+        }
+    }
+
+    if (encode_failed) {
+        m_error = "a value refers to memory that is not part of the VM";
+        return false;
+    }
+
+    SnapshotHeader header = SnapshotHeader();
+    header.m_magic = SNAPSHOT_MAGIC;
+    header.m_version = SNAPSHOT_VERSION;
+    header.m_program_hash = ProgramHash(*m_vm->m_program);
+    header.m_entry_pc = entry_pc;
+    header.m_num_statics = static_values.size();
+    header.m_num_objects = objects.size();
+    header.m_num_members = members.size();
+
+    std::ofstream file(path, std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) {
+        m_error = "could not open the snapshot file for writing";
+        return false;
+    }
+
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(static_values.data()),
+        static_values.size() * sizeof(SnapshotValue));
+    file.write(reinterpret_cast<const char*>(objects.data()),
+        objects.size() * sizeof(SnapshotObject));
+    file.write(reinterpret_cast<const char*>(members.data()),
+        members.size() * sizeof(SnapshotValue));
+    file.write(strings.data(), strings.size());
+
+    return file.good();
+}
+
+bool Snapshot::Load(const char *path, BytecodeFile &file, uint32_t &entry_pc)
+{
+    StaticMemory &statics = m_vm->m_static_memory;
+    Heap &heap = m_vm->m_heap;
+    const Program &program = *m_vm->m_program;
+
+    if (statics.Size() != 0 || heap.Size() != 0) {
+        m_error = "the VM has already been initialized";
+        return false;
+    }
+
+    if (!file.Open(path)) {
+        m_error = "could not open the snapshot file";
+        return false;
+    }
+
+    BytecodeStream bs(file.GetData(), file.GetSize());
+    if (!bs.CanRead(sizeof(SnapshotHeader))) {
+        m_error = "not a snapshot file";
+        return false;
+    }
+
+    const SnapshotHeader *header = bs.ReadAligned<SnapshotHeader>();
+    if (header->m_magic != SNAPSHOT_MAGIC) {
+        m_error = "not a snapshot file";
+        return false;
+    } else if (header->m_version != SNAPSHOT_VERSION) {
+        m_error = "unsupported snapshot version";
+        return false;
+    } else if (header->m_program_hash != ProgramHash(program)) {
+        m_error = "the snapshot was taken from a different program";
+        return false;
+    }
+
+    // the header instructions, one for each static slot in order, the
+    // same ones that VM::Initialize() runs up to the entry pc
+    std::vector<const Instruction*> slots;
+    uint32_t header_end = 0;
+    for (; header_end < program.Size(); header_end++) {
+        const Instruction &ins = program[header_end];
+        if (ins.m_opcode >= STORE_STATIC_STRING && ins.m_opcode <= STORE_STATIC_TYPE) {
+            if (slots.size() >= StaticMemory::max_size) {
+                break;
+            }
+            slots.push_back(&ins);
+        } else if (ins.m_opcode != NOP) {
+            break;
+        }
+    }
+
+    if (header->m_entry_pc != header_end || header->m_num_statics != slots.size()) {
+        m_error = "corrupt snapshot";
+        return false;
+    }
+
+    uint64_t num_values = (uint64_t)header->m_num_statics + header->m_num_objects + header->m_num_members;
+    if (!bs.CanRead(num_values * sizeof(SnapshotValue))) {
+        m_error = "truncated snapshot";
+        return false;
+    }
+
+    const SnapshotValue *static_values = reinterpret_cast<const SnapshotValue*>(
+        file.GetData() + bs.Position());
+    const SnapshotObject *objects = reinterpret_cast<const SnapshotObject*>(
+        static_values + header->m_num_statics);
+    const SnapshotValue *members = reinterpret_cast<const SnapshotValue*>(
+        objects + header->m_num_objects);
+    const char *strings = reinterpret_cast<const char*>(members + header->m_num_members);
+    size_t strings_size = file.GetData() + file.GetSize() - strings;
+
+    // jumps, calls and NEW trust addresses, functions and types, so
+    // nothing but what the header stores is taken from the file
+    std::vector<bool> owned(header->m_num_objects, false);
+    for (uint32_t i = 0; i < header->m_num_statics; i++) {
+        if (!MatchesSlot(*slots[i], static_values[i])) {
+            m_error = "static memory does not match the program header";
+            return false;
+        }
+
+        // static memory frees its strings, so each one
+        // has to be a string of its own, off the heap
+        if (slots[i]->m_opcode == STORE_STATIC_STRING) {
+            uint64_t index = static_values[i].m_bits - 1;
+            if (index >= header->m_num_objects || owned[index] ||
+                objects[index].m_kind != SNAPSHOT_STATIC_STRING) {
+                m_error = "static memory does not match the program header";
+                return false;
+            }
+            owned[index] = true;
+        }
+    }
+    for (uint32_t i = 0; i < header->m_num_objects; i++) {
+        if (objects[i].m_kind == SNAPSHOT_STATIC_STRING && !owned[i]) {
+            m_error = "corrupt snapshot";
+            return false;
+        }
+    }
+    for (uint32_t i = 0; i < header->m_num_members; i++) {
+        const SnapshotValue &value = members[i];
+        if (value.m_type != StackValue::ADDRESS && value.m_type != StackValue::FUNCTION &&
+            value.m_type != StackValue::TYPE_INFO) {
+            continue;
+        }
+
+        bool found = false;
+        for (size_t j = 0; j < slots.size() && !found; j++) {
+            found = MatchesSlot(*slots[j], value);
+        }
+        if (!found) {
+            m_error = "an object holds a value that the program header does not store";
+            return false;
+        }
+    }
+
+    // objects are allocated along with their members,
+    // so those are checked before anything is allocated
+    for (uint32_t i = 0; i < header->m_num_objects; i++) {
+        const SnapshotObject &object = objects[i];
+        if (object.m_kind > SNAPSHOT_HEAP_OBJECT || (object.m_kind == SNAPSHOT_HEAP_OBJECT &&
+            (object.m_offset > header->m_num_members ||
+             object.m_size > header->m_num_members - object.m_offset))) {
+            m_error = "corrupt snapshot";
+            return false;
+        }
+    }
+
+    // allocate every value first, so that references can be resolved
+    std::vector<HeapValue*> values(header->m_num_objects);
+    for (uint32_t i = 0; i < header->m_num_objects; i++) {
+        if (objects[i].m_kind == SNAPSHOT_STATIC_STRING) {
+            // freed by the destructor of static memory, like
+            // the strings that STORE_STATIC_STRING creates
+            values[i] = HeapValue::Create(HeapValue::PayloadSize<utf::Utf8String>());
+        } else {
+            values[i] = heap.Alloc(objects[i].m_kind == SNAPSHOT_HEAP_OBJECT
+                ? Object::SizeFor(objects[i].m_size)
+                : HeapValue::PayloadSize<utf::Utf8String>());
+        }
+    }
+
+    bool decode_failed = false;
+    auto decode = [&](const SnapshotValue &value, StackValue &sv) {
+        if (value.m_type > StackValue::TYPE_INFO ||
+            (value.m_type == StackValue::INT64 && !StackValue::Int64Fits((int64_t)value.m_bits))) {
+            decode_failed = true;
+        } else if (value.m_type == StackValue::HEAP_POINTER) {
+            if (value.m_bits > values.size()) {
+                decode_failed = true;
+                sv.SetHeapPointer(nullptr);
+            } else {
+                sv.SetHeapPointer(value.m_bits != 0 ? values[value.m_bits - 1] : nullptr);
+            }
+        } else {
+            DecodeBits(value.m_type, value.m_bits, sv);
+        }
+    };
+
+    for (uint32_t i = 0; i < header->m_num_objects; i++) {
+        const SnapshotObject &object = objects[i];
+
+        if (object.m_kind == SNAPSHOT_HEAP_OBJECT) {
+            Object &obj = values[i]->Emplace<Object>(object.m_size);
+            for (uint32_t j = 0; j < object.m_size; j++) {
+                decode(members[object.m_offset + j], obj.GetMember(j));
+            }
+        } else {
+            // strings end in a NUL, and are borrowed from the mapping
+            if (object.m_offset >= strings_size || object.m_size >= strings_size - object.m_offset ||
+                strings[object.m_offset + object.m_size] != '\0') {
+                decode_failed = true;
+                break;
+            }
+
+            values[i]->Assign(utf::Utf8String::Borrow(strings + object.m_offset, object.m_size));
+        }
+    }
+
+    for (uint32_t i = 0; i < header->m_num_statics && !decode_failed; i++) {
+        StackValue sv;
+        decode(static_values[i], sv);
+        statics.Store(sv);
+    }
+
+    if (decode_failed) {
+        m_error = "corrupt snapshot";
+        return false;
+    }
+
+    entry_pc = header->m_entry_pc;
+    return true;
+}
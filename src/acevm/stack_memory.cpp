@@ -1,14 +1,53 @@
 #include <acevm/stack_memory.hpp>
 
-const uint16_t Stack::stack_size = 20000;
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <unistd.h>
+#define ACEVM_HAS_MMAP
+#endif
 
-Stack::Stack()
-    : m_data(new StackValue[stack_size]),
-      m_sp(0)
+#ifndef MAP_NORESERVE
+#define MAP_NORESERVE 0
+#endif
+
+const size_t Stack::default_limit = 20000;
+const size_t Stack::max_limit = 16 * 1024 * 1024;
+
+Stack::Stack(size_t limit)
+    : m_data(nullptr),
+      m_sp(0),
+      m_limit(limit < max_limit ? limit : max_limit),
+      m_reserved(0)
 {
+#ifdef ACEVM_HAS_MMAP
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    size_t data_size = (m_limit * sizeof(StackValue) + page_size - 1) & ~(page_size - 1);
+
+    // anonymous pages are zero-filled the first time they are touched.
+    // nothing is read above the stack pointer before it is pushed, so
+    // the values do not have to be constructed.
+    void *data = mmap(nullptr, data_size + page_size, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (data != MAP_FAILED) {
+        mprotect(static_cast<char*>(data) + data_size, page_size, PROT_NONE);
+
+        m_data = static_cast<StackValue*>(data);
+        m_reserved = data_size + page_size;
+        return;
+    }
+#endif
+
+    m_data = new StackValue[m_limit];
 }
 
 Stack::~Stack()
 {
+#ifdef ACEVM_HAS_MMAP
+    if (m_reserved != 0) {
+        munmap(m_data, m_reserved);
+        return;
+    }
+#endif
+
     delete[] m_data;
 }
@@ -1,5 +1,17 @@
 #include <acevm/stack_value.hpp>
 
+#ifdef ACEVM_NAN_BOXING
+StackValue::StackValue()
+{
+    // initialize to null reference
+    SetHeapPointer(nullptr);
+}
+
+StackValue::StackValue(const StackValue &other)
+    : m_bits(other.m_bits)
+{
+}
+#else
 StackValue::StackValue()
     : m_type(HEAP_POINTER)
 {
@@ -12,3 +24,4 @@ StackValue::StackValue(const StackValue &other)
       m_value(other.m_value)
 {
 }
+#endif
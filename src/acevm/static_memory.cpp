@@ -1,10 +1,11 @@
 #include <acevm/static_memory.hpp>
 
-const uint16_t StaticMemory::static_size = 1000;
+const size_t StaticMemory::max_size = 65536;
 
 StaticMemory::StaticMemory()
-    : m_data(new StackValue[static_size]),
-      m_sp(0)
+    : m_data(nullptr),
+      m_sp(0),
+      m_capacity(0)
 {
 }
 
@@ -13,11 +14,28 @@ StaticMemory::~StaticMemory()
     // delete all heap allocated objects
     for (; m_sp != 0; m_sp--) {
         StackValue &sv = m_data[m_sp - 1];
-        if (sv.m_type == StackValue::HEAP_POINTER &&
-            sv.m_value.ptr != nullptr) {
-            delete sv.m_value.ptr;
+        if (sv.GetType() == StackValue::HEAP_POINTER &&
+            sv.GetHeapPointer() != nullptr) {
+            HeapValue::Delete(sv.GetHeapPointer());
         }
     }
 
     delete[] m_data;
 }
+
+void StaticMemory::Grow()
+{
+    size_t capacity = m_capacity != 0 ? m_capacity * 2 : 64;
+    if (capacity > max_size) {
+        capacity = max_size;
+    }
+
+    StackValue *data = new StackValue[capacity];
+    for (size_t i = 0; i < m_sp; i++) {
+        data[i] = m_data[i];
+    }
+
+    delete[] m_data;
+    m_data = data;
+    m_capacity = capacity;
+}
@@ -0,0 +1,122 @@
+#include <acevm/string_builder.hpp>
+
+#include <algorithm>
+#include <vector>
+#include <cstring>
+
+// chunks after a fork start small, and each chunk
+// appended to in place is twice the size of the last
+static const size_t min_chunk_size = 32;
+static const size_t max_chunk_size = 64 * 1024;
+
+/** Bytes shared by every builder that ends in or after this chunk.
+    The buffer is never reallocated, so an in place append does not
+    move bytes that other builders or the caller are reading. */
+struct StringBuilder::Chunk {
+    Chunk(size_t capacity, const std::shared_ptr<Chunk> &prev, size_t prev_bytes)
+        : m_data(new char[capacity]),
+          m_capacity(capacity),
+          m_used(0),
+          m_prev(prev),
+          m_prev_bytes(prev_bytes)
+    {
+    }
+
+    ~Chunk()
+    {
+        // a long chain of forks is freed one chunk at a
+        // time instead of recursing once per chunk
+        std::shared_ptr<Chunk> prev = std::move(m_prev);
+        while (prev != nullptr && prev.use_count() == 1) {
+            std::shared_ptr<Chunk> next = std::move(prev->m_prev);
+            prev = std::move(next);
+        }
+    }
+
+    std::unique_ptr<char[]> m_data;
+    size_t m_capacity;
+    // bytes written by any builder
+    size_t m_used;
+
+    std::shared_ptr<Chunk> m_prev;
+    // how many bytes of m_prev come before this chunk
+    size_t m_prev_bytes;
+};
+
+StringBuilder::StringBuilder(const utf::Utf8String &str)
+    : m_tail(std::make_shared<Chunk>(std::max(2 * str.GetByteLength(), min_chunk_size), nullptr, 0)),
+      m_tail_bytes(str.GetByteLength()),
+      m_num_bytes(str.GetByteLength()),
+      m_length(str.GetLength())
+{
+    std::memcpy(m_tail->m_data.get(), str.GetData(), m_num_bytes);
+    m_tail->m_used = m_num_bytes;
+}
+
+StringBuilder::StringBuilder(const std::shared_ptr<Chunk> &tail, size_t tail_bytes, size_t num_bytes, size_t length)
+    : m_tail(tail),
+      m_tail_bytes(tail_bytes),
+      m_num_bytes(num_bytes),
+      m_length(length)
+{
+}
+
+bool StringBuilder::operator==(const StringBuilder &other) const
+{
+    if (m_num_bytes != other.m_num_bytes) {
+        return false;
+    }
+    return !std::memcmp(Flatten().GetData(), other.Flatten().GetData(), m_num_bytes);
+}
+
+StringBuilder StringBuilder::Append(const char *data, size_t size, size_t length) const
+{
+    // once either side is not valid UTF-8, the length stays unknown
+    size_t sum_length = m_length != (size_t)-1 && length != (size_t)-1
+        ? m_length + length
+        : (size_t)-1;
+
+    std::shared_ptr<Chunk> tail = m_tail;
+    size_t tail_bytes = m_tail_bytes;
+    bool newest = tail_bytes == tail->m_used;
+
+    if (!newest || tail->m_capacity - tail->m_used < size) {
+        // a newer builder owns the rest of the chunk, or it is
+        // full. the new chunk follows the bytes of this builder.
+        size_t capacity = newest
+            ? std::min(2 * tail->m_capacity, max_chunk_size)
+            : min_chunk_size;
+        tail = std::make_shared<Chunk>(std::max(capacity, size), m_tail, m_tail_bytes);
+        tail_bytes = 0;
+    }
+
+    std::memcpy(tail->m_data.get() + tail_bytes, data, size);
+    tail->m_used = tail_bytes + size;
+
+    return StringBuilder(tail, tail_bytes + size, m_num_bytes + size, sum_length);
+}
+
+StringBuilder StringBuilder::Append(const StringBuilder &other) const
+{
+    const utf::Utf8String &flat = other.Flatten();
+    return Append(flat.GetData(), flat.GetByteLength(), other.m_length);
+}
+
+const utf::Utf8String &StringBuilder::Flatten() const
+{
+    if (m_flat == nullptr) {
+        std::vector<char> bytes(m_num_bytes + 1);
+
+        // the chunks are linked from the last one back
+        size_t end = m_num_bytes;
+        size_t count = m_tail_bytes;
+        for (const Chunk *chunk = m_tail.get(); chunk != nullptr; chunk = chunk->m_prev.get()) {
+            end -= count;
+            std::memcpy(bytes.data() + end, chunk->m_data.get(), count);
+            count = chunk->m_prev_bytes;
+        }
+
+        m_flat = std::make_shared<utf::Utf8String>(bytes.data(), m_num_bytes);
+    }
+    return *m_flat;
+}
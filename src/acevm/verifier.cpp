@@ -0,0 +1,438 @@
+#include <acevm/verifier.hpp>
+#include <acevm/instructions.hpp>
+#include <acevm/stack_memory.hpp>
+#include <acevm/static_memory.hpp>
+
+#include <algorithm>
+#include <cstdio>
+
+Verifier::Verifier(const Program *program)
+    : m_program(program),
+      m_header_size(0),
+      m_max_stack_depth(0)
+{
+}
+
+void Verifier::SetError(const char *message, size_t pc)
+{
+    char buffer[256];
+    std::sprintf(buffer, "%s at instruction %u", message, (unsigned)pc);
+    m_error = buffer;
+}
+
+bool Verifier::CheckOperands(size_t pc, const Instruction &ins)
+{
+    // register operands of the instruction, one bit for each of m_a, m_b, m_c
+    int regs = 0;
+
+    switch (ins.m_opcode) {
+    case NOP:
+    case POP:
+    case ECHO_NEWLINE:
+    case RET:
+    case END_TRY:
+    case EXIT:
+    case STORE_STATIC_STRING:
+    case STORE_STATIC_TYPE:
+        break;
+    case STORE_STATIC_ADDRESS:
+    case STORE_STATIC_FUNCTION:
+        if (ins.m_imm.addr >= m_program->Size()) {
+            SetError("address out of bounds", pc);
+            return false;
+        }
+        break;
+    case LOAD_STATIC:
+    case NEW:
+        if (ins.m_index >= StaticMemory::max_size) {
+            SetError("static index out of bounds", pc);
+            return false;
+        }
+        regs = 1;
+        break;
+    case LOAD_I64:
+        if (!StackValue::Int64Fits(ins.m_imm.i64)) {
+            SetError("int64 constant out of range", pc);
+            return false;
+        }
+        regs = 1;
+        break;
+    case LOAD_I32:
+    case LOAD_F32:
+    case LOAD_F64:
+    case LOAD_LOCAL:
+    case LOAD_NULL:
+    case LOAD_TRUE:
+    case LOAD_FALSE:
+    case MOV:
+    case PUSH:
+    case ECHO:
+    case JMP:
+    case JE:
+    case JNE:
+    case JG:
+    case JGE:
+    case CALL:
+    case TAIL_CALL:
+    case BEGIN_TRY:
+    case CMPZ:
+        regs = 1;
+        break;
+    case LOAD_MEM:
+    case CMP:
+    case CMP_I32_I32:
+    case CMP_I64_I64:
+    case CMP_F64_F64:
+        regs = 1 | 2;
+        break;
+    case MOV_MEM:
+        regs = 1 | 4;
+        break;
+    case ADD:
+    case SUB:
+    case MUL:
+    case DIV:
+    case ADD_I32_I32: case ADD_I64_I64: case ADD_F64_F64:
+    case SUB_I32_I32: case SUB_I64_I64: case SUB_F64_F64:
+    case MUL_I32_I32: case MUL_I64_I64: case MUL_F64_F64:
+    case DIV_I32_I32: case DIV_I64_I64: case DIV_F64_F64:
+        regs = 1 | 2 | 4;
+        break;
+    default:
+        // unknown instructions have nothing to check. no path through
+        // one can be proven, and the interpreter reports it when reached
+        return true;
+    }
+
+    if (((regs & 1) && ins.m_a >= 8) || ((regs & 2) && ins.m_b >= 8) || ((regs & 4) && ins.m_c >= 8)) {
+        SetError("register out of bounds", pc);
+        return false;
+    }
+
+    return true;
+}
+
+bool Verifier::ReadStaticSlots()
+{
+    m_slots.clear();
+    m_header_size = 0;
+
+    // the header is where static memory is filled in
+    bool in_header = true;
+
+    for (size_t pc = 0; pc < m_program->Size(); pc++) {
+        const Instruction &ins = (*m_program)[pc];
+
+        switch (ins.m_opcode) {
+        case STORE_STATIC_STRING:
+        case STORE_STATIC_ADDRESS:
+        case STORE_STATIC_FUNCTION:
+        case STORE_STATIC_TYPE:
+        {
+            if (!in_header) {
+                SetError("static memory is written outside of the program header", pc);
+                return false;
+            }
+
+            StaticSlot slot;
+            slot.m_opcode = ins.m_opcode;
+            slot.m_nargs = ins.m_a;
+            slot.m_addr = ins.m_imm.addr;
+            m_slots.push_back(slot);
+            break;
+        }
+        case NOP:
+            break;
+        default:
+            in_header = false;
+            break;
+        }
+
+        if (in_header) {
+            m_header_size = pc + 1;
+        }
+    }
+
+    if (m_slots.size() > StaticMemory::max_size) {
+        SetError("not enough static memory", m_header_size);
+        return false;
+    }
+
+    return true;
+}
+
+bool Verifier::Flow(uint32_t pc, const State &state)
+{
+    State &target = m_states[pc];
+
+    if (!target.m_reached) {
+        target = state;
+        target.m_reached = true;
+        m_worklist.push_back(pc);
+        return true;
+    }
+
+    if (target.m_top_level != state.m_top_level || target.m_nargs != state.m_nargs) {
+        SetError("instruction is shared by more than one function", pc);
+        return false;
+    }
+    if (target.m_depth != state.m_depth || target.m_try_depths != state.m_try_depths) {
+        SetError("stack depth differs between paths", pc);
+        return false;
+    }
+
+    // registers that differ between paths are not known anymore
+    bool changed = false;
+    for (int i = 0; i < 8; i++) {
+        if (target.m_regs[i] != state.m_regs[i] && target.m_regs[i] != -1) {
+            target.m_regs[i] = -1;
+            changed = true;
+        }
+    }
+    if (changed) {
+        m_worklist.push_back(pc);
+    }
+
+    return true;
+}
+
+bool Verifier::JumpTarget(uint32_t pc, const State &state, uint8_t reg, uint32_t &target)
+{
+    int32_t slot = state.m_regs[reg];
+    if (slot == -1 || m_slots[slot].m_opcode != STORE_STATIC_ADDRESS) {
+        SetError("jump target is not known", pc);
+        return false;
+    }
+
+    target = m_slots[slot].m_addr;
+    if (target < m_header_size) {
+        SetError("jump into the program header", pc);
+        return false;
+    }
+
+    return true;
+}
+
+bool Verifier::FollowPaths()
+{
+    State entry;
+    entry.m_reached = false;
+    entry.m_top_level = true;
+    entry.m_nargs = 0;
+    entry.m_depth = 0;
+    std::fill(entry.m_regs, entry.m_regs + 8, -1);
+
+    m_states.assign(m_program->Size(), entry);
+    m_worklist.clear();
+
+    if (!Flow(0, entry)) {
+        return false;
+    }
+
+    // every function starts with an empty frame above its arguments
+    for (const StaticSlot &slot : m_slots) {
+        if (slot.m_opcode != STORE_STATIC_FUNCTION) {
+            continue;
+        }
+
+        uint32_t addr = slot.m_addr;
+        if (addr < m_header_size) {
+            SetError("function inside of the program header", addr);
+            return false;
+        }
+
+        State function = entry;
+        function.m_top_level = false;
+        function.m_nargs = slot.m_nargs;
+
+        if (!Flow(addr, function)) {
+            return false;
+        }
+    }
+
+    while (!m_worklist.empty()) {
+        uint32_t pc = m_worklist.back();
+        m_worklist.pop_back();
+
+        const Instruction &ins = (*m_program)[pc];
+        State next = m_states[pc];
+
+        m_max_stack_depth = std::max(m_max_stack_depth, next.m_depth);
+
+        switch (ins.m_opcode) {
+        case STORE_STATIC_STRING:
+        case STORE_STATIC_ADDRESS:
+        case STORE_STATIC_FUNCTION:
+        case STORE_STATIC_TYPE:
+        case NOP:
+        case ECHO:
+        case ECHO_NEWLINE:
+        case CMP:
+        case CMPZ:
+        case CMP_I32_I32:
+        case CMP_I64_I64:
+        case CMP_F64_F64:
+        case MOV_MEM:
+            break;
+        case LOAD_I32:
+        case LOAD_I64:
+        case LOAD_F32:
+        case LOAD_F64:
+        case LOAD_NULL:
+        case LOAD_TRUE:
+        case LOAD_FALSE:
+        case LOAD_MEM:
+            next.m_regs[ins.m_a] = -1;
+            break;
+        case ADD:
+        case SUB:
+        case MUL:
+        case DIV:
+        case ADD_I32_I32: case ADD_I64_I64: case ADD_F64_F64:
+        case SUB_I32_I32: case SUB_I64_I64: case SUB_F64_F64:
+        case MUL_I32_I32: case MUL_I64_I64: case MUL_F64_F64:
+        case DIV_I32_I32: case DIV_I64_I64: case DIV_F64_F64:
+            next.m_regs[ins.m_c] = -1;
+            break;
+        case LOAD_STATIC:
+            if (ins.m_index >= m_slots.size()) {
+                SetError("static memory is read before it is written", pc);
+                return false;
+            }
+            next.m_regs[ins.m_a] = ins.m_index;
+            break;
+        case NEW:
+            if (ins.m_index >= m_slots.size() ||
+                m_slots[ins.m_index].m_opcode != STORE_STATIC_TYPE) {
+                SetError("static value is not a type", pc);
+                return false;
+            }
+            next.m_regs[ins.m_a] = -1;
+            break;
+        case LOAD_LOCAL:
+        case MOV:
+            // arguments are just below the frame
+            if (ins.m_index == 0 || ins.m_index > next.m_depth + next.m_nargs) {
+                SetError("stack offset out of bounds", pc);
+                return false;
+            }
+            if (ins.m_opcode == LOAD_LOCAL) {
+                next.m_regs[ins.m_a] = -1;
+            }
+            break;
+        case PUSH:
+            if (++next.m_depth > Stack::max_limit) {
+                SetError("stack overflow", pc);
+                return false;
+            }
+            break;
+        case POP:
+            // neither the arguments nor the values that a try block
+            // started with may be popped
+            if (next.m_depth == 0 ||
+                (!next.m_try_depths.empty() && next.m_depth <= next.m_try_depths.back())) {
+                SetError("stack underflow", pc);
+                return false;
+            }
+            next.m_depth--;
+            break;
+        case JMP:
+        {
+            uint32_t target;
+            if (!JumpTarget(pc, next, ins.m_a, target) || !Flow(target, next)) {
+                return false;
+            }
+            continue;
+        }
+        case JE:
+        case JNE:
+        case JG:
+        case JGE:
+        {
+            uint32_t target;
+            if (!JumpTarget(pc, next, ins.m_a, target) || !Flow(target, next)) {
+                return false;
+            }
+            break;
+        }
+        case CALL:
+        case TAIL_CALL:
+            if (ins.m_b > next.m_depth) {
+                SetError("not enough arguments on the stack", pc);
+                return false;
+            }
+            if (ins.m_opcode == TAIL_CALL) {
+                continue;
+            }
+            // the callee may use any register
+            std::fill(next.m_regs, next.m_regs + 8, -1);
+            break;
+        case RET:
+            if (!next.m_top_level && next.m_depth != 0) {
+                SetError("function returns with values left on the stack", pc);
+                return false;
+            }
+            continue;
+        case BEGIN_TRY:
+        {
+            uint32_t target;
+            if (!JumpTarget(pc, next, ins.m_a, target)) {
+                return false;
+            }
+
+            // the catch block starts at the stack depth of BEGIN_TRY,
+            // with whatever was in the registers when it threw
+            State handler = next;
+            std::fill(handler.m_regs, handler.m_regs + 8, -1);
+            if (!Flow(target, handler)) {
+                return false;
+            }
+
+            next.m_try_depths.push_back(next.m_depth);
+            break;
+        }
+        case END_TRY:
+            if (next.m_try_depths.empty()) {
+                SetError("END_TRY without BEGIN_TRY", pc);
+                return false;
+            }
+            next.m_try_depths.pop_back();
+            break;
+        case EXIT:
+            continue;
+        default:
+        {
+            char buffer[64];
+            std::sprintf(buffer, "unknown instruction '%d'",
+                ins.m_opcode == BAD_INSTRUCTION ? (int)ins.m_a : (int)ins.m_opcode);
+            SetError(buffer, pc);
+            return false;
+        }
+        }
+
+        if (!Flow(pc + 1, next)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+VerifyResult Verifier::Verify()
+{
+    m_error.clear();
+    m_max_stack_depth = 0;
+
+    for (size_t pc = 0; pc < m_program->Size(); pc++) {
+        if (!CheckOperands(pc, (*m_program)[pc])) {
+            return VERIFY_MALFORMED;
+        }
+    }
+
+    if (!ReadStaticSlots() || !FollowPaths()) {
+        m_max_stack_depth = 0;
+        return VERIFY_UNPROVEN;
+    }
+
+    return VERIFY_OK;
+}
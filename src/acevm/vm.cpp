@@ -3,17 +3,35 @@
 #include <acevm/stack_value.hpp>
 #include <acevm/heap_value.hpp>
 #include <acevm/object.hpp>
+#include <acevm/string_builder.hpp>
 
 #include <common/utf8.hpp>
 
 #include <iostream>
 #include <algorithm>
+#include <chrono>
 #include <cstdio>
+#include <cstring>
 #include <cassert>
 
-VM::VM(BytecodeStream *bs)
-    : m_bs(bs),
-      m_max_heap_objects(GC_THRESHOLD_MIN)
+VM::VM(Program *program, size_t stack_limit, size_t nursery_size)
+    : m_nursery(nursery_size),
+      m_exec_thread(stack_limit),
+      m_max_heap_objects(GC_THRESHOLD_MIN),
+      m_marking(false),
+      m_gc_pause_budget_us(0),
+      m_marker(&m_nursery),
+      m_gc_concurrent(false),
+      m_concurrent_marking(false),
+      m_alloc_rate(0),
+      m_mark_rate(GC_PACING_MARK_RATE),
+      m_pacing_allocated(0),
+      m_pacing_time(std::chrono::high_resolution_clock::now()),
+      m_program(program),
+      m_pc(0),
+      m_verified(false),
+      m_max_stack_depth(0),
+      m_jit(this)
 {
 }
 
@@ -21,53 +39,401 @@ VM::~VM()
 {
 }
 
-HeapValue *VM::HeapAlloc()
+void VM::SetVerified(uint32_t max_stack_depth)
 {
-    int heap_size = m_heap.Size();
-    if (heap_size >= GC_THRESHOLD_MAX) {
+    if (max_stack_depth > m_exec_thread.m_stack.GetLimit()) {
+        return;
+    }
+
+    m_verified = true;
+    m_max_stack_depth = max_stack_depth;
+}
+
+double GcStats::SlicePercentile(double fraction) const
+{
+    if (m_slice_seconds.empty()) {
+        return 0;
+    }
+
+    std::vector<double> sorted(m_slice_seconds);
+    size_t index = std::min((size_t)(fraction * sorted.size()), sorted.size() - 1);
+    std::nth_element(sorted.begin(), sorted.begin() + index, sorted.end());
+    return sorted[index];
+}
+
+HeapValue *VM::HeapAlloc(size_t payload_size)
+{
+    HeapValue *hv = m_nursery.Alloc(payload_size);
+    if (hv != nullptr) {
+        return hv;
+    }
+
+    bool young = m_nursery.CanHold(payload_size);
+    bool collect_heap = m_marking || m_concurrent_marking || m_heap.IsSweeping() || ShouldCollectHeap();
+    if (young || collect_heap) {
+        // the nursery is emptied before the heap is collected,
+        // so that a full collection only has to look at the heap
+        if (m_nursery.Size() != 0) {
+            CollectNursery();
+        }
+        if (collect_heap || ShouldCollectHeap()) {
+            if (!(m_gc_concurrent ? CollectHeapConcurrent() : CollectHeap())) {
+                return nullptr;
+            }
+        }
+    }
+
+    if (young) {
+        return m_nursery.Alloc(payload_size);
+    }
+
+    hv = m_heap.Alloc(payload_size);
+    if (m_marking || m_concurrent_marking) {
+        // it can only refer to what is stored into it
+        // from now on, which the write barrier marks
+        hv->GetFlags() |= GC_MARKED;
+    }
+    return hv;
+}
+
+bool VM::ShouldCollectHeap()
+{
+    size_t size = m_heap.Size();
+    if (!m_gc_concurrent || size >= m_max_heap_objects) {
+        return size >= m_max_heap_objects;
+    }
+
+    size_t allocated = m_heap.GetNumAllocated();
+    if (allocated - m_pacing_allocated >= GC_PACING_SAMPLE) {
+        auto now = std::chrono::high_resolution_clock::now();
+        double seconds = std::chrono::duration_cast<std::chrono::duration<double, std::ratio<1>>>(now - m_pacing_time).count();
+        if (seconds > 0) {
+            double rate = (allocated - m_pacing_allocated) / seconds;
+            m_alloc_rate = m_alloc_rate != 0 ? (m_alloc_rate + rate) / 2 : rate;
+        }
+        m_pacing_allocated = allocated;
+        m_pacing_time = now;
+    }
+
+    // what the heap will have grown to by the time
+    // everything in it now has been marked
+    double mark_seconds = size / m_mark_rate;
+    return size + m_alloc_rate * mark_seconds * GC_PACING_MARGIN >= m_max_heap_objects;
+}
+
+bool VM::CollectHeap()
+{
+    auto start = std::chrono::high_resolution_clock::now();
+
+    if (!m_marking && !m_heap.IsSweeping()) {
+        MarkRoots(&m_exec_thread);
+        m_marking = true;
+    }
+
+    auto deadline = m_gc_pause_budget_us != 0
+        ? start + std::chrono::microseconds(m_gc_pause_budget_us)
+        : std::chrono::high_resolution_clock::time_point::max();
+
+    // the rest is done all at once if the heap grows
+    // too far while it is being collected in slices
+    if (m_heap.Size() >= std::min(m_max_heap_objects * GC_THRESHOLD_GROWTH, (size_t)GC_THRESHOLD_MAX)) {
+        deadline = std::chrono::high_resolution_clock::time_point::max();
+    }
+
+    if (m_marking && DrainMarkStack(deadline)) {
+        // registers and the stack are written to without a
+        // barrier, so they are marked again before sweeping
+        MarkRoots(&m_exec_thread);
+        DrainMarkStack();
+        m_marking = false;
+        m_heap.StartSweep();
+    }
+
+    bool result = m_marking || SweepHeap(deadline);
+    RecordPause(start);
+    return result;
+}
+
+bool VM::CollectHeapConcurrent()
+{
+    auto start = std::chrono::high_resolution_clock::now();
+
+    auto deadline = m_gc_pause_budget_us != 0
+        ? start + std::chrono::microseconds(m_gc_pause_budget_us)
+        : std::chrono::high_resolution_clock::time_point::max();
+
+    if (m_heap.IsSweeping()) {
+        bool result = SweepHeap(deadline);
+        RecordPause(start);
+        return result;
+    }
+
+    if (!m_concurrent_marking) {
+        // a short pause, to hand a snapshot of the roots to the thread
+        ConcurrentMarker::Guard guard(&m_marker);
+
+        auto push = [this](const StackValue &value) {
+            if (value.GetType() == StackValue::HEAP_POINTER) {
+                m_marker.Push(value.GetHeapPointer());
+            }
+        };
+        for (int i = 0; i < 8; i++) {
+            push(m_exec_thread.m_regs[i]);
+        }
+        for (int i = m_exec_thread.m_stack.GetStackPointer() - 1; i >= 0; i--) {
+            push(m_exec_thread.m_stack[i]);
+        }
+        for (size_t i = 0; i < m_static_memory.Size(); i++) {
+            push(m_static_memory[i]);
+        }
+
+        m_marker.Start();
+        m_concurrent_marking = true;
+        m_marking_start = start;
+
+        RecordPause(start);
+        return true;
+    }
+
+    // the thread is waited for if the heap grows too far
+    bool too_large = m_heap.Size() >= std::min(m_max_heap_objects * GC_THRESHOLD_GROWTH, (size_t)GC_THRESHOLD_MAX);
+    if (!m_marker.IsDone() && !too_large) {
+        return true;
+    }
+
+    {
+        ConcurrentMarker::Guard guard(&m_marker);
+
+        // values that were overwritten since the thread ran out
+        // of work, or everything that is left if it is behind
+        m_marker.Finish();
+        m_concurrent_marking = false;
+
+        double seconds = std::chrono::duration_cast<std::chrono::duration<double, std::ratio<1>>>(start - m_marking_start).count();
+        m_gc_stats.m_concurrent_seconds += seconds;
+        if (m_marker.GetNumMarked() != 0 && seconds > 0) {
+            m_mark_rate = m_marker.GetNumMarked() / seconds;
+        }
+    }
+
+    m_heap.StartSweep();
+    bool result = SweepHeap(too_large ? std::chrono::high_resolution_clock::time_point::max() : deadline);
+    RecordPause(start);
+    return result;
+}
+
+bool VM::SweepHeap(std::chrono::high_resolution_clock::time_point deadline)
+{
+    while (!m_heap.SweepPages(sweep_slice_pages)) {
+        if (std::chrono::high_resolution_clock::now() >= deadline) {
+            return true;
+        }
+    }
+
+    // the next run is after the heap has grown
+    // in proportion to what is still alive
+    m_max_heap_objects = std::min(
+        std::max(m_heap.Size() * GC_THRESHOLD_GROWTH, (size_t)GC_THRESHOLD_MIN),
+        (size_t)GC_THRESHOLD_MAX);
+
+    m_gc_stats.m_major_collections++;
+
+    if (m_heap.Size() >= GC_THRESHOLD_MAX) {
         // heap overflow.
         char buffer[256];
         std::sprintf(buffer, "heap overflow, GC_THRESHOLD_MAX is %d", (int)GC_THRESHOLD_MAX);
         ThrowException(Exception(buffer));
-        return nullptr;
-    } else if (heap_size >= m_max_heap_objects) {
-        // run the gc
-        MarkObjects(&m_exec_thread);
-        m_heap.Sweep();
-        utf::cout << "Garbage collection ran.\n";
-        utf::cout << "\tm_heap.Size() = " << m_heap.Size() << "\n";
+        return false;
+    }
+
+    return true;
+}
+
+void VM::RecordPause(std::chrono::high_resolution_clock::time_point start)
+{
+    auto end = std::chrono::high_resolution_clock::now();
+    double seconds = std::chrono::duration_cast<std::chrono::duration<double, std::ratio<1>>>(end - start).count();
+    m_gc_stats.m_major_seconds += seconds;
+    m_gc_stats.m_slice_seconds.push_back(seconds);
+}
+
+void VM::StoreMemberConcurrent(HeapValue *obj, StackValue &member, const StackValue &value)
+{
+    ConcurrentMarker::Guard guard(&m_marker);
+
+    // the thread may not have gotten to what member referred
+    // to when marking started, and has to find it all the same
+    if (member.GetType() == StackValue::HEAP_POINTER) {
+        m_marker.Push(member.GetHeapPointer());
+    }
+
+    WriteBarrier(obj, value);
+    member = value;
+}
+
+void VM::CollectNursery()
+{
+    auto start = std::chrono::high_resolution_clock::now();
+
+    // the marking thread may be looking at the objects that are forwarded
+    ConcurrentMarker::Guard guard(m_concurrent_marking ? &m_marker : nullptr);
 
-        // check if size is still over the maximum,
-        // and resize the maximum if necessary.
-        if (m_heap.Size() >= m_max_heap_objects) {
-            // resize max number of objects
-            m_max_heap_objects = std::min(
-                m_max_heap_objects + GC_THRESHOLD_STEP, GC_THRESHOLD_MAX);
+    ExecutionThread *thread = &m_exec_thread;
+    for (int i = 0; i < 8; i++) {
+        ForwardValue(thread->m_regs[i]);
+    }
+    for (int i = thread->m_stack.GetStackPointer() - 1; i >= 0; i--) {
+        ForwardValue(thread->m_stack[i]);
+    }
+    for (size_t i = 0; i < m_static_memory.Size(); i++) {
+        ForwardValue(m_static_memory[i]);
+    }
+
+    // the only old values that can refer to the nursery
+    for (HeapValue *hv : m_remembered) {
+        hv->GetFlags() &= ~GC_REMEMBERED;
+        m_promoted.push_back(hv);
+    }
+    m_remembered.clear();
+
+    // promoted objects can still refer to the nursery as well
+    while (!m_promoted.empty()) {
+        HeapValue *hv = m_promoted.back();
+        m_promoted.pop_back();
+
+        if (Object *obj_ptr = hv->GetPointer<Object>()) {
+            int obj_size = obj_ptr->GetSize();
+            for (int i = 0; i < obj_size; i++) {
+                ForwardValue(obj_ptr->GetMember(i));
+            }
         }
     }
 
-    return m_heap.Alloc();
+    // everything that was not moved is garbage
+    m_nursery.Reset();
+
+    auto end = std::chrono::high_resolution_clock::now();
+    double seconds = std::chrono::duration_cast<std::chrono::duration<double, std::ratio<1>>>(end - start).count();
+    m_gc_stats.m_minor_collections++;
+    m_gc_stats.m_minor_seconds += seconds;
+    m_gc_stats.m_minor_max_seconds = std::max(m_gc_stats.m_minor_max_seconds, seconds);
 }
 
-void VM::MarkObject(StackValue &object)
+HeapValue *VM::Promote(HeapValue *hv)
 {
-    if (object.m_type == StackValue::HEAP_POINTER && object.m_value.ptr != nullptr) {
-        Object *obj_ptr = object.m_value.ptr->GetPointer<Object>();
-        if (obj_ptr != nullptr) {
+    if (hv->GetFlags() & GC_FORWARDED) {
+        return hv->GetForwardingAddress();
+    }
+
+    HeapValue *old = m_heap.Alloc(hv->GetPayloadSize());
+    hv->MoveTo(old);
+    m_gc_stats.m_promoted++;
+
+    if (old->GetKind() == HEAP_OBJECT) {
+        m_promoted.push_back(old);
+    }
+    if (m_marking) {
+        // the heap is being marked, and nothing has looked into it yet
+        m_mark_stack.push_back(old);
+    } else if (m_concurrent_marking) {
+        // it was not there when marking started, so it is kept
+        old->GetFlags() |= GC_MARKED;
+    }
+
+    return old;
+}
+
+bool VM::DrainMarkStack(std::chrono::high_resolution_clock::time_point deadline)
+{
+    bool timed = deadline != std::chrono::high_resolution_clock::time_point::max();
+    size_t num_marked = 0;
+
+    while (!m_mark_stack.empty()) {
+        if (timed && ++num_marked % 256 == 0 &&
+            std::chrono::high_resolution_clock::now() >= deadline) {
+            return false;
+        }
+
+        HeapValue *hv = m_mark_stack.back();
+        m_mark_stack.pop_back();
+
+        // values are only looked at when popped, so the header
+        // of the next one can be loaded while this one is marked
+        if (!m_mark_stack.empty()) {
+            __builtin_prefetch(m_mark_stack.back());
+        }
+
+        if (hv->GetFlags() & GC_MARKED) {
+            continue;
+        }
+        hv->GetFlags() |= GC_MARKED;
+
+        if (Object *obj_ptr = hv->GetPointer<Object>()) {
             int obj_size = obj_ptr->GetSize();
             for (int i = 0; i < obj_size; i++) {
-                MarkObject(obj_ptr->GetMember(i));
+                MarkValue(obj_ptr->GetMember(i));
             }
         }
-        object.m_value.ptr->GetFlags() |= GC_MARKED;
     }
+
+    return true;
 }
 
-void VM::MarkObjects(ExecutionThread *thread)
+void VM::MarkRoots(ExecutionThread *thread)
 {
+    // values that are only in a register are still in use
+    for (int i = 0; i < 8; i++) {
+        MarkValue(thread->m_regs[i]);
+    }
+
     for (int i = thread->m_stack.GetStackPointer() - 1; i >= 0; i--) {
-        MarkObject(thread->m_stack[i]);
+        MarkValue(thread->m_stack[i]);
+    }
+
+    // static strings are not on the heap, but marking them
+    // keeps this from depending on what static memory can hold
+    for (size_t i = 0; i < m_static_memory.Size(); i++) {
+        MarkValue(m_static_memory[i]);
+    }
+}
+
+void VM::MarkObjects(ExecutionThread *thread)
+{
+    MarkRoots(thread);
+    DrainMarkStack();
+}
+
+bool VM::AddStrings(StackValue &lhs, StackValue &rhs, StackValue &result)
+{
+    HeapValue *left = lhs.GetHeapPointer();
+    HeapValue *right = rhs.GetType() == StackValue::HEAP_POINTER ? rhs.GetHeapPointer() : nullptr;
+    if (left == nullptr || right == nullptr) {
+        return false;
     }
+
+    bool left_builder = left->TypeCompatible<StringBuilder>();
+    bool right_builder = right->TypeCompatible<StringBuilder>();
+    if ((!left_builder && !left->TypeCompatible<utf::Utf8String>()) ||
+        (!right_builder && !right->TypeCompatible<utf::Utf8String>())) {
+        return false;
+    }
+
+    // the result is built before allocating,
+    // which may collect the operands
+    StringBuilder sum = left_builder
+        ? left->Get<StringBuilder>()
+        : StringBuilder(left->Get<utf::Utf8String>());
+    sum = right_builder
+        ? sum.Append(right->Get<StringBuilder>())
+        : sum.Append(right->Get<utf::Utf8String>());
+
+    HeapValue *hv = HeapAlloc(HeapValue::PayloadSize<StringBuilder>());
+    if (hv != nullptr) {
+        hv->Assign(std::move(sum));
+        result.SetHeapPointer(hv);
+    }
+
+    return true;
 }
 
 void VM::Echo(StackValue &value)
@@ -75,82 +441,188 @@ void VM::Echo(StackValue &value)
     // string buffer for printing datatype
     char str[256];
 
-    switch (value.m_type) {
+    switch (value.GetType()) {
     case StackValue::INT32:
-        utf::cout << value.m_value.i32;
+        utf::cout << value.GetInt32();
         break;
     case StackValue::INT64:
-        utf::cout << value.m_value.i64;
+        utf::cout << value.GetInt64();
         break;
     case StackValue::FLOAT:
-        utf::cout << value.m_value.f;
+        utf::cout << value.GetFloat();
         break;
     case StackValue::DOUBLE:
-        utf::cout << value.m_value.d;
+        utf::cout << value.GetDouble();
         break;
     case StackValue::BOOLEAN:
-        utf::cout << (value.m_value.b ? "true" : "false");
+        utf::cout << (value.GetBoolean() ? "true" : "false");
         break;
     case StackValue::HEAP_POINTER:
-        if (value.m_value.ptr == nullptr) {
+        if (value.GetHeapPointer() == nullptr) {
             // special case for null pointers
             utf::cout << "null";
-        } else if (value.m_value.ptr->TypeCompatible<utf::Utf8String>()) {
+        } else if (value.GetHeapPointer()->TypeCompatible<utf::Utf8String>()) {
             // print string value
-            utf::cout << value.m_value.ptr->Get<utf::Utf8String>();
+            utf::cout << value.GetHeapPointer()->Get<utf::Utf8String>();
+        } else if (value.GetHeapPointer()->TypeCompatible<StringBuilder>()) {
+            utf::cout << value.GetHeapPointer()->Get<StringBuilder>().Flatten();
         } else {
-            std::sprintf(str, "object<%p>", (void*)value.m_value.ptr);
+            std::sprintf(str, "object<%p>", (void*)value.GetHeapPointer());
             utf::cout << str;
         }
 
         break;
     case StackValue::FUNCTION:
         std::sprintf(str, "function<%du, %du>",
-            value.m_value.func.m_addr, value.m_value.func.m_nargs);
+            value.GetFunction().m_addr, value.GetFunction().m_nargs);
         utf::cout << str;
         break;
     case StackValue::ADDRESS:
-        std::sprintf(str, "address<%du>", value.m_value.addr);
+        std::sprintf(str, "address<%du>", value.GetAddress());
         utf::cout << str;
         break;
     case StackValue::TYPE_INFO:
-        std::sprintf(str, "type<%du>", value.m_value.type_info.m_size);
+        std::sprintf(str, "type<%du>", value.GetTypeInfo().m_size);
         utf::cout << str;
         break;
     }
 }
 
-void VM::InvokeFunction(StackValue &value, uint8_t num_args)
+bool VM::PushFrame(const StackValue &value, uint8_t num_args, uint32_t return_pc)
 {
-    if (value.m_type != StackValue::FUNCTION) {
+    if (value.GetType() != StackValue::FUNCTION) {
         char buffer[256];
         std::sprintf(buffer, "cannot invoke type '%s' as a function",
             value.GetTypeString());
         ThrowException(Exception(buffer));
-    } else if (value.m_value.func.m_nargs != num_args) {
+        return false;
+    } else if (value.GetFunction().m_nargs != num_args) {
         char buffer[256];
         std::sprintf(buffer, "expected %d parameters, received %d",
-            (int)value.m_value.func.m_nargs, (int)num_args);
+            (int)value.GetFunction().m_nargs, (int)num_args);
         ThrowException(Exception(buffer));
-    } else {
-        // store current address
-        uint32_t previous = m_bs->Position();
-        // seek to the function's address
-        m_bs->Seek(value.m_value.func.m_addr);
+        return false;
+    } else if (m_exec_thread.m_frames.size() >= FRAME_STACK_MAX) {
+        ThrowException(Exception("maximum call depth exceeded"));
+        return false;
+    }
 
-        while (m_bs->Position() < m_bs->Size()) {
-            uint8_t code;
-            m_bs->Read(&code, 1);
+    uint32_t sp = m_exec_thread.m_stack.GetStackPointer();
 
-            if (code != RET) {
-                HandleInstruction(code);
-            } else {
-                // leave function and return to previous position
-                m_bs->Seek(previous);
+    // a verified function does not check its pushes,
+    // so the whole frame has to fit from the start
+    if (sp < num_args || sp + m_max_stack_depth > m_exec_thread.m_stack.GetLimit()) {
+        ThrowException(Exception("stack overflow"));
+        return false;
+    }
+
+    Frame frame;
+    frame.m_return_pc = return_pc;
+    frame.m_sp = sp;
+    frame.m_base = sp - num_args;
+    frame.m_tail_called = false;
+    m_exec_thread.m_frames.push_back(frame);
+
+    return true;
+}
+
+void VM::InvokeFunction(StackValue &value, uint8_t num_args)
+{
+    std::vector<Frame> &frames = m_exec_thread.m_frames;
+    size_t depth = frames.size();
+
+    // store current address
+    uint32_t previous = m_pc;
+
+    if (!PushFrame(value, num_args, previous)) {
+        return;
+    }
+
+    // seek to the function's address
+    m_pc = value.GetFunction().m_addr;
+
+#ifdef ACEVM_JIT
+    // hot functions run as native code until it hands control back.
+    // a pending exception unwinds straight to the caller.
+    if (m_jit.IsEnabled() && m_jit.Enter(m_pc) &&
+        m_exec_thread.m_exception_state.m_exception_occured) {
+        frames.resize(depth);
+        return;
+    }
+#endif
+
+    // run the function body until it returns from this frame. native
+    // code may have entered other functions by now.
+    RunResult result = Run(depth + 1);
+
+    if (result == RUN_RETURNED) {
+        if (frames[depth].m_tail_called) {
+            m_exec_thread.m_stack.SetStackPointer(frames[depth].m_sp);
+        }
+        // leave function and return to previous position
+        m_pc = previous;
+    }
+
+    // if the program was halted or an exception is pending,
+    // every frame above the caller's is discarded
+    frames.resize(depth);
+}
+
+void VM::StoreStatic(const Instruction &ins)
+{
+    StackValue sv;
+
+    switch (ins.m_opcode) {
+    case STORE_STATIC_STRING:
+    {
+        // the value will be freed on
+        // the destructor call of m_static_memory
+        HeapValue *hv = HeapValue::Create(HeapValue::PayloadSize<utf::Utf8String>());
+
+        if (ins.m_b) {
+            // the string is followed by a NUL in the bytecode, which
+            // outlives static memory. it is only copied if changed.
+            hv->Assign(utf::Utf8String::Borrow(ins.m_imm.str, ins.m_index));
+        } else {
+            hv->Assign(utf::Utf8String(ins.m_imm.str, ins.m_index));
+        }
+
+        sv.SetHeapPointer(hv);
+        break;
+    }
+    case STORE_STATIC_ADDRESS:
+        sv.SetAddress(ins.m_imm.addr);
+        break;
+    case STORE_STATIC_FUNCTION:
+        sv.SetFunction(ins.m_imm.addr, ins.m_a);
+        break;
+    case STORE_STATIC_TYPE:
+        sv.SetTypeInfo(ins.m_a);
+        break;
+    }
+
+    m_static_memory.Store(sv);
+}
+
+uint32_t VM::Initialize()
+{
+    uint32_t pc = 0;
+
+    for (; pc < m_program->Size(); pc++) {
+        const Instruction &ins = (*m_program)[pc];
+
+        if (ins.m_opcode >= STORE_STATIC_STRING && ins.m_opcode <= STORE_STATIC_TYPE) {
+            if (m_static_memory.Size() >= StaticMemory::max_size) {
+                // let the interpreter throw
                 break;
             }
+            StoreStatic(ins);
+        } else if (ins.m_opcode != NOP) {
+            break;
         }
     }
+
+    return pc;
 }
 
 void VM::ThrowException(const Exception &exception)
@@ -161,475 +633,778 @@ void VM::ThrowException(const Exception &exception)
     } else {
         // unhandled exception
         std::printf("unhandled exception: %s\n", exception.ToString().c_str());
-        // seek to end of bytecode stream
-        m_bs->Seek(m_bs->Size());
+        // jump to the EXIT at the end of the program. the exception
+        // flag stays set, so every nested Run() unwinds on the way there.
+        m_pc = m_program->Size() - 1;
+        m_exec_thread.m_exception_state.m_exception_occured = true;
     }
 }
 
-void VM::HandleInstruction(uint8_t code)
+void VM::PopHandlers(size_t depth)
 {
-    switch (code) {
-    case STORE_STATIC_STRING:
-    {
-        // get string length
-        uint32_t len;
-        m_bs->Read(&len);
+    ExceptionState &state = m_exec_thread.m_exception_state;
+    while (!state.m_handlers.empty() && state.m_handlers.back().m_frame_depth >= depth) {
+        state.m_handlers.pop_back();
+        state.m_try_counter--;
+    }
+}
 
-        // read string based on length
-        char *str = new char[len + 1];
-        m_bs->Read(str, len);
-        str[len] = '\0';
+void VM::ProfileSite(Instruction &ins, const StackValue &lhs, const StackValue &rhs)
+{
+    QuickenSite &site = m_program->GetSite(ins.m_index);
+    site.m_generic++;
 
-        // the value will be freed on
-        // the destructor call of m_static_memory
-        HeapValue *hv = new HeapValue();
-        hv->Assign(utf::Utf8String(str));
+    if (site.m_deopts >= QUICKEN_MAX_DEOPTS) {
+        // types at this site are not stable enough
+        return;
+    }
 
-        StackValue sv;
-        sv.m_type = StackValue::HEAP_POINTER;
-        sv.m_value.ptr = hv;
+    if (lhs.GetType() != site.m_lhs_type || rhs.GetType() != site.m_rhs_type || site.m_stable == 0) {
+        site.m_lhs_type = lhs.GetType();
+        site.m_rhs_type = rhs.GetType();
+        site.m_stable = 1;
+        return;
+    }
 
-        m_static_memory.Store(sv);
+    if (++site.m_stable < QUICKEN_THRESHOLD || lhs.GetType() != rhs.GetType()) {
+        return;
+    }
 
-        delete[] str;
+    // the typed forms are laid out as I32_I32, I64_I64, F64_F64 per opcode
+    int variant;
+    switch (lhs.GetType()) {
+    case StackValue::INT32:
+        variant = 0;
+        break;
+    case StackValue::INT64:
+        variant = 1;
+        break;
+    case StackValue::DOUBLE:
+        variant = 2;
+        break;
+    default:
+        // no typed form for these operands
+        return;
+    }
 
+    switch (site.m_opcode) {
+    case ADD:
+        ins.m_opcode = ADD_I32_I32 + variant;
+        break;
+    case SUB:
+        ins.m_opcode = SUB_I32_I32 + variant;
+        break;
+    case MUL:
+        ins.m_opcode = MUL_I32_I32 + variant;
+        break;
+    case DIV:
+        ins.m_opcode = DIV_I32_I32 + variant;
+        break;
+    case CMP:
+        ins.m_opcode = CMP_I32_I32 + variant;
         break;
     }
-    case STORE_STATIC_ADDRESS:
-    {
-        uint32_t value;
-        m_bs->Read(&value);
+}
 
-        StackValue sv;
-        sv.m_type = StackValue::ADDRESS;
-        sv.m_value.addr = value;
+void VM::Deoptimize(Instruction &ins)
+{
+    QuickenSite &site = m_program->GetSite(ins.m_index);
+    site.m_deopts++;
+    site.m_stable = 0;
 
-        m_static_memory.Store(sv);
+    ins.m_opcode = site.m_opcode;
+}
 
-        break;
-    }
-    case STORE_STATIC_FUNCTION:
-    {
-        uint32_t addr;
-        m_bs->Read(&addr);
+void VM::PrintQuickeningStats() const
+{
+    static const char *const names[] = { "add", "sub", "mul", "div", "cmp" };
+    static const char *const variants[] = { "i32_i32", "i64_i64", "f64_f64" };
 
-        uint8_t nargs;
-        m_bs->Read(&nargs);
+    std::printf("%-8s %-6s %-10s %12s %12s %8s %8s\n",
+        "pc", "op", "form", "generic", "typed", "deopts", "hit %");
 
-        StackValue sv;
-        sv.m_type = StackValue::FUNCTION;
-        sv.m_value.func.m_addr = addr;
-        sv.m_value.func.m_nargs = nargs;
+    for (const QuickenSite &site : m_program->GetSites()) {
+        uint64_t total = site.m_generic + site.m_hits;
+        if (total == 0) {
+            continue;
+        }
 
-        m_static_memory.Store(sv);
+        const Instruction &ins = (*m_program)[site.m_pc];
 
-        break;
+        const char *form = "generic";
+        if (ins.m_opcode >= ADD_I32_I32 && ins.m_opcode <= CMP_F64_F64) {
+            form = variants[(ins.m_opcode - ADD_I32_I32) % 3];
+        }
+
+        int name = site.m_opcode == CMP ? 4 : site.m_opcode - ADD;
+
+        std::printf("%-8u %-6s %-10s %12llu %12llu %8llu %7.2f%%\n",
+            site.m_pc, names[name], form,
+            (unsigned long long)site.m_generic,
+            (unsigned long long)site.m_hits,
+            (unsigned long long)site.m_deopts,
+            100.0 * (double)site.m_hits / (double)total);
     }
-    case STORE_STATIC_TYPE:
-    {
-        uint8_t size;
-        m_bs->Read(&size);
+}
 
-        StackValue sv;
-        sv.m_type = StackValue::TYPE_INFO;
-        sv.m_value.type_info.m_size = size;
+RunResult VM::Run(size_t base_depth)
+{
+    if (m_verified) {
+        return Interpret<false>(base_depth);
+    }
+    return Interpret<true>(base_depth);
+}
 
-        m_static_memory.Store(sv);
+template <bool checked>
+RunResult VM::Interpret(size_t base_depth)
+{
+    Instruction *const instructions = m_program->GetInstructions();
+    Instruction *ip = instructions + m_pc;
+
+#ifdef ACEVM_COMPUTED_GOTO
+    // every handler jumps straight to the next one through this table,
+    // so each opcode gets its own indirect branch to be predicted
+    static void *dispatch_table[256];
+    static bool dispatch_table_ready = false;
+
+    if (!dispatch_table_ready) {
+        std::fill(dispatch_table, dispatch_table + 256, &&op_UNKNOWN);
+
+        dispatch_table[NOP] = &&op_NOP;
+        dispatch_table[STORE_STATIC_STRING] = &&op_STORE_STATIC_STRING;
+        dispatch_table[STORE_STATIC_ADDRESS] = &&op_STORE_STATIC_ADDRESS;
+        dispatch_table[STORE_STATIC_FUNCTION] = &&op_STORE_STATIC_FUNCTION;
+        dispatch_table[STORE_STATIC_TYPE] = &&op_STORE_STATIC_TYPE;
+        dispatch_table[LOAD_I32] = &&op_LOAD_I32;
+        dispatch_table[LOAD_I64] = &&op_LOAD_I64;
+        dispatch_table[LOAD_F32] = &&op_LOAD_F32;
+        dispatch_table[LOAD_F64] = &&op_LOAD_F64;
+        dispatch_table[LOAD_LOCAL] = &&op_LOAD_LOCAL;
+        dispatch_table[LOAD_STATIC] = &&op_LOAD_STATIC;
+        dispatch_table[LOAD_MEM] = &&op_LOAD_MEM;
+        dispatch_table[LOAD_NULL] = &&op_LOAD_NULL;
+        dispatch_table[LOAD_TRUE] = &&op_LOAD_TRUE;
+        dispatch_table[LOAD_FALSE] = &&op_LOAD_FALSE;
+        dispatch_table[MOV] = &&op_MOV;
+        dispatch_table[MOV_MEM] = &&op_MOV_MEM;
+        dispatch_table[PUSH] = &&op_PUSH;
+        dispatch_table[POP] = &&op_POP;
+        dispatch_table[ECHO] = &&op_ECHO;
+        dispatch_table[ECHO_NEWLINE] = &&op_ECHO_NEWLINE;
+        dispatch_table[JMP] = &&op_JMP;
+        dispatch_table[JE] = &&op_JE;
+        dispatch_table[JNE] = &&op_JNE;
+        dispatch_table[JG] = &&op_JG;
+        dispatch_table[JGE] = &&op_JGE;
+        dispatch_table[CALL] = &&op_CALL;
+        dispatch_table[RET] = &&op_RET;
+        dispatch_table[BEGIN_TRY] = &&op_BEGIN_TRY;
+        dispatch_table[END_TRY] = &&op_END_TRY;
+        dispatch_table[NEW] = &&op_NEW;
+        dispatch_table[CMP] = &&op_CMP;
+        dispatch_table[CMPZ] = &&op_CMPZ;
+        dispatch_table[ADD] = &&op_ADD;
+        dispatch_table[SUB] = &&op_SUB;
+        dispatch_table[MUL] = &&op_MUL;
+        dispatch_table[DIV] = &&op_DIV;
+        dispatch_table[EXIT] = &&op_EXIT;
+        dispatch_table[TAIL_CALL] = &&op_TAIL_CALL;
+        dispatch_table[ADD_I32_I32] = &&op_ADD_I32_I32;
+        dispatch_table[ADD_I64_I64] = &&op_ADD_I64_I64;
+        dispatch_table[ADD_F64_F64] = &&op_ADD_F64_F64;
+        dispatch_table[SUB_I32_I32] = &&op_SUB_I32_I32;
+        dispatch_table[SUB_I64_I64] = &&op_SUB_I64_I64;
+        dispatch_table[SUB_F64_F64] = &&op_SUB_F64_F64;
+        dispatch_table[MUL_I32_I32] = &&op_MUL_I32_I32;
+        dispatch_table[MUL_I64_I64] = &&op_MUL_I64_I64;
+        dispatch_table[MUL_F64_F64] = &&op_MUL_F64_F64;
+        dispatch_table[DIV_I32_I32] = &&op_DIV_I32_I32;
+        dispatch_table[DIV_I64_I64] = &&op_DIV_I64_I64;
+        dispatch_table[DIV_F64_F64] = &&op_DIV_F64_F64;
+        dispatch_table[CMP_I32_I32] = &&op_CMP_I32_I32;
+        dispatch_table[CMP_I64_I64] = &&op_CMP_I64_I64;
+        dispatch_table[CMP_F64_F64] = &&op_CMP_F64_F64;
+
+        dispatch_table_ready = true;
+    }
 
-        break;
+#define VM_CASE(name) op_##name
+#define VM_DEFAULT op_UNKNOWN
+#define VM_DISPATCH() goto *dispatch_table[ip->m_opcode]
+
+    VM_DISPATCH();
+#else
+#define VM_CASE(name) case name
+#define VM_DEFAULT default
+#define VM_DISPATCH() goto vm_dispatch
+
+vm_dispatch:
+    switch (ip->m_opcode) {
+#endif
+
+#define VM_NEXT() \
+    do { \
+        ++ip; \
+        VM_DISPATCH(); \
+    } while (0)
+
+// typed forms of ADD, SUB, MUL and DIV. operands of any other type, and
+// division by zero, rewrite the instruction back to its generic form and
+// run that instead. integer math is done in 64 bits like the generic form,
+// which also throws for an int64 result that a value cannot hold.
+#define VM_QUICK_ARITHMETIC(type, name, wide_type, op, check_zero) \
+    do { \
+        StackValue &lhs = m_exec_thread.m_regs[ip->m_a]; \
+        StackValue &rhs = m_exec_thread.m_regs[ip->m_b]; \
+        if (!lhs.IsType(type) || !rhs.IsType(type) || \
+            (check_zero && rhs.Get##name() == 0)) { \
+            Deoptimize(*ip); \
+            VM_DISPATCH(); \
+        } \
+        wide_type result_value = (wide_type)lhs.Get##name() op (wide_type)rhs.Get##name(); \
+        if (type == StackValue::INT64 && !StackValue::Int64Fits((int64_t)result_value)) { \
+            Deoptimize(*ip); \
+            VM_DISPATCH(); \
+        } \
+        m_exec_thread.m_regs[ip->m_c].Set##name(result_value); \
+        m_program->GetSite(ip->m_index).m_hits++; \
+        VM_NEXT(); \
+    } while (0)
+
+// typed forms of CMP
+#define VM_QUICK_COMPARE(type, name) \
+    do { \
+        StackValue &lhs = m_exec_thread.m_regs[ip->m_a]; \
+        StackValue &rhs = m_exec_thread.m_regs[ip->m_b]; \
+        if (!lhs.IsType(type) || !rhs.IsType(type)) { \
+            Deoptimize(*ip); \
+            VM_DISPATCH(); \
+        } \
+        if (lhs.Get##name() > rhs.Get##name()) { \
+            m_exec_thread.m_regs.m_flags = GREATER; \
+        } else if (lhs.Get##name() == rhs.Get##name()) { \
+            m_exec_thread.m_regs.m_flags = EQUAL; \
+        } else { \
+            m_exec_thread.m_regs.m_flags = NONE; \
+        } \
+        m_program->GetSite(ip->m_index).m_hits++; \
+        VM_NEXT(); \
+    } while (0)
+
+// throw an exception and continue at the innermost catch block.
+// try blocks cost nothing until this happens.
+#define VM_THROW(exception) \
+    do { \
+        ThrowException(exception); \
+        goto vm_unwind; \
+    } while (0)
+
+// checks that the Verifier proves for the whole program in advance
+#define VM_CHECK(condition, message) \
+    do { \
+        if (checked && !(condition)) { \
+            VM_THROW(Exception(message)); \
+        } \
+    } while (0)
+
+// for the generic instructions, where a conversion
+// in the middle of the handler may have thrown
+#define VM_NEXT_CHECKED() \
+    do { \
+        if (m_exec_thread.m_exception_state.m_exception_occured) { \
+            goto vm_unwind; \
+        } \
+        VM_NEXT(); \
+    } while (0)
+
+#ifdef ACEVM_JIT
+// backward jumps close loops, so their targets are counted and
+// run as native code once they are hot
+#define VM_JUMP(target) \
+    do { \
+        uint32_t resume = (target); \
+        if (instructions + resume <= ip && m_jit.IsEnabled() && m_jit.Enter(resume) && \
+            m_exec_thread.m_exception_state.m_exception_occured) { \
+            goto vm_unwind; \
+        } \
+        ip = instructions + resume; \
+        VM_DISPATCH(); \
+    } while (0)
+#else
+#define VM_JUMP(target) \
+    do { \
+        ip = instructions + (target); \
+        VM_DISPATCH(); \
+    } while (0)
+#endif
+
+// entering a function. its entry is counted for the JIT as well
+#ifdef ACEVM_JIT
+#define VM_ENTER(target) \
+    do { \
+        uint32_t resume = (target); \
+        if (m_jit.IsEnabled() && m_jit.Enter(resume) && \
+            m_exec_thread.m_exception_state.m_exception_occured) { \
+            goto vm_unwind; \
+        } \
+        ip = instructions + resume; \
+        VM_DISPATCH(); \
+    } while (0)
+#else
+#define VM_ENTER(target) VM_JUMP(target)
+#endif
+
+// pop the current frame and continue at its return address. the frame
+// that this Run() was started with is popped by whoever started it.
+// try blocks that RET leaves are left as well.
+#define VM_RETURN() \
+    do { \
+        std::vector<Frame> &frames = m_exec_thread.m_frames; \
+        PopHandlers(frames.size()); \
+        if (frames.size() == base_depth) { \
+            m_pc = ip - instructions; \
+            return RUN_RETURNED; \
+        } \
+        const Frame &frame = frames.back(); \
+        if (frame.m_tail_called) { \
+            m_exec_thread.m_stack.SetStackPointer(frame.m_sp); \
+        } \
+        ip = instructions + frame.m_return_pc; \
+        frames.pop_back(); \
+        VM_DISPATCH(); \
+    } while (0)
+
+    VM_CASE(NOP):
+    {
+        VM_NEXT();
     }
-    case LOAD_I32:
+    VM_CASE(STORE_STATIC_STRING):
+    VM_CASE(STORE_STATIC_ADDRESS):
+    VM_CASE(STORE_STATIC_FUNCTION):
+    VM_CASE(STORE_STATIC_TYPE):
     {
-        uint8_t reg;
-        m_bs->Read(&reg);
+        VM_CHECK(m_static_memory.Size() < StaticMemory::max_size, "not enough static memory");
+
+        StoreStatic(*ip);
+
+        VM_NEXT();
+    }
+    VM_CASE(LOAD_I32):
+    {
+        uint8_t reg = ip->m_a;
 
         // get register value given
         StackValue &value = m_exec_thread.m_regs[reg];
-        value.m_type = StackValue::INT32;
 
-        // read 32-bit integer into register value
-        m_bs->Read(&value.m_value.i32);
+        // copy 32-bit integer into register value
+        value.SetInt32(ip->m_imm.i32);
 
-        break;
+        VM_NEXT();
     }
-    case LOAD_I64:
+    VM_CASE(LOAD_I64):
     {
-        uint8_t reg;
-        m_bs->Read(&reg);
+        uint8_t reg = ip->m_a;
 
         // get register value given
         StackValue &value = m_exec_thread.m_regs[reg];
-        value.m_type = StackValue::INT64;
 
-        // read 64-bit integer into register value
-        m_bs->Read(&value.m_value.i64);
+        // copy 64-bit integer into register value
+        value.SetInt64(ip->m_imm.i64);
 
-        break;
+        VM_NEXT();
     }
-    case LOAD_F32:
+    VM_CASE(LOAD_F32):
     {
-        uint8_t reg;
-        m_bs->Read(&reg);
+        uint8_t reg = ip->m_a;
 
         // get register value given
         StackValue &value = m_exec_thread.m_regs[reg];
-        value.m_type = StackValue::FLOAT;
 
-        // read float into register value
-        m_bs->Read(&value.m_value.f);
+        // copy float into register value
+        value.SetFloat(ip->m_imm.f);
 
-        break;
+        VM_NEXT();
     }
-    case LOAD_F64:
+    VM_CASE(LOAD_F64):
     {
-        uint8_t reg;
-        m_bs->Read(&reg);
+        uint8_t reg = ip->m_a;
 
         // get register value given
         StackValue &value = m_exec_thread.m_regs[reg];
-        value.m_type = StackValue::DOUBLE;
 
-        // read double into register value
-        m_bs->Read(&value.m_value.d);
+        // copy double into register value
+        value.SetDouble(ip->m_imm.d);
 
-        break;
+        VM_NEXT();
     }
-    case LOAD_LOCAL:
+    VM_CASE(LOAD_LOCAL):
     {
-        uint8_t reg;
-        m_bs->Read(&reg);
+        uint8_t reg = ip->m_a;
+
+        uint16_t offset = ip->m_index;
 
-        uint16_t offset;
-        m_bs->Read(&offset);
+        VM_CHECK(offset != 0 && offset <= m_exec_thread.m_stack.GetStackPointer(),
+            "stack offset out of bounds");
 
         // read value from stack at (sp - offset)
         // into the the register
         m_exec_thread.m_regs[reg] =
             m_exec_thread.m_stack[m_exec_thread.m_stack.GetStackPointer() - offset];
 
-        break;
+        VM_NEXT();
     }
-    case LOAD_STATIC:
+    VM_CASE(LOAD_STATIC):
     {
-        uint8_t reg;
-        m_bs->Read(&reg);
+        uint8_t reg = ip->m_a;
+
+        uint16_t index = ip->m_index;
 
-        uint16_t index;
-        m_bs->Read(&index);
+        VM_CHECK(index < m_static_memory.Size(), "static index out of bounds");
 
         // read value from static memory
         // at the index into the the register
         m_exec_thread.m_regs[reg] = m_static_memory[index];
 
-        break;
+        VM_NEXT();
     }
-    case LOAD_MEM:
+    VM_CASE(LOAD_MEM):
     {
-        uint8_t dst;
-        m_bs->Read(&dst);
+        uint8_t dst = ip->m_a;
 
-        uint8_t src;
-        m_bs->Read(&src);
+        uint8_t src = ip->m_b;
 
-        uint8_t idx;
-        m_bs->Read(&idx);
+        uint8_t idx = ip->m_c;
 
         StackValue &sv = m_exec_thread.m_regs[src];
-        assert(sv.m_type == StackValue::HEAP_POINTER && "source must be a pointer");
+        if (sv.GetType() != StackValue::HEAP_POINTER) {
+            VM_THROW(Exception("not a standard object"));
+        }
 
-        HeapValue *hv = sv.m_value.ptr;
+        HeapValue *hv = sv.GetHeapPointer();
         if (hv == nullptr) {
             // null reference exception.
-            ThrowException(Exception("attempted to access a member of a null object"));
+            VM_THROW(Exception("attempted to access a member of a null object"));
         } else {
             Object *objptr = nullptr;
             if ((objptr = hv->GetPointer<Object>()) != nullptr) {
-                assert(idx < objptr->GetSize() && "member index out of bounds");
+                if (idx >= objptr->GetSize()) {
+                    VM_THROW(Exception("member index out of bounds"));
+                }
                 m_exec_thread.m_regs[dst] = objptr->GetMember(idx);
             } else {
-                ThrowException(Exception("not a standard object"));
+                VM_THROW(Exception("not a standard object"));
             }
         }
 
-        break;
+        VM_NEXT();
     }
-    case LOAD_NULL:
+    VM_CASE(LOAD_NULL):
     {
-        uint8_t reg;
-        m_bs->Read(&reg);
+        uint8_t reg = ip->m_a;
 
         StackValue &sv = m_exec_thread.m_regs[reg];
-        sv.m_type = StackValue::HEAP_POINTER;
-        sv.m_value.ptr = nullptr;
+        sv.SetHeapPointer(nullptr);
 
-        break;
+        VM_NEXT();
     }
-    case LOAD_TRUE:
+    VM_CASE(LOAD_TRUE):
     {
-        uint8_t reg;
-        m_bs->Read(&reg);
+        uint8_t reg = ip->m_a;
 
         StackValue &sv = m_exec_thread.m_regs[reg];
-        sv.m_type = StackValue::BOOLEAN;
-        sv.m_value.b = true;
+        sv.SetBoolean(true);
 
-        break;
+        VM_NEXT();
     }
-    case LOAD_FALSE:
+    VM_CASE(LOAD_FALSE):
     {
-        uint8_t reg;
-        m_bs->Read(&reg);
+        uint8_t reg = ip->m_a;
 
         StackValue &sv = m_exec_thread.m_regs[reg];
-        sv.m_type = StackValue::BOOLEAN;
-        sv.m_value.b = false;
+        sv.SetBoolean(false);
 
-        break;
+        VM_NEXT();
     }
-    case MOV:
+    VM_CASE(MOV):
     {
-        uint16_t offset;
-        m_bs->Read(&offset);
+        uint16_t offset = ip->m_index;
+
+        uint8_t reg = ip->m_a;
 
-        uint8_t reg;
-        m_bs->Read(&reg);
+        VM_CHECK(offset != 0 && offset <= m_exec_thread.m_stack.GetStackPointer(),
+            "stack offset out of bounds");
 
         // copy value from register to stack value at (sp - offset)
         m_exec_thread.m_stack[m_exec_thread.m_stack.GetStackPointer() - offset] =
             m_exec_thread.m_regs[reg];
 
-        break;
+        VM_NEXT();
     }
-    case MOV_MEM:
+    VM_CASE(MOV_MEM):
     {
-        uint8_t dst;
-        m_bs->Read(&dst);
+        uint8_t dst = ip->m_a;
 
-        uint8_t idx;
-        m_bs->Read(&idx);
+        uint8_t idx = ip->m_b;
 
-        uint8_t src;
-        m_bs->Read(&src);
+        uint8_t src = ip->m_c;
 
         StackValue &sv = m_exec_thread.m_regs[dst];
-        assert(sv.m_type == StackValue::HEAP_POINTER && "destination must be a pointer");
+        if (sv.GetType() != StackValue::HEAP_POINTER) {
+            VM_THROW(Exception("not a standard object"));
+        }
 
-        HeapValue *hv = sv.m_value.ptr;
+        HeapValue *hv = sv.GetHeapPointer();
         if (hv == nullptr) {
             // null reference exception.
-            ThrowException(Exception("attempted to store a member to a null object"));
+            VM_THROW(Exception("attempted to store a member to a null object"));
         } else {
             Object *objptr = nullptr;
             if ((objptr = hv->GetPointer<Object>()) != nullptr) {
-                assert(idx < objptr->GetSize() && "member index out of bounds");
-                objptr->GetMember(idx) = m_exec_thread.m_regs[src];
+                if (idx >= objptr->GetSize()) {
+                    VM_THROW(Exception("member index out of bounds"));
+                }
+                StoreMember(hv, objptr->GetMember(idx), m_exec_thread.m_regs[src]);
             } else {
-                ThrowException(Exception("not a standard object"));
+                VM_THROW(Exception("not a standard object"));
             }
         }
 
-        break;
+        VM_NEXT();
     }
-    case PUSH:
+    VM_CASE(PUSH):
     {
-        uint8_t reg;
-        m_bs->Read(&reg);
+        uint8_t reg = ip->m_a;
+        Stack &stack = m_exec_thread.m_stack;
+
+        VM_CHECK(stack.GetStackPointer() < stack.GetLimit(), "stack overflow");
 
         // push a copy of the register value to the top of the stack
-        m_exec_thread.m_stack.Push(m_exec_thread.m_regs[reg]);
+        stack.Push(m_exec_thread.m_regs[reg]);
 
-        break;
+        VM_NEXT();
     }
-    case POP:
+    VM_CASE(POP):
     {
+        VM_CHECK(m_exec_thread.m_stack.GetStackPointer() > 0, "stack underflow");
+
         m_exec_thread.m_stack.Pop();
 
-        break;
+        VM_NEXT();
     }
-    case ECHO:
+    VM_CASE(ECHO):
     {
-        uint8_t reg;
-        m_bs->Read(&reg);
+        uint8_t reg = ip->m_a;
 
         // print out the value of the item in the register
         Echo(m_exec_thread.m_regs[reg]);
 
-        break;
+        VM_NEXT();
     }
-    case ECHO_NEWLINE:
+    VM_CASE(ECHO_NEWLINE):
     {
         utf::cout << "\n";
 
-        break;
+        VM_NEXT();
     }
-    case JMP:
+    VM_CASE(JMP):
     {
-        uint8_t reg;
-        m_bs->Read(&reg);
+        uint8_t reg = ip->m_a;
 
         const StackValue &addr = m_exec_thread.m_regs[reg];
-        assert(addr.m_type == StackValue::ADDRESS && "register must hold an address");
-
-        m_bs->Seek(addr.m_value.addr);
+        VM_CHECK(addr.GetType() == StackValue::ADDRESS, "register does not hold an address");
 
-        break;
+        VM_JUMP(addr.GetAddress());
     }
-    case JE:
+    VM_CASE(JE):
     {
-        uint8_t reg;
-        m_bs->Read(&reg);
+        uint8_t reg = ip->m_a;
 
         if (m_exec_thread.m_regs.m_flags == EQUAL) {
             const StackValue &addr = m_exec_thread.m_regs[reg];
-            assert(addr.m_type == StackValue::ADDRESS && "register must hold an address");
+            VM_CHECK(addr.GetType() == StackValue::ADDRESS, "register does not hold an address");
 
-            m_bs->Seek(addr.m_value.addr);
+            VM_JUMP(addr.GetAddress());
         }
 
-        break;
+        VM_NEXT();
     }
-    case JNE:
+    VM_CASE(JNE):
     {
-        uint8_t reg;
-        m_bs->Read(&reg);
+        uint8_t reg = ip->m_a;
 
         if (m_exec_thread.m_regs.m_flags != EQUAL) {
             const StackValue &addr = m_exec_thread.m_regs[reg];
-            assert(addr.m_type == StackValue::ADDRESS && "register must hold an address");
+            VM_CHECK(addr.GetType() == StackValue::ADDRESS, "register does not hold an address");
 
-            m_bs->Seek(addr.m_value.addr);
+            VM_JUMP(addr.GetAddress());
         }
 
-        break;
+        VM_NEXT();
     }
-    case JG:
+    VM_CASE(JG):
     {
-        uint8_t reg;
-        m_bs->Read(&reg);
+        uint8_t reg = ip->m_a;
 
         if (m_exec_thread.m_regs.m_flags == GREATER) {
             const StackValue &addr = m_exec_thread.m_regs[reg];
-            assert(addr.m_type == StackValue::ADDRESS && "register must hold an address");
+            VM_CHECK(addr.GetType() == StackValue::ADDRESS, "register does not hold an address");
 
-            m_bs->Seek(addr.m_value.addr);
+            VM_JUMP(addr.GetAddress());
         }
 
-        break;
+        VM_NEXT();
     }
-    case JGE:
+    VM_CASE(JGE):
     {
-        uint8_t reg;
-        m_bs->Read(&reg);
+        uint8_t reg = ip->m_a;
 
         if (m_exec_thread.m_regs.m_flags == GREATER || m_exec_thread.m_regs.m_flags == EQUAL) {
             const StackValue &addr = m_exec_thread.m_regs[reg];
-            assert(addr.m_type == StackValue::ADDRESS && "register must hold an address");
+            VM_CHECK(addr.GetType() == StackValue::ADDRESS, "register does not hold an address");
 
-            m_bs->Seek(addr.m_value.addr);
+            VM_JUMP(addr.GetAddress());
         }
 
-        break;
+        VM_NEXT();
     }
-    case CALL:
+    VM_CASE(CALL):
     {
-        uint8_t reg;
-        m_bs->Read(&reg);
+        uint8_t reg = ip->m_a;
 
-        uint8_t num_args;
-        m_bs->Read(&num_args);
+        uint8_t num_args = ip->m_b;
 
-        InvokeFunction(m_exec_thread.m_regs[reg], num_args);
+        StackValue &func = m_exec_thread.m_regs[reg];
 
-        break;
+        // the function returns to the instruction after this one
+        if (!PushFrame(func, num_args, (ip + 1) - instructions)) {
+            goto vm_unwind;
+        }
+
+        VM_ENTER(func.GetFunction().m_addr);
     }
-    case BEGIN_TRY:
+    VM_CASE(TAIL_CALL):
     {
-        // register that holds address of catch block
-        uint8_t reg;
-        m_bs->Read(&reg);
-
-        // copy the value of the address for the catch-block
-        StackValue addr(m_exec_thread.m_regs[reg]);
-        assert(addr.m_type == StackValue::ADDRESS && "register must hold an address");
+        uint8_t reg = ip->m_a;
 
-        int try_counter_before = m_exec_thread.m_exception_state.m_try_counter++;
-        // the size of the stack before, so we can revert to it on error
-        int sp_before = m_exec_thread.m_stack.GetStackPointer();
+        uint8_t num_args = ip->m_b;
 
-        while (HasNextInstruction() &&
-            m_exec_thread.m_exception_state.m_try_counter != try_counter_before) {
+        StackValue &func = m_exec_thread.m_regs[reg];
+        std::vector<Frame> &frames = m_exec_thread.m_frames;
 
-            // handle instructions until we reach the end of the block
-            uint8_t code;
-            m_bs->Read(&code, 1);
+        if (frames.empty()) {
+            // not inside of a function, so there is no frame to reuse.
+            // call it like any other function and return afterwards.
+            m_pc = (ip + 1) - instructions;
+            InvokeFunction(func, num_args);
+            if (m_exec_thread.m_exception_state.m_exception_occured) {
+                goto vm_unwind;
+            } else if (m_pc != (uint32_t)((ip + 1) - instructions)) {
+                // halted
+                ip = instructions + m_pc;
+                VM_DISPATCH();
+            }
+            VM_RETURN();
+        }
 
-            HandleInstruction(code);
+        if (func.GetType() != StackValue::FUNCTION || func.GetFunction().m_nargs != num_args) {
+            // let PushFrame() throw the same exceptions a CALL would
+            PushFrame(func, num_args, 0);
+            goto vm_unwind;
+        }
 
-            if (m_exec_thread.m_exception_state.m_exception_occured) {
-                // decrement the try counter
-                m_exec_thread.m_exception_state.m_try_counter--;
+        // move the arguments down over the current function's arguments,
+        // and keep its return address
+        Frame &frame = frames.back();
+        Stack &stack = m_exec_thread.m_stack;
 
-                // pop all local variables from the stack
-                while (sp_before < m_exec_thread.m_stack.GetStackPointer()) {
-                    m_exec_thread.m_stack.Pop();
-                }
+        VM_CHECK(stack.GetStackPointer() >= num_args, "stack underflow");
+        // the new function has to fit above the frame as well
+        if (frame.m_base + num_args + m_max_stack_depth > m_exec_thread.m_stack.GetLimit()) {
+            VM_THROW(Exception("stack overflow"));
+        }
 
-                // jump to the catch block
-                m_bs->Seek(addr.m_value.addr);
-                // reset the exception flag
-                m_exec_thread.m_exception_state.m_exception_occured = false;
+        // the function being replaced cannot catch anything anymore
+        PopHandlers(frames.size());
 
-                break;
-            }
+        size_t first_arg = stack.GetStackPointer() - num_args;
+        for (size_t i = 0; i < num_args; i++) {
+            stack[frame.m_base + i] = stack[first_arg + i];
         }
+        stack.SetStackPointer(frame.m_base + num_args);
+        frame.m_tail_called = true;
 
-        break;
+        VM_ENTER(func.GetFunction().m_addr);
     }
-    case END_TRY:
+    VM_CASE(BEGIN_TRY):
     {
-        m_exec_thread.m_exception_state.m_try_counter--;
-        break;
+        // register that holds address of catch block
+        uint8_t reg = ip->m_a;
+
+        const StackValue &addr = m_exec_thread.m_regs[reg];
+        VM_CHECK(addr.GetType() == StackValue::ADDRESS, "register does not hold an address");
+
+        // remember where to unwind to. the block itself
+        // runs like any other code.
+        TryHandler handler;
+        handler.m_catch_pc = addr.GetAddress();
+        handler.m_sp = m_exec_thread.m_stack.GetStackPointer();
+        handler.m_frame_depth = m_exec_thread.m_frames.size();
+
+        m_exec_thread.m_exception_state.m_handlers.push_back(handler);
+        m_exec_thread.m_exception_state.m_try_counter++;
+
+        VM_NEXT();
+    }
+    VM_CASE(END_TRY):
+    {
+        ExceptionState &state = m_exec_thread.m_exception_state;
+        if (!state.m_handlers.empty()) {
+            state.m_handlers.pop_back();
+        }
+        state.m_try_counter--;
+
+        VM_NEXT();
     }
-    case NEW:
+    VM_CASE(NEW):
     {
-        uint8_t reg;
-        m_bs->Read(&reg);
+        uint8_t reg = ip->m_a;
+
+        uint16_t index = ip->m_index;
 
-        uint16_t index;
-        m_bs->Read(&index);
+        VM_CHECK(index < m_static_memory.Size(), "static index out of bounds");
 
         // read value from static memory
         StackValue &type_sv = m_static_memory[index];
-        assert(type_sv.m_type == StackValue::TYPE_INFO && "object must be type info");
+        VM_CHECK(type_sv.GetType() == StackValue::TYPE_INFO, "static value is not a type");
 
         // get number of data members
-        int size = type_sv.m_value.type_info.m_size;
+        int size = type_sv.GetTypeInfo().m_size;
 
         // allocate heap object
-        HeapValue *hv = HeapAlloc();
-        if (hv != nullptr) {
-            hv->Assign(Object(size));
-
-            // assign register value to the allocated object
-            StackValue &sv = m_exec_thread.m_regs[reg];
-            sv.m_type = StackValue::HEAP_POINTER;
-            sv.m_value.ptr = hv;
+        HeapValue *hv = HeapAlloc(Object::SizeFor(size));
+        if (hv == nullptr) {
+            goto vm_unwind;
         }
+        hv->Emplace<Object>(size);
 
-        break;
+        // assign register value to the allocated object
+        StackValue &sv = m_exec_thread.m_regs[reg];
+        sv.SetHeapPointer(hv);
+
+        VM_NEXT();
     }
-    case CMP:
+    VM_CASE(CMP):
     {
-        uint8_t lhs_reg;
-        m_bs->Read(&lhs_reg);
+        uint8_t lhs_reg = ip->m_a;
 
-        uint8_t rhs_reg;
-        m_bs->Read(&rhs_reg);
+        uint8_t rhs_reg = ip->m_b;
 
         // load values from registers
         StackValue &lhs = m_exec_thread.m_regs[lhs_reg];
         StackValue &rhs = m_exec_thread.m_regs[rhs_reg];
 
+        ProfileSite(*ip, lhs, rhs);
+
         // COMPARE INTEGERS
         if (IS_VALUE_INTEGER(lhs) && IS_VALUE_INTEGER(rhs)) {
             int64_t left = GetValueInt64(lhs);
@@ -646,9 +1421,9 @@ void VM::HandleInstruction(uint8_t code)
                 m_exec_thread.m_regs.m_flags = NONE;
             }
         // COMPARE BOOLEANS
-        } else if (lhs.m_type == StackValue::BOOLEAN && rhs.m_type == StackValue::BOOLEAN) {
-            bool left = lhs.m_value.b;
-            bool right = rhs.m_value.b;
+        } else if (lhs.GetType() == StackValue::BOOLEAN && rhs.GetType() == StackValue::BOOLEAN) {
+            bool left = lhs.GetBoolean();
+            bool right = rhs.GetBoolean();
 
             if (left > right) {
                 // set GREATER flag
@@ -660,13 +1435,13 @@ void VM::HandleInstruction(uint8_t code)
                 // set NONE flag
                 m_exec_thread.m_regs.m_flags = NONE;
             }
-        } else if (lhs.m_type == StackValue::HEAP_POINTER) {
+        } else if (lhs.GetType() == StackValue::HEAP_POINTER) {
             COMPARE_REFERENCES(lhs, rhs);
-        } else if (rhs.m_type == StackValue::HEAP_POINTER) {
+        } else if (rhs.GetType() == StackValue::HEAP_POINTER) {
             COMPARE_REFERENCES(rhs, lhs);
-        } else if (lhs.m_type == StackValue::FUNCTION) {
+        } else if (lhs.GetType() == StackValue::FUNCTION) {
             COMPARE_FUNCTIONS(lhs, rhs);
-        } else if (rhs.m_type == StackValue::FUNCTION) {
+        } else if (rhs.GetType() == StackValue::FUNCTION) {
             COMPARE_FUNCTIONS(rhs, lhs);
         // COMPARE FLOATING POINT
         } else if (IS_VALUE_FLOATING_POINT(lhs)) {
@@ -677,12 +1452,11 @@ void VM::HandleInstruction(uint8_t code)
             THROW_COMPARISON_ERROR(lhs, rhs);
         }
 
-        break;
+        VM_NEXT_CHECKED();
     }
-    case CMPZ:
+    VM_CASE(CMPZ):
     {
-        uint8_t lhs_reg;
-        m_bs->Read(&lhs_reg);
+        uint8_t lhs_reg = ip->m_a;
 
         // load values from registers
         StackValue &lhs = m_exec_thread.m_regs[lhs_reg];
@@ -707,23 +1481,23 @@ void VM::HandleInstruction(uint8_t code)
                 // set NONE flag
                 m_exec_thread.m_regs.m_flags = NONE;
             }
-        } else if (lhs.m_type == StackValue::BOOLEAN) {
-            if (!lhs.m_value.b) {
+        } else if (lhs.GetType() == StackValue::BOOLEAN) {
+            if (!lhs.GetBoolean()) {
                 // set EQUAL flag
                 m_exec_thread.m_regs.m_flags = EQUAL;
             } else {
                 // set NONE flag
                 m_exec_thread.m_regs.m_flags = NONE;
             }
-        } else if (lhs.m_type == StackValue::HEAP_POINTER) {
-            if (lhs.m_value.ptr == nullptr) {
+        } else if (lhs.GetType() == StackValue::HEAP_POINTER) {
+            if (lhs.GetHeapPointer() == nullptr) {
                 // set EQUAL flag
                 m_exec_thread.m_regs.m_flags = EQUAL;
             } else {
                 // set NONE flag
                 m_exec_thread.m_regs.m_flags = NONE;
             }
-        } else if (lhs.m_type == StackValue::FUNCTION) {
+        } else if (lhs.GetType() == StackValue::FUNCTION) {
             // set NONE flag
             m_exec_thread.m_regs.m_flags = NONE;
         } else {
@@ -731,50 +1505,58 @@ void VM::HandleInstruction(uint8_t code)
             std::sprintf(buffer, "cannot determine if type '%s' is nonzero",
                 lhs.GetTypeString());
 
-            ThrowException(Exception(buffer));
+            VM_THROW(Exception(buffer));
         }
 
-        break;
+        VM_NEXT();
     }
-    case ADD:
+    VM_CASE(ADD):
     {
-        uint8_t lhs_reg;
-        m_bs->Read(&lhs_reg);
+        uint8_t lhs_reg = ip->m_a;
 
-        uint8_t rhs_reg;
-        m_bs->Read(&rhs_reg);
+        uint8_t rhs_reg = ip->m_b;
 
-        uint8_t dst_reg;
-        m_bs->Read(&dst_reg);
+        uint8_t dst_reg = ip->m_c;
 
         // load values from registers
         StackValue &lhs = m_exec_thread.m_regs[lhs_reg];
         StackValue &rhs = m_exec_thread.m_regs[rhs_reg];
 
+        ProfileSite(*ip, lhs, rhs);
+
         StackValue result;
-        result.m_type = MATCH_TYPES(lhs, rhs);
+        StackValue::Type result_type = MATCH_TYPES(lhs, rhs);
+
+        if (lhs.GetType() == StackValue::HEAP_POINTER) {
+            if (!AddStrings(lhs, rhs, result)) {
+                // TODO: Check for '__OPR_ADD__' function and call it
+                char buffer[256];
+                std::sprintf(buffer, "cannot add types '%s' and '%s'",
+                    lhs.GetTypeString(), rhs.GetTypeString());
 
-        if (lhs.m_type == StackValue::HEAP_POINTER) {
-            // TODO: Check for '__OPR_ADD__' function and call it
+                ThrowException(Exception(buffer));
+            }
         } else if (IS_VALUE_INTEGER(lhs) && IS_VALUE_INTEGER(rhs)) {
             int64_t left = GetValueInt64(lhs);
             int64_t right = GetValueInt64(rhs);
             int64_t result_value = left + right;
 
-            if (result.m_type == StackValue::INT32) {
-                result.m_value.i32 = (int32_t)result_value;
+            if (result_type == StackValue::INT32) {
+                result.SetInt32((int32_t)result_value);
+            } else if (!StackValue::Int64Fits(result_value)) {
+                ThrowException(Exception("int64 result out of range"));
             } else {
-                result.m_value.i64 = result_value;
+                result.SetInt64(result_value);
             }
         } else if (IS_VALUE_FLOATING_POINT(lhs) || IS_VALUE_FLOATING_POINT(rhs)) {
             double left = GetValueDouble(lhs);
             double right = GetValueDouble(rhs);
             double result_value = left + right;
 
-            if (result.m_type == StackValue::FLOAT) {
-                result.m_value.f = (float)result_value;
+            if (result_type == StackValue::FLOAT) {
+                result.SetFloat((float)result_value);
             } else {
-                result.m_value.d = result_value;
+                result.SetDouble(result_value);
             }
         } else {
             char buffer[256];
@@ -787,47 +1569,48 @@ void VM::HandleInstruction(uint8_t code)
         // set the desination register to be the result
         m_exec_thread.m_regs[dst_reg] = result;
 
-        break;
+        VM_NEXT_CHECKED();
     }
-    case SUB:
+    VM_CASE(SUB):
     {
-        uint8_t lhs_reg;
-        m_bs->Read(&lhs_reg);
+        uint8_t lhs_reg = ip->m_a;
 
-        uint8_t rhs_reg;
-        m_bs->Read(&rhs_reg);
+        uint8_t rhs_reg = ip->m_b;
 
-        uint8_t dst_reg;
-        m_bs->Read(&dst_reg);
+        uint8_t dst_reg = ip->m_c;
 
         // load values from registers
         StackValue &lhs = m_exec_thread.m_regs[lhs_reg];
         StackValue &rhs = m_exec_thread.m_regs[rhs_reg];
 
+        ProfileSite(*ip, lhs, rhs);
+
         StackValue result;
-        result.m_type = MATCH_TYPES(lhs, rhs);
+        StackValue::Type result_type = MATCH_TYPES(lhs, rhs);
 
-        if (lhs.m_type == StackValue::HEAP_POINTER) {
+        if (lhs.GetType() == StackValue::HEAP_POINTER) {
             // TODO: Check for '__OPR_SUB__' function and call it
         } else if (IS_VALUE_INTEGER(lhs) && IS_VALUE_INTEGER(rhs)) {
             int64_t left = GetValueInt64(lhs);
             int64_t right = GetValueInt64(rhs);
             int64_t result_value = left - right;
 
-            if (result.m_type == StackValue::INT32) {
-                result.m_value.i32 = (int32_t)result_value;
+            if (result_type == StackValue::INT32) {
+                result.SetInt32((int32_t)result_value);
+            } else if (!StackValue::Int64Fits(result_value)) {
+                ThrowException(Exception("int64 result out of range"));
             } else {
-                result.m_value.i64 = result_value;
+                result.SetInt64(result_value);
             }
         } else if (IS_VALUE_FLOATING_POINT(lhs) || IS_VALUE_FLOATING_POINT(rhs)) {
             double left = GetValueDouble(lhs);
             double right = GetValueDouble(rhs);
             double result_value = left - right;
 
-            if (result.m_type == StackValue::FLOAT) {
-                result.m_value.f = (float)result_value;
+            if (result_type == StackValue::FLOAT) {
+                result.SetFloat((float)result_value);
             } else {
-                result.m_value.d = result_value;
+                result.SetDouble(result_value);
             }
         } else {
             char buffer[256];
@@ -840,47 +1623,48 @@ void VM::HandleInstruction(uint8_t code)
         // set the desination register to be the result
         m_exec_thread.m_regs[dst_reg] = result;
 
-        break;
+        VM_NEXT_CHECKED();
     }
-    case MUL:
+    VM_CASE(MUL):
     {
-        uint8_t lhs_reg;
-        m_bs->Read(&lhs_reg);
+        uint8_t lhs_reg = ip->m_a;
 
-        uint8_t rhs_reg;
-        m_bs->Read(&rhs_reg);
+        uint8_t rhs_reg = ip->m_b;
 
-        uint8_t dst_reg;
-        m_bs->Read(&dst_reg);
+        uint8_t dst_reg = ip->m_c;
 
         // load values from registers
         StackValue &lhs = m_exec_thread.m_regs[lhs_reg];
         StackValue &rhs = m_exec_thread.m_regs[rhs_reg];
 
+        ProfileSite(*ip, lhs, rhs);
+
         StackValue result;
-        result.m_type = MATCH_TYPES(lhs, rhs);
+        StackValue::Type result_type = MATCH_TYPES(lhs, rhs);
 
-        if (lhs.m_type == StackValue::HEAP_POINTER) {
+        if (lhs.GetType() == StackValue::HEAP_POINTER) {
             // TODO: Check for '__OPR_MUL__' function and call it
         } else if (IS_VALUE_INTEGER(lhs) && IS_VALUE_INTEGER(rhs)) {
             int64_t left = GetValueInt64(lhs);
             int64_t right = GetValueInt64(rhs);
             int64_t result_value = left * right;
 
-            if (result.m_type == StackValue::INT32) {
-                result.m_value.i32 = (int32_t)result_value;
+            if (result_type == StackValue::INT32) {
+                result.SetInt32((int32_t)result_value);
+            } else if (!StackValue::Int64Fits(result_value)) {
+                ThrowException(Exception("int64 result out of range"));
             } else {
-                result.m_value.i64 = result_value;
+                result.SetInt64(result_value);
             }
         } else if (IS_VALUE_FLOATING_POINT(lhs) || IS_VALUE_FLOATING_POINT(rhs)) {
             double left = GetValueDouble(lhs);
             double right = GetValueDouble(rhs);
             double result_value = left * right;
 
-            if (result.m_type == StackValue::FLOAT) {
-                result.m_value.f = (float)result_value;
+            if (result_type == StackValue::FLOAT) {
+                result.SetFloat((float)result_value);
             } else {
-                result.m_value.d = result_value;
+                result.SetDouble(result_value);
             }
         } else {
             char buffer[256];
@@ -893,27 +1677,26 @@ void VM::HandleInstruction(uint8_t code)
         // set the desination register to be the result
         m_exec_thread.m_regs[dst_reg] = result;
 
-        break;
+        VM_NEXT_CHECKED();
     }
-    case DIV:
+    VM_CASE(DIV):
     {
-        uint8_t lhs_reg;
-        m_bs->Read(&lhs_reg);
+        uint8_t lhs_reg = ip->m_a;
 
-        uint8_t rhs_reg;
-        m_bs->Read(&rhs_reg);
+        uint8_t rhs_reg = ip->m_b;
 
-        uint8_t dst_reg;
-        m_bs->Read(&dst_reg);
+        uint8_t dst_reg = ip->m_c;
 
         // load values from registers
         StackValue &lhs = m_exec_thread.m_regs[lhs_reg];
         StackValue &rhs = m_exec_thread.m_regs[rhs_reg];
 
+        ProfileSite(*ip, lhs, rhs);
+
         StackValue result;
-        result.m_type = MATCH_TYPES(lhs, rhs);
+        StackValue::Type result_type = MATCH_TYPES(lhs, rhs);
 
-        if (lhs.m_type == StackValue::HEAP_POINTER) {
+        if (lhs.GetType() == StackValue::HEAP_POINTER) {
             // TODO: Check for '__OPR_DIV__' function and call it
         } else if (IS_VALUE_INTEGER(lhs) && IS_VALUE_INTEGER(rhs)) {
             int64_t left = GetValueInt64(lhs);
@@ -927,10 +1710,12 @@ void VM::HandleInstruction(uint8_t code)
             } else {
                 int64_t result_value = left / right;
 
-                if (result.m_type == StackValue::INT32) {
-                    result.m_value.i32 = (int32_t)result_value;
+                if (result_type == StackValue::INT32) {
+                    result.SetInt32((int32_t)result_value);
+                } else if (!StackValue::Int64Fits(result_value)) {
+                    ThrowException(Exception("int64 result out of range"));
                 } else {
-                    result.m_value.i64 = result_value;
+                    result.SetInt64(result_value);
                 }
             }
         } else if (IS_VALUE_FLOATING_POINT(lhs) || IS_VALUE_FLOATING_POINT(rhs)) {
@@ -945,10 +1730,10 @@ void VM::HandleInstruction(uint8_t code)
             } else {
                 double result_value = left / right;
 
-                if (result.m_type == StackValue::FLOAT) {
-                    result.m_value.f = (float)result_value;
+                if (result_type == StackValue::FLOAT) {
+                    result.SetFloat((float)result_value);
                 } else {
-                    result.m_value.d = result_value;
+                    result.SetDouble(result_value);
                 }
             }
         } else {
@@ -962,23 +1747,98 @@ void VM::HandleInstruction(uint8_t code)
         // set the desination register to be the result
         m_exec_thread.m_regs[dst_reg] = result;
 
-        break;
+        VM_NEXT_CHECKED();
     }
-    default:
+    VM_CASE(ADD_I32_I32): VM_QUICK_ARITHMETIC(StackValue::INT32, Int32, int64_t, +, false);
+    VM_CASE(ADD_I64_I64): VM_QUICK_ARITHMETIC(StackValue::INT64, Int64, int64_t, +, false);
+    VM_CASE(ADD_F64_F64): VM_QUICK_ARITHMETIC(StackValue::DOUBLE, Double, double, +, false);
+    VM_CASE(SUB_I32_I32): VM_QUICK_ARITHMETIC(StackValue::INT32, Int32, int64_t, -, false);
+    VM_CASE(SUB_I64_I64): VM_QUICK_ARITHMETIC(StackValue::INT64, Int64, int64_t, -, false);
+    VM_CASE(SUB_F64_F64): VM_QUICK_ARITHMETIC(StackValue::DOUBLE, Double, double, -, false);
+    VM_CASE(MUL_I32_I32): VM_QUICK_ARITHMETIC(StackValue::INT32, Int32, int64_t, *, false);
+    VM_CASE(MUL_I64_I64): VM_QUICK_ARITHMETIC(StackValue::INT64, Int64, int64_t, *, false);
+    VM_CASE(MUL_F64_F64): VM_QUICK_ARITHMETIC(StackValue::DOUBLE, Double, double, *, false);
+    VM_CASE(DIV_I32_I32): VM_QUICK_ARITHMETIC(StackValue::INT32, Int32, int64_t, /, true);
+    VM_CASE(DIV_I64_I64): VM_QUICK_ARITHMETIC(StackValue::INT64, Int64, int64_t, /, true);
+    VM_CASE(DIV_F64_F64): VM_QUICK_ARITHMETIC(StackValue::DOUBLE, Double, double, /, true);
+    VM_CASE(CMP_I32_I32): VM_QUICK_COMPARE(StackValue::INT32, Int32);
+    VM_CASE(CMP_I64_I64): VM_QUICK_COMPARE(StackValue::INT64, Int64);
+    VM_CASE(CMP_F64_F64): VM_QUICK_COMPARE(StackValue::DOUBLE, Double);
+    VM_CASE(RET):
+    {
+        VM_RETURN();
+    }
+    VM_CASE(EXIT):
+    {
+        // stay on the EXIT, so that any enclosing Run() halts as well
+        m_pc = ip - instructions;
+        return RUN_HALTED;
+    }
+    VM_DEFAULT:
+    {
         std::printf("unknown instruction '%d' referenced at location: 0x%08x\n",
-            (int)code, (int)m_bs->Position());
+            (int)ip->m_a, (int)ip->m_index);
 
-        // seek to end of bytecode stream
-        m_bs->Seek(m_bs->Size());
+        // jump to the EXIT at the end of the program
+        m_pc = m_program->Size() - 1;
+        return RUN_HALTED;
     }
-}
+#ifndef ACEVM_COMPUTED_GOTO
+    }
+#endif
 
-void VM::Execute()
-{
-    while (HasNextInstruction()) {
-        uint8_t code;
-        m_bs->Read(&code, 1);
+vm_unwind:
+    {
+        // an exception was thrown. continue at the innermost catch block,
+        // unless it was entered outside of this Run(), or there is none.
+        ExceptionState &state = m_exec_thread.m_exception_state;
+        if (state.m_try_counter > 0 && !state.m_handlers.empty() &&
+            state.m_handlers.back().m_frame_depth >= base_depth) {
+            TryHandler handler = state.m_handlers.back();
+            state.m_handlers.pop_back();
+            state.m_try_counter--;
+
+            // pop all local variables from the stack
+            while (handler.m_sp < m_exec_thread.m_stack.GetStackPointer()) {
+                m_exec_thread.m_stack.Pop();
+            }
+            m_exec_thread.m_frames.resize(handler.m_frame_depth);
+
+            // reset the exception flag
+            state.m_exception_occured = false;
+
+            // jump to the catch block
+            ip = instructions + handler.m_catch_pc;
+            VM_DISPATCH();
+        }
 
-        HandleInstruction(code);
+        if (state.m_try_counter > 0) {
+            // an enclosing Run() catches it
+            m_pc = ip - instructions;
+        }
+        return RUN_EXCEPTION;
     }
+
+#undef VM_CASE
+#undef VM_DEFAULT
+#undef VM_DISPATCH
+#undef VM_NEXT
+#undef VM_NEXT_CHECKED
+#undef VM_THROW
+#undef VM_CHECK
+#undef VM_JUMP
+#undef VM_ENTER
+#undef VM_RETURN
+#undef VM_QUICK_ARITHMETIC
+#undef VM_QUICK_COMPARE
+}
+
+void VM::Execute(uint32_t entry_pc)
+{
+    m_pc = entry_pc;
+    m_exec_thread.m_frames.clear();
+    m_exec_thread.m_exception_state.m_handlers.clear();
+    m_exec_thread.m_exception_state.m_try_counter = 0;
+    m_exec_thread.m_exception_state.m_exception_occured = false;
+    Run();
 }
@@ -0,0 +1,97 @@
+#include <acevm_opt/optimizer.hpp>
+
+#include <acevm/bytecode_file.hpp>
+#include <acevm/bytecode_stream.hpp>
+#include <acevm/decoder.hpp>
+#include <acevm/encoder.hpp>
+#include <acevm/program.hpp>
+
+#include <common/utf8.hpp>
+
+#include <fstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+/** check if the option is set */
+inline bool has_option(char **begin, char **end, const std::string &opt)
+{
+    return std::find(begin, end, opt) != end;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 3) {
+        utf::cout << "\tUsage: " << argv[0] << " <input file> <output file> [--stats] [--v2]\n";
+        return 1;
+    }
+
+    utf::Utf8String filename(argv[1]);
+    utf::Utf8String out_filename(argv[2]);
+
+    // load bytecode from file. strings in the decoded program point into it.
+    BytecodeFile file;
+    if (!file.Open(filename.GetData())) {
+        utf::cout << "Could not open file " << filename << "\n";
+        return 1;
+    }
+
+    size_t bytecode_size = file.GetSize();
+    BytecodeStream bytecode_stream(file.GetData(), bytecode_size);
+
+    Program program;
+    Decoder decoder(&bytecode_stream);
+    if (!decoder.Decode(program)) {
+        utf::cout << "Could not load file " << filename << ": "
+            << decoder.GetError().c_str() << "\n";
+        return 1;
+    }
+
+    Program optimized;
+    Optimizer optimizer(&program);
+    if (!optimizer.Optimize(optimized)) {
+        utf::cout << "Could not optimize file " << filename << ": "
+            << optimizer.GetError().c_str() << "\n";
+        return 1;
+    }
+
+    // the output is a flat program, like the input,
+    // unless a version 2 container is asked for
+    std::vector<char> out;
+    Encoder encoder(&optimized);
+    bool encoded = has_option(argv, argv + argc, "--v2")
+        ? encoder.EncodeContainer(out)
+        : encoder.Encode(out);
+    if (!encoded) {
+        utf::cout << "Could not encode the optimized program\n";
+        return 1;
+    }
+
+    std::ofstream out_file(out_filename.GetData(), std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!out_file.is_open()) {
+        utf::cout << "Could not open file " << out_filename << "\n";
+        return 1;
+    }
+    out_file.write(out.data(), out.size());
+    out_file.close();
+
+    if (has_option(argv, argv + argc, "--stats")) {
+        const OptimizerStats &stats = optimizer.GetStats();
+
+        // neither count includes the EXIT that ends every program
+        utf::cout << "instructions:      " << (int)program.Size() - 1
+            << " -> " << (int)optimized.Size() - 1 << "\n";
+        utf::cout << "bytes:             " << (int)bytecode_size
+            << " -> " << (int)out.size() << "\n";
+        utf::cout << "constants folded:  " << (int)stats.m_folded_constants << "\n";
+        utf::cout << "branches folded:   " << (int)stats.m_folded_branches << "\n";
+        utf::cout << "jumps threaded:    " << (int)stats.m_threaded_jumps << "\n";
+        utf::cout << "redundant loads:   " << (int)stats.m_redundant_loads << "\n";
+        utf::cout << "dead stores:       " << (int)stats.m_dead_stores << "\n";
+        utf::cout << "dead instructions: " << (int)stats.m_dead_instructions << "\n";
+        utf::cout << "peephole:          " << (int)stats.m_peephole << "\n";
+        utf::cout << "rounds:            " << (int)stats.m_rounds << "\n";
+    }
+
+    return 0;
+}
@@ -0,0 +1,975 @@
+#include <acevm_opt/optimizer.hpp>
+
+#include <acevm/instructions.hpp>
+#include <acevm/stack_value.hpp>
+#include <acevm/vm.hpp>
+
+#include <algorithm>
+
+#define REG_BIT(reg) ((RegisterSet)(1 << (reg)))
+
+// the value of a register when it is known at compile time
+struct ConstantValue {
+    int m_type; // a StackValue type, or -1 if unknown
+
+    union {
+        int32_t i32;
+        int64_t i64;
+        float f;
+        double d;
+        bool b;
+    } m_value;
+
+    inline bool IsInteger() const
+    {
+        return m_type == StackValue::INT32 || m_type == StackValue::INT64;
+    }
+
+    inline bool IsFloatingPoint() const
+    {
+        return m_type == StackValue::FLOAT || m_type == StackValue::DOUBLE;
+    }
+
+    inline int64_t GetInt64() const
+    {
+        return m_type == StackValue::INT32 ? (int64_t)m_value.i32 : m_value.i64;
+    }
+
+    inline double GetDouble() const
+    {
+        switch (m_type) {
+        case StackValue::INT32:
+            return (double)m_value.i32;
+        case StackValue::INT64:
+            return (double)m_value.i64;
+        case StackValue::FLOAT:
+            return (double)m_value.f;
+        default:
+            return m_value.d;
+        }
+    }
+};
+
+static ConstantValue UnknownValue()
+{
+    ConstantValue value;
+    value.m_type = -1;
+    value.m_value.i64 = 0;
+    return value;
+}
+
+/** Evaluate ADD, SUB, MUL or DIV the way the VM does. Returns false
+    when the result is not known, or the instruction would throw. */
+static bool EvaluateArithmetic(uint8_t opcode, const ConstantValue &lhs,
+    const ConstantValue &rhs, ConstantValue &result)
+{
+    // same as MATCH_TYPES in the VM
+    result.m_type = lhs.m_type < rhs.m_type ? rhs.m_type : lhs.m_type;
+
+    if (lhs.IsInteger() && rhs.IsInteger()) {
+        int64_t left = lhs.GetInt64();
+        int64_t right = rhs.GetInt64();
+        int64_t value;
+
+        switch (opcode) {
+        case ADD:
+            value = (int64_t)((uint64_t)left + (uint64_t)right);
+            break;
+        case SUB:
+            value = (int64_t)((uint64_t)left - (uint64_t)right);
+            break;
+        case MUL:
+            value = (int64_t)((uint64_t)left * (uint64_t)right);
+            break;
+        default:
+            if (right == 0 || (right == -1 && left == INT64_MIN)) {
+                return false;
+            }
+            value = left / right;
+            break;
+        }
+
+        if (result.m_type == StackValue::INT32) {
+            result.m_value.i32 = (int32_t)value;
+        } else {
+            result.m_value.i64 = value;
+        }
+
+        return true;
+    }
+
+    bool numeric = (lhs.IsInteger() || lhs.IsFloatingPoint()) &&
+        (rhs.IsInteger() || rhs.IsFloatingPoint());
+    if (!numeric) {
+        return false;
+    }
+
+    double left = lhs.GetDouble();
+    double right = rhs.GetDouble();
+    double value;
+
+    switch (opcode) {
+    case ADD:
+        value = left + right;
+        break;
+    case SUB:
+        value = left - right;
+        break;
+    case MUL:
+        value = left * right;
+        break;
+    default:
+        if (right == 0.0) {
+            return false;
+        }
+        value = left / right;
+        break;
+    }
+
+    if (result.m_type == StackValue::FLOAT) {
+        result.m_value.f = (float)value;
+    } else {
+        result.m_value.d = value;
+    }
+
+    return true;
+}
+
+/** Evaluate CMP the way the VM does, returns the flags or -1. */
+static int EvaluateCompare(const ConstantValue &lhs, const ConstantValue &rhs)
+{
+    if (lhs.IsInteger() && rhs.IsInteger()) {
+        int64_t left = lhs.GetInt64();
+        int64_t right = rhs.GetInt64();
+        return left > right ? GREATER : (left == right ? EQUAL : NONE);
+    } else if (lhs.m_type == StackValue::BOOLEAN && rhs.m_type == StackValue::BOOLEAN) {
+        bool left = lhs.m_value.b;
+        bool right = rhs.m_value.b;
+        return left > right ? GREATER : (left == right ? EQUAL : NONE);
+    }
+
+    // the VM puts the floating point operand on the left
+    const ConstantValue *first = &lhs;
+    const ConstantValue *second = &rhs;
+    if (!lhs.IsFloatingPoint()) {
+        std::swap(first, second);
+    }
+
+    if (first->IsFloatingPoint() && (second->IsFloatingPoint() || second->IsInteger())) {
+        double left = first->GetDouble();
+        double right = second->GetDouble();
+        return left > right ? GREATER : (left == right ? EQUAL : NONE);
+    }
+
+    return -1;
+}
+
+/** Evaluate CMPZ the way the VM does, returns the flags or -1. */
+static int EvaluateCompareZero(const ConstantValue &value)
+{
+    if (value.IsInteger()) {
+        return value.GetInt64() == 0 ? EQUAL : NONE;
+    } else if (value.IsFloatingPoint()) {
+        return value.GetDouble() == 0.0 ? EQUAL : NONE;
+    } else if (value.m_type == StackValue::BOOLEAN) {
+        return !value.m_value.b ? EQUAL : NONE;
+    }
+    return -1;
+}
+
+static bool IsJumpTaken(uint8_t opcode, int flags)
+{
+    switch (opcode) {
+    case JE:
+        return flags == EQUAL;
+    case JNE:
+        return flags != EQUAL;
+    case JG:
+        return flags == GREATER;
+    case JGE:
+        return flags == GREATER || flags == EQUAL;
+    default:
+        return true;
+    }
+}
+
+Optimizer::Optimizer(const Program *program)
+    : m_header_size(0)
+{
+    for (size_t pc = 0; pc < program->Size(); pc++) {
+        m_code.push_back((*program)[pc]);
+    }
+    m_removed.assign(m_code.size(), false);
+}
+
+bool Optimizer::IsJump(uint8_t opcode)
+{
+    return opcode == JMP || opcode == JE || opcode == JNE ||
+        opcode == JG || opcode == JGE;
+}
+
+bool Optimizer::IsTerminator(uint8_t opcode)
+{
+    return opcode == JMP || opcode == RET || opcode == EXIT || opcode == TAIL_CALL;
+}
+
+bool Optimizer::CanThrow(uint8_t opcode)
+{
+    switch (opcode) {
+    case LOAD_MEM:
+    case MOV_MEM:
+    case CALL:
+    case TAIL_CALL:
+    case NEW:
+    case CMP:
+    case CMPZ:
+    case ADD:
+    case SUB:
+    case MUL:
+    case DIV:
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool Optimizer::IsPureLoad(uint8_t opcode)
+{
+    switch (opcode) {
+    case LOAD_I32:
+    case LOAD_I64:
+    case LOAD_F32:
+    case LOAD_F64:
+    case LOAD_LOCAL:
+    case LOAD_STATIC:
+    case LOAD_NULL:
+    case LOAD_TRUE:
+    case LOAD_FALSE:
+        return true;
+    default:
+        return false;
+    }
+}
+
+RegisterSet Optimizer::Uses(const Instruction &ins)
+{
+    switch (ins.m_opcode) {
+    case MOV:
+    case PUSH:
+    case ECHO:
+    case JMP:
+    case BEGIN_TRY:
+    case CMPZ:
+        return REG_BIT(ins.m_a & 7);
+    case JE:
+    case JNE:
+    case JG:
+    case JGE:
+        return REG_BIT(ins.m_a & 7) | REG_BIT(OPT_FLAGS_REG);
+    case LOAD_MEM:
+        return REG_BIT(ins.m_b & 7);
+    case MOV_MEM:
+        return REG_BIT(ins.m_a & 7) | REG_BIT(ins.m_c & 7);
+    case CMP:
+    case ADD:
+    case SUB:
+    case MUL:
+    case DIV:
+        return REG_BIT(ins.m_a & 7) | REG_BIT(ins.m_b & 7);
+    case CALL:
+    case TAIL_CALL:
+    case RET:
+        // the callee and the caller may read any register
+        return OPT_ALL_REGS;
+    default:
+        return 0;
+    }
+}
+
+RegisterSet Optimizer::Defs(const Instruction &ins)
+{
+    switch (ins.m_opcode) {
+    case LOAD_I32:
+    case LOAD_I64:
+    case LOAD_F32:
+    case LOAD_F64:
+    case LOAD_LOCAL:
+    case LOAD_STATIC:
+    case LOAD_MEM:
+    case LOAD_NULL:
+    case LOAD_TRUE:
+    case LOAD_FALSE:
+    case NEW:
+        return REG_BIT(ins.m_a & 7);
+    case ADD:
+    case SUB:
+    case MUL:
+    case DIV:
+        return REG_BIT(ins.m_c & 7);
+    case CMP:
+    case CMPZ:
+        return REG_BIT(OPT_FLAGS_REG);
+    default:
+        return 0;
+    }
+}
+
+bool Optimizer::ReadStaticSlots()
+{
+    m_slots.clear();
+    m_header_size = 0;
+
+    // the header is where static memory is filled in
+    bool in_header = true;
+
+    for (size_t pc = 0; pc < m_code.size(); pc++) {
+        const Instruction &ins = m_code[pc];
+
+        switch (ins.m_opcode) {
+        case STORE_STATIC_STRING:
+        case STORE_STATIC_ADDRESS:
+        case STORE_STATIC_FUNCTION:
+        case STORE_STATIC_TYPE:
+        {
+            if (!in_header) {
+                m_error = "static memory is written outside of the program header";
+                return false;
+            }
+
+            StaticSlot slot;
+            slot.m_opcode = ins.m_opcode;
+            slot.m_addr = ins.m_imm.addr;
+            m_slots.push_back(slot);
+            break;
+        }
+        case NOP:
+            break;
+        case BAD_INSTRUCTION:
+            m_error = "program contains an unknown instruction";
+            return false;
+        default:
+            in_header = false;
+            break;
+        }
+
+        if (in_header) {
+            m_header_size = pc + 1;
+        }
+    }
+
+    for (const StaticSlot &slot : m_slots) {
+        if (slot.m_opcode == STORE_STATIC_ADDRESS || slot.m_opcode == STORE_STATIC_FUNCTION) {
+            if (slot.m_addr < m_header_size) {
+                m_error = "an address refers to the program header";
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+int64_t Optimizer::SlotAddress(uint32_t index) const
+{
+    if (index < m_slots.size() && m_slots[index].m_opcode == STORE_STATIC_ADDRESS) {
+        return m_slots[index].m_addr;
+    }
+    return -1;
+}
+
+void Optimizer::BuildCfg()
+{
+    size_t n = m_code.size();
+
+    // every address in static memory may be jumped to or called
+    std::vector<bool> is_leader(n + 1, false);
+    is_leader[0] = true;
+    for (const StaticSlot &slot : m_slots) {
+        if ((slot.m_opcode == STORE_STATIC_ADDRESS || slot.m_opcode == STORE_STATIC_FUNCTION) &&
+            slot.m_addr < n) {
+            is_leader[slot.m_addr] = true;
+        }
+    }
+    for (size_t pc = 0; pc < n; pc++) {
+        if (IsJump(m_code[pc].m_opcode) || IsTerminator(m_code[pc].m_opcode)) {
+            is_leader[pc + 1] = true;
+        }
+    }
+
+    m_blocks.clear();
+    m_block_of.assign(n, 0);
+
+    for (size_t pc = 0; pc < n; pc++) {
+        if (is_leader[pc]) {
+            Block block = Block();
+            block.m_begin = pc;
+            m_blocks.push_back(block);
+        }
+        m_blocks.back().m_end = pc + 1;
+        m_block_of[pc] = m_blocks.size() - 1;
+    }
+
+    // resolve the targets of jumps and try blocks
+    m_targets.assign(n, -1);
+    m_target_loads.assign(n, -1);
+
+    bool any_unresolved = false;
+    bool any_unresolved_catch = false;
+    std::vector<uint32_t> catch_targets;
+
+    for (const Block &block : m_blocks) {
+        int64_t known[8];
+        int64_t loader[8];
+        std::fill(known, known + 8, -1);
+        std::fill(loader, loader + 8, -1);
+
+        for (uint32_t pc = block.m_begin; pc < block.m_end; pc++) {
+            const Instruction &ins = m_code[pc];
+
+            if (IsJump(ins.m_opcode) || ins.m_opcode == BEGIN_TRY) {
+                m_targets[pc] = known[ins.m_a & 7];
+                m_target_loads[pc] = loader[ins.m_a & 7];
+
+                if (m_targets[pc] == -1) {
+                    if (ins.m_opcode == BEGIN_TRY) {
+                        any_unresolved_catch = true;
+                    } else {
+                        any_unresolved = true;
+                    }
+                } else if (ins.m_opcode == BEGIN_TRY) {
+                    catch_targets.push_back(m_targets[pc]);
+                }
+            }
+
+            if (ins.m_opcode == CALL || ins.m_opcode == TAIL_CALL) {
+                std::fill(known, known + 8, -1);
+                std::fill(loader, loader + 8, -1);
+            }
+
+            RegisterSet defs = Defs(ins);
+            for (int reg = 0; reg < 8; reg++) {
+                if (defs & REG_BIT(reg)) {
+                    known[reg] = -1;
+                    loader[reg] = -1;
+                }
+            }
+
+            if (ins.m_opcode == LOAD_STATIC) {
+                known[ins.m_a & 7] = SlotAddress(ins.m_index);
+                loader[ins.m_a & 7] = pc;
+            }
+        }
+    }
+
+    // blocks that can be reached without a known jump
+    std::vector<uint32_t> address_blocks;
+    for (const StaticSlot &slot : m_slots) {
+        if (slot.m_opcode == STORE_STATIC_ADDRESS && slot.m_addr < n) {
+            address_blocks.push_back(m_block_of[slot.m_addr]);
+        }
+    }
+
+    m_roots.clear();
+    m_roots.push_back(0);
+    for (const StaticSlot &slot : m_slots) {
+        if (slot.m_opcode == STORE_STATIC_FUNCTION && slot.m_addr < n) {
+            m_roots.push_back(m_block_of[slot.m_addr]);
+        }
+    }
+
+    m_handlers.clear();
+    if (any_unresolved_catch) {
+        m_handlers = address_blocks;
+    } else {
+        for (uint32_t target : catch_targets) {
+            if (target < n) {
+                m_handlers.push_back(m_block_of[target]);
+            }
+        }
+    }
+    m_roots.insert(m_roots.end(), m_handlers.begin(), m_handlers.end());
+
+    if (any_unresolved) {
+        m_roots.insert(m_roots.end(), address_blocks.begin(), address_blocks.end());
+    }
+
+    // successors
+    for (size_t i = 0; i < m_blocks.size(); i++) {
+        Block &block = m_blocks[i];
+        uint32_t last = block.m_end - 1;
+        uint8_t opcode = m_code[last].m_opcode;
+
+        if (!IsTerminator(opcode) && block.m_end < n) {
+            block.m_succs.push_back(i + 1);
+        }
+
+        if (IsJump(opcode)) {
+            if (m_targets[last] != -1 && m_targets[last] < (int64_t)n) {
+                block.m_succs.push_back(m_block_of[m_targets[last]]);
+            } else if (m_targets[last] == -1) {
+                block.m_succs.insert(block.m_succs.end(), address_blocks.begin(), address_blocks.end());
+            }
+        }
+    }
+
+    // reachability
+    std::vector<uint32_t> worklist(m_roots);
+    while (!worklist.empty()) {
+        uint32_t index = worklist.back();
+        worklist.pop_back();
+
+        if (m_blocks[index].m_reachable) {
+            continue;
+        }
+        m_blocks[index].m_reachable = true;
+
+        for (uint32_t succ : m_blocks[index].m_succs) {
+            worklist.push_back(succ);
+        }
+    }
+}
+
+RegisterSet Optimizer::HandlerLiveness() const
+{
+    RegisterSet live = 0;
+    for (uint32_t index : m_handlers) {
+        live |= m_blocks[index].m_live_in;
+    }
+    return live;
+}
+
+void Optimizer::ComputeLiveness()
+{
+    m_live_out.assign(m_code.size(), 0);
+
+    bool changed = true;
+    while (changed) {
+        changed = false;
+
+        // an instruction that throws may continue at any handler
+        RegisterSet handler_live = HandlerLiveness();
+
+        for (size_t i = m_blocks.size(); i-- > 0;) {
+            Block &block = m_blocks[i];
+
+            RegisterSet live = 0;
+            for (uint32_t succ : block.m_succs) {
+                live |= m_blocks[succ].m_live_in;
+            }
+
+            for (uint32_t pc = block.m_end; pc-- > block.m_begin;) {
+                const Instruction &ins = m_code[pc];
+
+                if (CanThrow(ins.m_opcode)) {
+                    live |= handler_live;
+                }
+                m_live_out[pc] = live;
+
+                live = (live & ~Defs(ins)) | Uses(ins);
+            }
+
+            if (live != block.m_live_in) {
+                block.m_live_in = live;
+                changed = true;
+            }
+        }
+    }
+}
+
+bool Optimizer::FoldConstants()
+{
+    bool changed = false;
+
+    for (const Block &block : m_blocks) {
+        ConstantValue regs[8];
+        std::fill(regs, regs + 8, UnknownValue());
+        int flags = -1;
+
+        for (uint32_t pc = block.m_begin; pc < block.m_end; pc++) {
+            Instruction &ins = m_code[pc];
+            ConstantValue value = UnknownValue();
+
+            switch (ins.m_opcode) {
+            case LOAD_I32:
+                value.m_type = StackValue::INT32;
+                value.m_value.i32 = ins.m_imm.i32;
+                break;
+            case LOAD_I64:
+                value.m_type = StackValue::INT64;
+                value.m_value.i64 = ins.m_imm.i64;
+                break;
+            case LOAD_F32:
+                value.m_type = StackValue::FLOAT;
+                value.m_value.f = ins.m_imm.f;
+                break;
+            case LOAD_F64:
+                value.m_type = StackValue::DOUBLE;
+                value.m_value.d = ins.m_imm.d;
+                break;
+            case LOAD_TRUE:
+            case LOAD_FALSE:
+                value.m_type = StackValue::BOOLEAN;
+                value.m_value.b = ins.m_opcode == LOAD_TRUE;
+                break;
+            case ADD:
+            case SUB:
+            case MUL:
+            case DIV:
+            {
+                ConstantValue result;
+                if (!EvaluateArithmetic(ins.m_opcode, regs[ins.m_a & 7], regs[ins.m_b & 7], result)) {
+                    break;
+                }
+
+                value = result;
+
+                // replace with a load of the result
+                Instruction load = Instruction();
+                load.m_a = ins.m_c;
+                switch (result.m_type) {
+                case StackValue::INT32:
+                    load.m_opcode = LOAD_I32;
+                    load.m_imm.i32 = result.m_value.i32;
+                    break;
+                case StackValue::INT64:
+                    load.m_opcode = LOAD_I64;
+                    load.m_imm.i64 = result.m_value.i64;
+                    break;
+                case StackValue::FLOAT:
+                    load.m_opcode = LOAD_F32;
+                    load.m_imm.f = result.m_value.f;
+                    break;
+                default:
+                    load.m_opcode = LOAD_F64;
+                    load.m_imm.d = result.m_value.d;
+                    break;
+                }
+                ins = load;
+
+                m_stats.m_folded_constants++;
+                changed = true;
+                break;
+            }
+            case CMP:
+                flags = EvaluateCompare(regs[ins.m_a & 7], regs[ins.m_b & 7]);
+                break;
+            case CMPZ:
+                flags = EvaluateCompareZero(regs[ins.m_a & 7]);
+                break;
+            case JE:
+            case JNE:
+            case JG:
+            case JGE:
+                if (flags != -1) {
+                    if (IsJumpTaken(ins.m_opcode, flags)) {
+                        ins.m_opcode = JMP;
+                    } else {
+                        m_removed[pc] = true;
+                    }
+
+                    m_stats.m_folded_branches++;
+                    changed = true;
+                }
+                break;
+            case CALL:
+                std::fill(regs, regs + 8, UnknownValue());
+                flags = -1;
+                break;
+            default:
+                break;
+            }
+
+            // the result of a folded instruction is in value,
+            // anything else that is written to is unknown
+            RegisterSet defs = Defs(ins);
+            for (int reg = 0; reg < 8; reg++) {
+                if (defs & REG_BIT(reg)) {
+                    regs[reg] = value;
+                }
+            }
+        }
+    }
+
+    return changed;
+}
+
+bool Optimizer::ThreadJumps()
+{
+    bool changed = false;
+    size_t n = m_code.size();
+
+    for (uint32_t pc = 0; pc < n; pc++) {
+        const Instruction &ins = m_code[pc];
+        if (!IsJump(ins.m_opcode) || m_targets[pc] == -1 || m_target_loads[pc] == -1) {
+            continue;
+        }
+
+        uint32_t target = m_targets[pc];
+        uint32_t loader = m_target_loads[pc];
+        uint8_t reg = ins.m_a & 7;
+
+        // the target must be a jump through a freshly loaded address
+        if (target + 1 >= n ||
+            m_code[target].m_opcode != LOAD_STATIC ||
+            m_code[target + 1].m_opcode != JMP ||
+            (m_code[target + 1].m_a & 7) != (m_code[target].m_a & 7)) {
+            continue;
+        }
+
+        uint32_t slot = m_code[target].m_index;
+        int64_t next_target = SlotAddress(slot);
+        if (next_target == -1 || next_target == target || next_target >= (int64_t)n) {
+            continue;
+        }
+
+        // the address loaded for this jump must not be used for anything else
+        if (m_live_out[pc] & REG_BIT(reg)) {
+            continue;
+        }
+
+        bool used_between = false;
+        for (uint32_t i = loader + 1; i < pc; i++) {
+            if (Uses(m_code[i]) & REG_BIT(reg)) {
+                used_between = true;
+                break;
+            }
+        }
+        if (used_between) {
+            continue;
+        }
+
+        // skipping the target also skips its write to the address register
+        uint8_t target_reg = m_code[target].m_a & 7;
+        if (target_reg != reg &&
+            (m_blocks[m_block_of[next_target]].m_live_in & REG_BIT(target_reg))) {
+            continue;
+        }
+
+        m_code[loader].m_index = slot;
+        m_targets[pc] = next_target;
+
+        m_stats.m_threaded_jumps++;
+        changed = true;
+    }
+
+    return changed;
+}
+
+bool Optimizer::RemoveRedundantLoads()
+{
+    bool changed = false;
+
+    // -2 means nothing is known yet, -1 that the register holds no slot
+    for (Block &block : m_blocks) {
+        std::fill(block.m_avail_in, block.m_avail_in + 8, -2);
+        block.m_visited = false;
+    }
+    for (uint32_t index : m_roots) {
+        std::fill(m_blocks[index].m_avail_in, m_blocks[index].m_avail_in + 8, -1);
+    }
+
+    auto transfer = [this](uint32_t pc, int32_t *avail) {
+        const Instruction &ins = m_code[pc];
+        if (ins.m_opcode == CALL) {
+            std::fill(avail, avail + 8, -1);
+        }
+
+        RegisterSet defs = Defs(ins);
+        for (int reg = 0; reg < 8; reg++) {
+            if (defs & REG_BIT(reg)) {
+                avail[reg] = -1;
+            }
+        }
+
+        if (ins.m_opcode == LOAD_STATIC) {
+            avail[ins.m_a & 7] = ins.m_index;
+        }
+    };
+
+    bool iterate = true;
+    while (iterate) {
+        iterate = false;
+
+        for (Block &block : m_blocks) {
+            if (!block.m_reachable || block.m_avail_in[0] == -2) {
+                continue;
+            }
+            block.m_visited = true;
+
+            int32_t avail[8];
+            std::copy(block.m_avail_in, block.m_avail_in + 8, avail);
+            for (uint32_t pc = block.m_begin; pc < block.m_end; pc++) {
+                transfer(pc, avail);
+            }
+
+            for (uint32_t succ : block.m_succs) {
+                Block &next = m_blocks[succ];
+                for (int reg = 0; reg < 8; reg++) {
+                    int32_t merged = next.m_avail_in[reg] == -2 ? avail[reg] :
+                        (next.m_avail_in[reg] == avail[reg] ? avail[reg] : -1);
+                    if (merged != next.m_avail_in[reg]) {
+                        next.m_avail_in[reg] = merged;
+                        iterate = true;
+                    }
+                }
+            }
+        }
+    }
+
+    for (Block &block : m_blocks) {
+        if (!block.m_visited) {
+            continue;
+        }
+
+        int32_t avail[8];
+        std::copy(block.m_avail_in, block.m_avail_in + 8, avail);
+
+        for (uint32_t pc = block.m_begin; pc < block.m_end; pc++) {
+            const Instruction &ins = m_code[pc];
+            if (ins.m_opcode == LOAD_STATIC && avail[ins.m_a & 7] == (int32_t)ins.m_index) {
+                m_removed[pc] = true;
+                m_stats.m_redundant_loads++;
+                changed = true;
+            }
+            transfer(pc, avail);
+        }
+    }
+
+    return changed;
+}
+
+bool Optimizer::RemoveDeadStores()
+{
+    bool changed = false;
+
+    for (size_t pc = 0; pc < m_code.size(); pc++) {
+        const Instruction &ins = m_code[pc];
+        if (IsPureLoad(ins.m_opcode) && !(m_live_out[pc] & REG_BIT(ins.m_a & 7))) {
+            m_removed[pc] = true;
+            m_stats.m_dead_stores++;
+            changed = true;
+        }
+    }
+
+    return changed;
+}
+
+bool Optimizer::Peephole()
+{
+    bool changed = false;
+    size_t n = m_code.size();
+
+    for (uint32_t pc = 0; pc < n; pc++) {
+        const Instruction &ins = m_code[pc];
+
+        if (ins.m_opcode == NOP) {
+            m_removed[pc] = true;
+            m_stats.m_peephole++;
+            changed = true;
+        } else if (ins.m_opcode == PUSH && pc + 1 < n && m_code[pc + 1].m_opcode == POP &&
+            m_blocks[m_block_of[pc + 1]].m_begin != pc + 1) {
+            // a value that is popped right away is never read
+            m_removed[pc] = true;
+            m_removed[pc + 1] = true;
+            m_stats.m_peephole += 2;
+            changed = true;
+            pc++;
+        } else if (IsJump(ins.m_opcode) && m_targets[pc] == pc + 1) {
+            // jumps to the next instruction go there either way
+            m_removed[pc] = true;
+            m_stats.m_peephole++;
+            changed = true;
+        }
+    }
+
+    return changed;
+}
+
+bool Optimizer::RemoveDeadCode()
+{
+    bool changed = false;
+
+    for (const Block &block : m_blocks) {
+        if (block.m_reachable) {
+            continue;
+        }
+
+        for (uint32_t pc = block.m_begin; pc < block.m_end; pc++) {
+            // the EXIT at the end of the program stays
+            if (pc != m_code.size() - 1 && !m_removed[pc]) {
+                m_removed[pc] = true;
+                m_stats.m_dead_instructions++;
+                changed = true;
+            }
+        }
+    }
+
+    return changed;
+}
+
+void Optimizer::Compact()
+{
+    // addresses of removed instructions continue at the next one
+    std::vector<uint32_t> new_index(m_code.size());
+    std::vector<Instruction> code;
+
+    for (size_t pc = 0; pc < m_code.size(); pc++) {
+        new_index[pc] = code.size();
+        if (!m_removed[pc]) {
+            code.push_back(m_code[pc]);
+        }
+    }
+
+    for (Instruction &ins : code) {
+        if (ins.m_opcode == STORE_STATIC_ADDRESS || ins.m_opcode == STORE_STATIC_FUNCTION) {
+            if (ins.m_imm.addr < new_index.size()) {
+                ins.m_imm.addr = new_index[ins.m_imm.addr];
+            }
+        }
+    }
+
+    m_code.swap(code);
+    m_removed.assign(m_code.size(), false);
+
+    ReadStaticSlots();
+}
+
+bool Optimizer::Optimize(Program &out)
+{
+    if (m_code.empty() || !ReadStaticSlots()) {
+        return false;
+    }
+
+    typedef bool (Optimizer::*Pass)();
+    static const Pass passes[] = {
+        &Optimizer::FoldConstants,
+        &Optimizer::ThreadJumps,
+        &Optimizer::RemoveRedundantLoads,
+        &Optimizer::RemoveDeadStores,
+        &Optimizer::Peephole,
+        &Optimizer::RemoveDeadCode,
+    };
+
+    bool changed = true;
+    while (changed && m_stats.m_rounds < OPT_MAX_ROUNDS) {
+        changed = false;
+        m_stats.m_rounds++;
+
+        for (Pass pass : passes) {
+            BuildCfg();
+            ComputeLiveness();
+
+            if ((this->*pass)()) {
+                Compact();
+                changed = true;
+            }
+        }
+    }
+
+    out.Clear();
+    for (const Instruction &ins : m_code) {
+        out.Append(ins);
+    }
+
+    return true;
+}
@@ -1,8 +1,26 @@
 #include <common/utf8.hpp>
 
+#include <algorithm>
+#include <utility>
+
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(ACEVM_NO_SIMD)
+#include <immintrin.h>
+#endif
+
 namespace utf {
 
-int utf8_strlen(const char *str)
+/** Number of bytes in the character that starts with c, as the
+    scalar kernels read it, or 0 if c cannot start a character. */
+static inline int utf8_width(unsigned char c)
+{
+    if (c <= 127) return 1;
+    if ((c & 0xE0) == 0xC0) return 2;
+    if ((c & 0xF0) == 0xE0) return 3;
+    if ((c & 0xF8) == 0xF0) return 4;
+    return 0;
+}
+
+static int utf8_strlen_scalar(const char *str)
 {
     int max = std::strlen(str);
     int count = 0;
@@ -27,7 +45,7 @@ int utf32_strlen(const u32char *str)
     return counter;
 }
 
-int utf8_strcmp(const char *s1, const char *s2)
+static int utf8_strcmp_scalar(const char *s1, const char *s2)
 {
     for (; *s1 || *s2;) {
         unsigned char c;
@@ -256,7 +274,7 @@ void utf8to32(const char *src, u32char *dst, int size)
     }
 }
 
-u32char utf8_charat(const char *str, int index)
+static u32char utf8_charat_scalar(const char *str, int index)
 {
     int max = std::strlen(str);
     int count = 0;
@@ -299,78 +317,571 @@ u32char utf8_charat(const char *str, int index)
     return -1;
 }
 
+// SSE2 is part of every x86-64 CPU. AVX2 is only used when the CPU
+// reports it, the functions that use it are compiled for it on their own.
+// define ACEVM_NO_SIMD to only build the scalar kernels.
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(ACEVM_NO_SIMD)
+#define UTF8_SIMD
+#endif
+
+#ifdef UTF8_SIMD
+
+// the vector kernels count characters as the bytes that are not
+// continuation bytes. that only matches the scalar kernels when every
+// lead byte is followed by exactly the continuation bytes it announces,
+// which is checked block by block. anything else is left to them.
+
+/** __builtin_popcount() is a library call without -mpopcnt. */
+static inline int CountBits(uint32_t bits)
+{
+    bits = bits - ((bits >> 1) & 0x55555555u);
+    bits = (bits & 0x33333333u) + ((bits >> 2) & 0x33333333u);
+    bits = (bits + (bits >> 4)) & 0x0F0F0F0Fu;
+    return (bits * 0x01010101u) >> 24;
+}
+
+/** Fold one 16-byte block into the check, and return a bit for
+    each byte that starts a character. lead2 .. lead4 carry the
+    lead bytes of the previous block. */
+static inline int Sse2Block(__m128i cur, __m128i &lead2, __m128i &lead3, __m128i &lead4, __m128i &error)
+{
+    const __m128i negative = _mm_cmplt_epi8(cur, _mm_setzero_si128());
+    // 0x80 .. 0xbf
+    const __m128i is_cont = _mm_cmplt_epi8(cur, _mm_set1_epi8(-64));
+    // 0xc0 and up, 0xe0 and up, 0xf0 and up
+    const __m128i cur2 = _mm_andnot_si128(is_cont, negative);
+    const __m128i cur3 = _mm_and_si128(_mm_cmpgt_epi8(cur, _mm_set1_epi8(-33)), negative);
+    const __m128i cur4 = _mm_and_si128(_mm_cmpgt_epi8(cur, _mm_set1_epi8(-17)), negative);
+    // 0xf8 and up never start a character
+    const __m128i invalid = _mm_and_si128(_mm_cmpgt_epi8(cur, _mm_set1_epi8(-9)), negative);
+
+    // a byte has to be a continuation byte if a lead byte up to three
+    // bytes before it says so, and may not be one otherwise
+    __m128i must_cont = _mm_or_si128(_mm_slli_si128(cur2, 1), _mm_srli_si128(lead2, 15));
+    must_cont = _mm_or_si128(must_cont, _mm_or_si128(_mm_slli_si128(cur3, 2), _mm_srli_si128(lead3, 14)));
+    must_cont = _mm_or_si128(must_cont, _mm_or_si128(_mm_slli_si128(cur4, 3), _mm_srli_si128(lead4, 13)));
+
+    error = _mm_or_si128(error, _mm_or_si128(_mm_xor_si128(must_cont, is_cont), invalid));
+    lead2 = cur2;
+    lead3 = cur3;
+    lead4 = cur4;
+
+    return ~_mm_movemask_epi8(is_cont) & 0xFFFF;
+}
+
+/** Find the byte offset of character index among the first size bytes
+    of str, or size if there are not that many. With index < 0, all of
+    them are counted instead. Returns false if str has to be left to
+    the scalar kernels. */
+static bool Sse2Scan(const char *str, size_t size, int index, size_t &offset, int &count)
+{
+    __m128i lead2 = _mm_setzero_si128();
+    __m128i lead3 = _mm_setzero_si128();
+    __m128i lead4 = _mm_setzero_si128();
+    __m128i error = _mm_setzero_si128();
+    // high bits of the previous block
+    int last = 0;
+    int n = 0;
+
+    for (size_t i = 0; i <= size; i += 16) {
+        __m128i cur;
+        int valid = 0xFFFF;
+        if (i + 16 <= size) {
+            cur = _mm_loadu_si128(reinterpret_cast<const __m128i*>(str + i));
+        } else {
+            // the last block is padded with NUL bytes. a character that
+            // runs into them is an error, like one that runs into the NUL.
+            char tail[16] = { 0 };
+            std::memcpy(tail, str + i, size - i);
+            cur = _mm_loadu_si128(reinterpret_cast<const __m128i*>(tail));
+            valid = (1 << (size - i)) - 1;
+        }
+
+        int high = _mm_movemask_epi8(cur);
+        int starts;
+        int block_count;
+
+        if (high == 0 && (last & 0xE000) == 0) {
+            // all ASCII, and nothing left over from the previous block
+            starts = valid;
+            block_count = valid == 0xFFFF ? 16 : (int)(size - i);
+            lead2 = lead3 = lead4 = _mm_setzero_si128();
+        } else {
+            starts = Sse2Block(cur, lead2, lead3, lead4, error) & valid;
+            block_count = CountBits(starts);
+        }
+        last = high;
+
+        if (index >= 0 && index < n + block_count) {
+            if (_mm_movemask_epi8(error) != 0) {
+                return false;
+            }
+            // drop the characters before it
+            for (int skip = index - n; skip > 0; skip--) {
+                starts &= starts - 1;
+            }
+            offset = i + __builtin_ctz(starts);
+            return true;
+        }
+        n += block_count;
+    }
+
+    if (_mm_movemask_epi8(error) != 0) {
+        return false;
+    }
+    offset = size;
+    count = n;
+    return true;
+}
+
+/** Reads may go past the end of a string, but never past its page. */
+#define UTF8_READS_PAST_END __attribute__((no_sanitize_address))
+
+/** Find the first byte where s1 and s2 differ, or where both end. */
+UTF8_READS_PAST_END
+static size_t Sse2Mismatch(const char *s1, const char *s2)
+{
+    size_t i = 0;
+    for (;;) {
+        // the strings may end anywhere, so a block is never
+        // read across a page that might not be mapped
+        if (((uintptr_t)(s1 + i) & 4095) > 4096 - 16 || ((uintptr_t)(s2 + i) & 4095) > 4096 - 16) {
+            if (s1[i] != s2[i] || s1[i] == '\0') {
+                return i;
+            }
+            i++;
+            continue;
+        }
+
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s1 + i));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s2 + i));
+        int mask = (_mm_movemask_epi8(_mm_cmpeq_epi8(a, b)) ^ 0xFFFF) |
+            _mm_movemask_epi8(_mm_cmpeq_epi8(a, _mm_setzero_si128()));
+
+        if (mask != 0) {
+            return i + __builtin_ctz(mask);
+        }
+        i += 16;
+    }
+}
+
+/** Byte shift of the lead bytes from cur into the next k bytes, carrying
+    in the end of prev. AVX2 shifts each 128-bit lane on its own. */
+#define AVX2_SHIFT_IN(cur, prev, k) \
+    _mm256_alignr_epi8((cur), _mm256_permute2x128_si256((prev), (cur), 0x21), 16 - (k))
+
+__attribute__((target("avx2")))
+static inline int Avx2Block(__m256i cur, __m256i &lead2, __m256i &lead3, __m256i &lead4, __m256i &error)
+{
+    const __m256i negative = _mm256_cmpgt_epi8(_mm256_setzero_si256(), cur);
+    const __m256i is_cont = _mm256_cmpgt_epi8(_mm256_set1_epi8(-64), cur);
+    const __m256i cur2 = _mm256_andnot_si256(is_cont, negative);
+    const __m256i cur3 = _mm256_and_si256(_mm256_cmpgt_epi8(cur, _mm256_set1_epi8(-33)), negative);
+    const __m256i cur4 = _mm256_and_si256(_mm256_cmpgt_epi8(cur, _mm256_set1_epi8(-17)), negative);
+    const __m256i invalid = _mm256_and_si256(_mm256_cmpgt_epi8(cur, _mm256_set1_epi8(-9)), negative);
+
+    __m256i must_cont = AVX2_SHIFT_IN(cur2, lead2, 1);
+    must_cont = _mm256_or_si256(must_cont, AVX2_SHIFT_IN(cur3, lead3, 2));
+    must_cont = _mm256_or_si256(must_cont, AVX2_SHIFT_IN(cur4, lead4, 3));
+
+    error = _mm256_or_si256(error, _mm256_or_si256(_mm256_xor_si256(must_cont, is_cont), invalid));
+    lead2 = cur2;
+    lead3 = cur3;
+    lead4 = cur4;
+
+    return ~_mm256_movemask_epi8(is_cont);
+}
+
+/** Sse2Scan() with 32-byte blocks. */
+__attribute__((target("avx2")))
+static bool Avx2Scan(const char *str, size_t size, int index, size_t &offset, int &count)
+{
+    __m256i lead2 = _mm256_setzero_si256();
+    __m256i lead3 = _mm256_setzero_si256();
+    __m256i lead4 = _mm256_setzero_si256();
+    __m256i error = _mm256_setzero_si256();
+    uint32_t last = 0;
+    int n = 0;
+
+    for (size_t i = 0; i <= size; i += 32) {
+        __m256i cur;
+        uint32_t valid = 0xFFFFFFFFu;
+        if (i + 32 <= size) {
+            cur = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(str + i));
+        } else {
+            char tail[32] = { 0 };
+            std::memcpy(tail, str + i, size - i);
+            cur = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(tail));
+            valid = (1u << (size - i)) - 1;
+        }
+
+        uint32_t high = _mm256_movemask_epi8(cur);
+        uint32_t starts;
+        int block_count;
+
+        if (high == 0 && (last & 0xE0000000u) == 0) {
+            starts = valid;
+            block_count = valid == 0xFFFFFFFFu ? 32 : (int)(size - i);
+            lead2 = lead3 = lead4 = _mm256_setzero_si256();
+        } else {
+            starts = Avx2Block(cur, lead2, lead3, lead4, error) & valid;
+            block_count = CountBits(starts);
+        }
+        last = high;
+
+        if (index >= 0 && index < n + block_count) {
+            if (!_mm256_testz_si256(error, error)) {
+                return false;
+            }
+            for (int skip = index - n; skip > 0; skip--) {
+                starts &= starts - 1;
+            }
+            offset = i + __builtin_ctz(starts);
+            return true;
+        }
+        n += block_count;
+    }
+
+    if (!_mm256_testz_si256(error, error)) {
+        return false;
+    }
+    offset = size;
+    count = n;
+    return true;
+}
+
+/** Sse2Mismatch() with 32-byte blocks. */
+__attribute__((target("avx2"))) UTF8_READS_PAST_END
+static size_t Avx2Mismatch(const char *s1, const char *s2)
+{
+    size_t i = 0;
+    for (;;) {
+        if (((uintptr_t)(s1 + i) & 4095) > 4096 - 32 || ((uintptr_t)(s2 + i) & 4095) > 4096 - 32) {
+            if (s1[i] != s2[i] || s1[i] == '\0') {
+                return i;
+            }
+            i++;
+            continue;
+        }
+
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s1 + i));
+        __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s2 + i));
+        uint32_t mask = ~(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(a, b)) |
+            (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(a, _mm256_setzero_si256()));
+
+        if (mask != 0) {
+            return i + __builtin_ctz(mask);
+        }
+        i += 32;
+    }
+}
+
+#undef AVX2_SHIFT_IN
+#undef UTF8_READS_PAST_END
+
+#endif
+
+static Utf8Kernels DetectKernels()
+{
+#ifdef UTF8_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return UTF8_KERNELS_AVX2;
+    }
+    return UTF8_KERNELS_SSE2;
+#else
+    return UTF8_KERNELS_SCALAR;
+#endif
+}
+
+// picked the first time a kernel runs. every thread
+// that races to do it stores the same value.
+static int g_kernels = -1;
+
+static inline Utf8Kernels CurrentKernels()
+{
+    if (g_kernels < 0) {
+        g_kernels = DetectKernels();
+    }
+    return (Utf8Kernels)g_kernels;
+}
+
+Utf8Kernels utf8_get_kernels()
+{
+    return CurrentKernels();
+}
+
+void utf8_set_kernels(Utf8Kernels kernels)
+{
+    g_kernels = std::min(kernels, DetectKernels());
+}
+
+#ifdef UTF8_SIMD
+/** Whether str starts with a character whose lead byte is followed
+    by the continuation bytes it announces. */
+static inline bool Utf8WholeChar(const char *str)
+{
+    int width = utf8_width((unsigned char)str[0]);
+    if (width == 0) {
+        return false;
+    }
+    for (int i = 1; i < width; i++) {
+        if (((unsigned char)str[i] & 0xC0) != 0x80) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/** Run the scan that the current kernels use. */
+static inline bool SimdScan(Utf8Kernels kernels, const char *str, size_t size, int index,
+    size_t &offset, int &count)
+{
+    if (kernels == UTF8_KERNELS_AVX2) {
+        return Avx2Scan(str, size, index, offset, count);
+    }
+    return Sse2Scan(str, size, index, offset, count);
+}
+#endif
+
+int utf8_strlen(const char *str)
+{
+#ifdef UTF8_SIMD
+    Utf8Kernels kernels = CurrentKernels();
+    if (kernels != UTF8_KERNELS_SCALAR) {
+        size_t offset;
+        int count;
+        if (SimdScan(kernels, str, std::strlen(str), -1, offset, count)) {
+            return count;
+        }
+    }
+#endif
+    return utf8_strlen_scalar(str);
+}
+
+int utf8_strcmp(const char *s1, const char *s2)
+{
+#ifdef UTF8_SIMD
+    Utf8Kernels kernels = CurrentKernels();
+    if (kernels != UTF8_KERNELS_SCALAR) {
+        size_t at = kernels == UTF8_KERNELS_AVX2 ? Avx2Mismatch(s1, s2) : Sse2Mismatch(s1, s2);
+        if (s1[at] == s2[at]) {
+            // both ended
+            return 0;
+        }
+
+        // everything before is equal, so the characters that differ start
+        // at the same byte: the last lead byte before at that reaches it
+        size_t start = at;
+        for (size_t back = 1; back <= 3 && back <= at; back++) {
+            unsigned char c = (unsigned char)s1[at - back];
+            if ((c & 0xC0) != 0x80) {
+                if (utf8_width(c) > (int)back) {
+                    start = at - back;
+                }
+                break;
+            }
+        }
+
+        // that only holds if the bytes before are whole characters, and
+        // the ones that differ are as well. otherwise the scalar kernel
+        // groups the bytes its own way, from the start.
+        size_t offset;
+        int count;
+        if (SimdScan(kernels, s1, start, -1, offset, count) &&
+            Utf8WholeChar(s1 + start) && Utf8WholeChar(s2 + start)) {
+            return utf8_strcmp_scalar(s1 + start, s2 + start);
+        }
+    }
+#endif
+    return utf8_strcmp_scalar(s1, s2);
+}
+
+u32char utf8_charat(const char *str, int index)
+{
+#ifdef UTF8_SIMD
+    Utf8Kernels kernels = CurrentKernels();
+    if (kernels != UTF8_KERNELS_SCALAR && index >= 0) {
+        size_t size = std::strlen(str);
+        size_t offset;
+        int count;
+        if (SimdScan(kernels, str, size, index, offset, count)) {
+            return offset < size ? utf8_charat_scalar(str + offset, 0) : (u32char)-1;
+        }
+    }
+#endif
+    return utf8_charat_scalar(str, index);
+}
+
 void utf8_charat(const char *str, char *dst, int index)
 {
     char32to8(utf8_charat(str, index), dst);
 }
 
 Utf8String::Utf8String()
-    : m_data(new char[1]),
-      m_size(1),
-      m_length(0)
+    : m_data(m_inline),
+      m_size(inline_size),
+      m_num_bytes(0),
+      m_length(0),
+      m_hash(0),
+      m_hashed(false),
+      m_breadcrumbs(nullptr),
+      m_borrowed(false)
 {
     m_data[0] = '\0';
 }
 
 Utf8String::Utf8String(size_t size)
-    : m_data(new char[size + 1]),
-      m_size(size + 1),
-      m_length(0)
+    : Utf8String()
 {
+    Reserve(size, false);
     std::memset(m_data, 0, m_size);
 }
 
 Utf8String::Utf8String(const char *str)
+    : Utf8String()
 {
-    if (str == nullptr) {
-        m_data = new char[1];
-        m_data[0] = '\0';
-        m_size = 1;
-        m_length = 0;
-    } else {
-        // copy raw bytes
-        m_size = std::strlen(str) + 1;
-        m_data = new char[m_size];
-        std::strcpy(m_data, str);
-        // recalculate length
-        m_length = utf8_strlen(m_data);
+    if (str != nullptr) {
+        Assign(str, std::strlen(str), (size_t)-1);
     }
 }
 
+Utf8String::Utf8String(const char *str, size_t size)
+    : Utf8String()
+{
+    Assign(str, size, (size_t)-1);
+}
+
 Utf8String::Utf8String(const Utf8String &other)
+    : Utf8String()
+{
+    operator=(other);
+}
+
+Utf8String::Utf8String(Utf8String &&other)
+    : Utf8String()
+{
+    operator=(std::move(other));
+}
+
+Utf8String::Utf8String(char *data, size_t size, size_t length, bool borrowed)
+    : m_data(data),
+      m_size(size),
+      m_num_bytes(size - 1),
+      m_length(length),
+      m_hash(0),
+      m_hashed(false),
+      m_breadcrumbs(nullptr),
+      m_borrowed(borrowed)
 {
-    // copy raw bytes
-    m_size = std::strlen(other.m_data) + 1;
-    m_data = new char[m_size];
-    std::strcpy(m_data, other.m_data);
-    m_length = other.m_length;
 }
 
 Utf8String::~Utf8String()
 {
-    if (m_data != nullptr) {
+    if (!m_borrowed && m_data != m_inline) {
         delete[] m_data;
     }
+    delete[] m_breadcrumbs;
 }
 
-Utf8String &Utf8String::operator=(const char *str)
+Utf8String Utf8String::Borrow(const char *str, size_t size)
+{
+    // the length is only counted once, copies keep it
+    return Utf8String(const_cast<char*>(str), size + 1, utf8_strlen(str), true);
+}
+
+uint32_t Utf8String::Hash(const char *data, size_t size)
+{
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= (uint8_t)data[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+void Utf8String::Reserve(size_t size, bool keep)
 {
-    if (m_data != nullptr) {
+    if (!m_borrowed && size < m_size) {
+        return;
+    }
+
+    char *data = m_inline;
+    size_t buffer_size = inline_size;
+    if (size >= inline_size) {
+        // grow geometrically, so that appending in a loop is linear
+        buffer_size = std::max(size + 1, m_borrowed ? 0 : m_size * 2);
+        data = new char[buffer_size];
+    }
+
+    if (keep && data != m_data) {
+        std::memcpy(data, m_data, m_num_bytes + 1);
+    }
+
+    if (!m_borrowed && m_data != m_inline && m_data != data) {
         delete[] m_data;
     }
 
+    m_data = data;
+    m_size = buffer_size;
+    m_borrowed = false;
+}
+
+void Utf8String::Release()
+{
+    if (!m_borrowed && m_data != m_inline) {
+        delete[] m_data;
+    }
+
+    m_data = m_inline;
+    m_size = inline_size;
+    m_borrowed = false;
+}
+
+void Utf8String::Assign(const char *str, size_t size, size_t length)
+{
+    Reserve(size, false);
+
+    // str may be part of this string
+    std::memmove(m_data, str, size);
+    m_data[size] = '\0';
+    m_num_bytes = size;
+    // counted unless it is known already
+    m_length = length != (size_t)-1 ? length : utf8_strlen(m_data);
+    Changed();
+}
+
+void Utf8String::Append(const char *str, size_t size, size_t length)
+{
+    Reserve(m_num_bytes + size, true);
+
+    std::memcpy(m_data + m_num_bytes, str, size);
+    m_num_bytes += size;
+    m_data[m_num_bytes] = '\0';
+
+    // once either side is not valid UTF-8, the length stays unknown
+    if (m_length != (size_t)-1) {
+        if (length == (size_t)-1) {
+            length = utf8_strlen(m_data + m_num_bytes - size);
+        }
+        m_length = length != (size_t)-1 ? m_length + length : (size_t)-1;
+    }
+    Changed();
+}
+
+void Utf8String::Changed()
+{
+    m_hashed = false;
+    delete[] m_breadcrumbs;
+    m_breadcrumbs = nullptr;
+}
+
+Utf8String &Utf8String::operator=(const char *str)
+{
     if (str == nullptr) {
-        m_data = new char[1];
-        m_data[0] = '\0';
-        m_size = 1;
-        m_length = 0;
+        Assign("", 0, 0);
     } else {
-        // copy raw bytes
-        m_size = std::strlen(str) + 1;
-        m_data = new char[m_size];
-        std::strcpy(m_data, str);
-        // recalculate length
-        m_length = utf8_strlen(m_data);
+        Assign(str, std::strlen(str), (size_t)-1);
     }
 
     return *this;
@@ -378,85 +889,158 @@ Utf8String &Utf8String::operator=(const char *str)
 
 Utf8String &Utf8String::operator=(const Utf8String &other)
 {
-    if (m_data != nullptr) {
-        delete[] m_data;
+    if (&other == this) {
+        return *this;
     }
 
-    // copy raw bytes
-    m_size = std::strlen(other.m_data) + 1;
-    m_data = new char[m_size];
-    std::strcpy(m_data, other.m_data);
+    if (other.m_borrowed) {
+        // release what this string had, and share the bytes
+        Release();
+        m_data = other.m_data;
+        m_size = other.m_size;
+        m_num_bytes = other.m_num_bytes;
+        m_length = other.m_length;
+        m_borrowed = true;
+        Changed();
+    } else {
+        Assign(other.m_data, other.m_num_bytes, other.m_length);
+    }
+
+    m_hash = other.m_hash;
+    m_hashed = other.m_hashed;
+
+    return *this;
+}
+
+Utf8String &Utf8String::operator=(Utf8String &&other)
+{
+    if (&other == this) {
+        return *this;
+    }
+
+    if (other.m_borrowed || other.m_data == other.m_inline) {
+        // nothing to take over
+        operator=((const Utf8String&)other);
+        return *this;
+    }
+
+    Release();
+    Changed();
+    m_data = other.m_data;
+    m_size = other.m_size;
+    m_num_bytes = other.m_num_bytes;
     m_length = other.m_length;
+    m_hash = other.m_hash;
+    m_hashed = other.m_hashed;
+    m_breadcrumbs = other.m_breadcrumbs;
+
+    // leave other as an empty string
+    other.m_data = other.m_inline;
+    other.m_size = inline_size;
+    other.m_data[0] = '\0';
+    other.m_num_bytes = 0;
+    other.m_length = 0;
+    other.m_hashed = false;
+    other.m_breadcrumbs = nullptr;
 
     return *this;
 }
 
 Utf8String Utf8String::operator+(const char *str) const
 {
-    Utf8String result(m_length + strlen(str));
-
-    utf8_strcpy(result.m_data, m_data);
-    utf8_strcat(result.m_data, str);
+    Utf8String result;
+    size_t size = std::strlen(str);
 
-    // calculate length
-    result.m_length = utf8_strlen(result.m_data);
+    result.Reserve(m_num_bytes + size, false);
+    result.Assign(m_data, m_num_bytes, m_length);
+    result.Append(str, size, (size_t)-1);
 
     return result;
 }
 
 Utf8String Utf8String::operator+(const Utf8String &other) const
 {
-    Utf8String result(m_length + other.m_length);
-
-    utf8_strcpy(result.m_data, m_data);
-    utf8_strcat(result.m_data, other.m_data);
+    Utf8String result;
 
-    // calculate length
-    result.m_length = utf8_strlen(result.m_data);
+    result.Reserve(m_num_bytes + other.m_num_bytes, false);
+    result.Assign(m_data, m_num_bytes, m_length);
+    result.Append(other.m_data, other.m_num_bytes, other.m_length);
 
     return result;
 }
 
 Utf8String &Utf8String::operator+=(const char *str)
 {
-    size_t this_len = std::strlen(m_data);
-    size_t other_len = std::strlen(str);
-
-    if (this_len + other_len < m_size) {
-        std::strcat(m_data, str);
-        m_size += other_len;
-        // calculate utf-8 length of string and add it
-        m_length += utf8_strlen(str);
-    } else {
-        // we must delete and recreate the array
-        m_size = this_len + other_len + 1;
-
-        char *new_data = new char[m_size];
-        std::strcpy(new_data, m_data);
-        std::strcat(new_data, str);
-        delete[] m_data;
-        m_data = new_data;
-        // recalculate length
-        m_length = utf8_strlen(m_data);
-    }
-
+    Append(str, std::strlen(str), (size_t)-1);
     return *this;
 }
 
 Utf8String &Utf8String::operator+=(const Utf8String &other)
 {
-    return operator+=(other.m_data);
+    if (&other == this) {
+        // the bytes move when the buffer grows
+        Utf8String copy(other);
+        Append(copy.m_data, copy.m_num_bytes, copy.m_length);
+    } else {
+        Append(other.m_data, other.m_num_bytes, other.m_length);
+    }
+    return *this;
 }
 
 u32char Utf8String::operator[](size_t index) const
 {
-    u32char result;
-    if (m_data == nullptr || ((result = utf8_charat(m_data, index) == (u32char(-1))))) {
+    if (m_length == (size_t)-1) {
+        // not valid UTF-8, so the length is not known
+        u32char result = utf8_charat(m_data, index);
+        if (result == (u32char)-1) {
+            throw std::out_of_range("index out of range");
+        }
+        return result;
+    }
+
+    if (index >= m_length) {
         throw std::out_of_range("index out of range");
     }
+
+    if (IsAscii()) {
+        return (unsigned char)m_data[index];
+    }
+
+    size_t offset = 0;
+    if (m_length > breadcrumb_interval) {
+        if (m_breadcrumbs == nullptr) {
+            BuildBreadcrumbs();
+        }
+        offset = m_breadcrumbs[index / breadcrumb_interval];
+        index %= breadcrumb_interval;
+    }
+
+    for (; index > 0; index--) {
+        offset += utf8_width((unsigned char)m_data[offset]);
+    }
+
+    // the same bytes that utf8_charat puts together,
+    // without reading past the end of the string
+    u32char result = 0;
+    size_t width = std::min<size_t>(utf8_width((unsigned char)m_data[offset]), m_num_bytes - offset);
+    std::memcpy(&result, m_data + offset, width);
     return result;
 }
 
+void Utf8String::BuildBreadcrumbs() const
+{
+    size_t num_breadcrumbs = (m_length - 1) / breadcrumb_interval + 1;
+    m_breadcrumbs = new size_t[num_breadcrumbs];
+
+    size_t offset = 0;
+    for (size_t i = 0; i < num_breadcrumbs; i++) {
+        m_breadcrumbs[i] = offset;
+        for (size_t j = 0; j < breadcrumb_interval && offset < m_num_bytes; j++) {
+            offset += utf8_width((unsigned char)m_data[offset]);
+        }
+    }
+}
+
 utf8_ostream &operator<<(utf8_ostream &os, const Utf8String &str)
 {
 #ifdef _WIN32